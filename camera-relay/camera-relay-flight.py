@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+"""Decode the camera-relay-monitor flight recorder.
+
+Reads the live ring ($XDG_RUNTIME_DIR/camera-relay.flight) or one of its
+dumps (.usr1, .crash, .stall, .failed, .prev) and prints a timeline of the
+relay events and frame timing statistics.
+
+Usage: camera-relay-flight.py [FILE] [--last SECONDS] [--frames] [--stats]
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+
+HEADER = struct.Struct("<8sIIIiQqIIQQ")
+EVENT = struct.Struct("<QIHHQ")
+
+# enum flight_type in camera-relay-monitor.c
+(FL_FRAME_IN, FL_FRAME_OUT, FL_CLIENTS, FL_EVENT, FL_PIPELINE_START, FL_PIPELINE_STOP,
+ FL_PIPELINE_EOF, FL_STALL, FL_PAUSE, FL_RESUME, FL_RECONFIGURE, FL_SNAPSHOT, FL_DUMP,
+ FL_CRASH) = range(1, 15)
+
+REASONS = ["live", "usr1", "crash", "stall", "failed"]
+
+DEFAULT_FILE = os.path.join(os.environ.get("XDG_RUNTIME_DIR", "/tmp"), "camera-relay.flight")
+
+
+def load(path):
+    """Return the header fields and the valid events, oldest first."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        sys.exit(f"{path}: too short for a flight recorder file")
+    (magic, version, capacity, event_size, pid, start_mono, start_real,
+     reason, _, head, _) = HEADER.unpack_from(data)
+    if magic != b"CRFLIGHT" or version != 1 or event_size != EVENT.size:
+        sys.exit(f"{path}: not a camera-relay flight recorder file")
+
+    events = []
+    first = max(0, head - capacity)
+    for seq in range(first, head):
+        offset = HEADER.size + (seq % capacity) * EVENT.size
+        if offset + EVENT.size > len(data):
+            break
+        t, value, kind, arg, stored = EVENT.unpack_from(data, offset)
+        # Skip slots being rewritten or already overwritten by a later lap
+        if stored == seq + 1:
+            events.append((t, kind, arg, value))
+    events.sort()
+    header = {"pid": pid, "start_mono": start_mono, "start_real": start_real,
+              "reason": REASONS[reason] if reason < len(REASONS) else str(reason),
+              "recorded": head, "capacity": capacity}
+    return header, events
+
+
+def wall(header, t):
+    ns = header["start_real"] + t - header["start_mono"]
+    return time.strftime("%H:%M:%S", time.localtime(ns // 10**9)) + ".%03d" % (ns // 10**6 % 1000)
+
+
+def describe(kind, arg, value):
+    if kind == FL_CLIENTS:
+        return f"clients      {value} with the device open"
+    if kind == FL_EVENT:
+        return f"event        {value} streaming reader(s)"
+    if kind == FL_PIPELINE_START:
+        return f"start        pipeline pid {value}"
+    if kind == FL_PIPELINE_STOP:
+        if os.WIFEXITED(value):
+            status = f"exit {os.WEXITSTATUS(value)}"
+        elif os.WIFSIGNALED(value):
+            status = f"signal {os.WTERMSIG(value)}"
+        else:
+            status = f"status {value:#x}"
+        return f"stop         {status}" + (" (killed after 3 s)" if arg else "")
+    if kind == FL_PIPELINE_EOF:
+        return f"eof          pipeline ended, short read of {value} bytes"
+    if kind == FL_STALL:
+        return f"stall        no frame for {value} ms"
+    if kind == FL_PAUSE:
+        return "pause"
+    if kind == FL_RESUME:
+        return "resume"
+    if kind == FL_RECONFIGURE:
+        return f"reconfigure  applied in {value} ms"
+    if kind == FL_SNAPSHOT:
+        return f"snapshot     {value} bytes"
+    if kind == FL_DUMP:
+        return "dump         " + (REASONS[arg] if arg < len(REASONS) else str(arg))
+    if kind == FL_CRASH:
+        return f"crash        signal {value}"
+    return f"type {kind}    arg {arg} value {value}"
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def ms(ns):
+    return ns / 1e6
+
+
+def timeline(header, events, frames):
+    """Print the events; runs of frames are folded into one line."""
+    run = []  # frame-in times of the current run
+
+    def flush():
+        if not run:
+            return
+        gaps = [b - a for a, b in zip(run, run[1:])]
+        line = f"frames       {len(run)}"
+        if gaps:
+            line += (f" in {ms(run[-1] - run[0]) / 1000:.1f} s,"
+                     f" gap avg {ms(sum(gaps) / len(gaps)):.1f} ms, max {ms(max(gaps)):.1f} ms")
+        print(f"  {wall(header, run[0])}  {line}")
+        run.clear()
+
+    last_in = None
+    for t, kind, arg, value in events:
+        if kind == FL_FRAME_IN:
+            if frames:
+                gap = f", gap {ms(t - last_in):.1f} ms" if last_in is not None else ""
+                print(f"  {wall(header, t)}  frame in     {value} bytes{gap}")
+            else:
+                run.append(t)
+            last_in = t
+            continue
+        if kind == FL_FRAME_OUT:
+            if frames:
+                write = (f", write {ms(t - last_in) * 1000:.0f} us"
+                         if last_in is not None else "")
+                print(f"  {wall(header, t)}  frame out    {value} bytes{write}")
+            continue
+        flush()
+        if kind in (FL_PIPELINE_START, FL_RESUME):
+            last_in = None
+        print(f"  {wall(header, t)}  {describe(kind, arg, value)}")
+    flush()
+
+
+def stats(events):
+    gaps, writes, short = [], [], 0
+    last_in = None
+    counts = {}
+    for t, kind, arg, value in events:
+        counts[kind] = counts.get(kind, 0) + 1
+        if kind == FL_FRAME_IN:
+            if last_in is not None:
+                gaps.append(t - last_in)
+            last_in = t
+        elif kind == FL_FRAME_OUT and last_in is not None:
+            writes.append(t - last_in)
+            if value == 0:
+                short += 1
+        elif kind in (FL_PIPELINE_START, FL_RESUME, FL_PIPELINE_STOP, FL_PAUSE):
+            # Gaps across a pipeline start or a pause aren't frame gaps
+            last_in = None
+
+    print(f"Frames:      {counts.get(FL_FRAME_IN, 0)} in, {counts.get(FL_FRAME_OUT, 0)} out"
+          + (f", {short} failed writes" if short else ""))
+    if gaps:
+        print("Frame gap:   avg %.1f ms, p50 %.1f, p95 %.1f, p99 %.1f, max %.1f ms" % (
+            ms(sum(gaps) / len(gaps)), ms(percentile(gaps, 50)), ms(percentile(gaps, 95)),
+            ms(percentile(gaps, 99)), ms(max(gaps))))
+        median = percentile(gaps, 50)
+        late = sum(1 for g in gaps if g > 2 * median)
+        print(f"Late frames: {late} with a gap over twice the median")
+    if writes:
+        print("Write:       avg %.0f us, p99 %.0f us, max %.0f us" % (
+            ms(sum(writes) / len(writes)) * 1000, ms(percentile(writes, 99)) * 1000,
+            ms(max(writes)) * 1000))
+    print(f"Pipeline:    {counts.get(FL_PIPELINE_START, 0)} start(s),"
+          f" {counts.get(FL_PIPELINE_EOF, 0)} ended by itself,"
+          f" {counts.get(FL_PAUSE, 0)} pause(s), {counts.get(FL_STALL, 0)} stall(s)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode the camera relay flight recorder")
+    parser.add_argument("file", nargs="?", default=DEFAULT_FILE,
+                        help="ring or dump file (default: the running relay's)")
+    parser.add_argument("--last", type=float, metavar="SECONDS",
+                        help="only the last SECONDS of events")
+    parser.add_argument("--frames", action="store_true",
+                        help="list every frame instead of folding them")
+    parser.add_argument("--stats", action="store_true",
+                        help="only the statistics, no timeline")
+    args = parser.parse_args()
+
+    try:
+        header, events = load(args.file)
+    except OSError as e:
+        sys.exit(f"{args.file}: {e.strerror}")
+    if args.last and events:
+        cutoff = events[-1][0] - int(args.last * 1e9)
+        events = [e for e in events if e[0] >= cutoff]
+
+    print(f"{args.file}: monitor pid {header['pid']}, {header['reason']},"
+          f" {len(events)} of {header['recorded']} events")
+    if events and not args.stats:
+        timeline(header, events, args.frames)
+        print()
+    stats(events)
+
+
+if __name__ == "__main__":
+    main()
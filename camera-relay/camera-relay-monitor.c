@@ -13,43 +13,441 @@
  * at any time and will see black frames until the camera initializes
  * (typically 2-3 seconds), then real frames appear automatically.
  *
+ * Between pipeline cycles the writer stays too: its client usage events
+ * are re-armed on the open fd, or, on v4l2loopback 0.12.x where they break
+ * after the first cycle, a spare writer takes over before the old fd
+ * closes. STATUS reports which as writer=in-place or writer=swap.
+ *
  * Events emitted on stdout (line-buffered):
  *   READY  — device open, watching for clients
  *   START  — client detected, pipeline starting
  *   STOP   — clients gone, pipeline stopped
+ *   PAUSE  — clients still open but none streaming, pipeline suspended
+ *   RESUME — a client streams again, pipeline continued
+ *
+ * Browsers keep the device open after a call or with the camera toggled
+ * off. v4l2loopback's client usage events carry the number of streaming
+ * readers; when it stays 0 while the device is open, the pipeline is
+ * suspended with SIGSTOP, so the SoftISP and conversion use no CPU, and
+ * continued on the next STREAMON without the 2-3 s camera startup. After
+ * PAUSE_RELEASE_SEC the pipeline is stopped for real, which releases the
+ * sensor; the next STREAMON starts it again from IDLE.
+ *
+ * With --control, a thread serves one-line commands on a Unix socket:
+ *   STATUS                    — relay state and counters as key=value lines
+ *   SNAPSHOT [raw|yuyv|nv12|ppm|png]
+ *                             — the next camera frame, at full resolution
+ *   RECONFIGURE               — re-read the settings, like SIGHUP, and
+ *                               report what changed
+ * While the pipeline runs, STATUS adds its CPU time per thread, and with
+ * --trace the GStreamer latency tracer's per-element latency.
+ * Replies start with "OK ..." or "ERR <reason>". A snapshot is copied out
+ * of the relay loop and converted on the control thread, so it adds no
+ * capture client and doesn't delay the frames going to the device.
+ *
+ * With --profiles, the capture format depends on the app that connected.
+ * The file has one line per app, matched against the client's comm or
+ * executable name (fnmatch patterns, first match wins):
+ *   firefox   960x540    30  NV12  3    size, fps, format, linger (s)
+ *   obs       1920x1080  30  YUYV  5
+ *   zbarcam   off                       never start the camera for it
+ * "-" keeps the default of a field. The profile is picked when the
+ * pipeline starts; the monitor re-opens the writer with that format and
+ * rewrites the pipeline's video/x-raw caps to match what the device took.
+ * Apps that connect later share the running format.
+ *
+ * With --config, a file of relay settings (default size, frame rate,
+ * format, linger and extra GStreamer filter elements, see load_config())
+ * overrides the command line's. On SIGHUP or RECONFIGURE the monitor
+ * re-reads it and the profiles, and applies them at the next frame
+ * boundary without releasing the writer fd: the device format is set
+ * again only if it changes, the pipeline is restarted only if its caps
+ * or filter change. Apps keep streaming from the device through the
+ * camera startup, instead of the device vanishing.
+ *
+ * With --flight, a ring of recent events (frames in and out, client
+ * counts, client events, pipeline starts, stops and stalls) is kept in a
+ * shared file and dumped on SIGUSR1, a crash, a stall or a failed
+ * pipeline; camera-relay-flight.py decodes it.
+ *
+ * With --scope, each pipeline runs in a systemd scope of its own, with the
+ * CPU and memory limits from --config, and STATUS adds the session's CPU
+ * time, pressure and peak memory from its cgroup (see scope_cmd()).
  *
- * Build:  gcc -O2 -Wall -o camera-relay-monitor camera-relay-monitor.c
- * Usage:  camera-relay-monitor /dev/video0 1920 1080 -- gst-launch-1.0 ...
+ * A profile size below the command line's is scaled from a size with the
+ * camera's full view, rather than cropped by the SoftISP; with --binning
+ * that is a binned half or quarter size (see profile_cmd()).
+ *
+ * Build:  gcc -O2 -Wall -pthread -o camera-relay-monitor camera-relay-monitor.c
+ * Usage:  camera-relay-monitor /dev/video0 1920 1080 [--control SOCKET]
+ *                              [--profiles FILE] [--config FILE]
+ *                              [--flight FILE] [--trace] [--scope]
+ *                              [--binning]
+ *                              -- gst-launch-1.0 ...
+ *         camera-relay-monitor --client SOCKET COMMAND > reply
  */
 
 #define _GNU_SOURCE
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <linux/videodev2.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 /* Event IDs for v4l2loopback versions */
 #define V4L2_EVENT_CLIENT_USAGE_OLD  (V4L2_EVENT_PRIVATE_START)
 #define V4L2_EVENT_CLIENT_USAGE_NEW  (V4L2_EVENT_PRIVATE_START + 0x08E00000 + 1)
 
+/* A suspended pipeline is stopped for real after this long */
+#define PAUSE_RELEASE_SEC 30
+
 static volatile sig_atomic_t running = 1;
 
+/*
+ * Streaming readers, from the last client usage event (-1: none yet).
+ * Only trusted once an event reported a reader: a driver that sends the
+ * event without a count would otherwise look like nobody ever streams.
+ */
+static int streaming_readers = -1;
+static int counts_trusted;
+
+/* Device format, only changed between pipeline frames */
+static atomic_int frame_width, frame_height, frame_bytes;
+static atomic_uint frame_format;
+
+/* Size of the frame buffers, YUY2 at the command line size */
+static int buffer_bytes;
+
+/* Per-application capture profiles (--profiles) */
+struct profile {
+	char app[64];		/* fnmatch() pattern for comm or exe name */
+	int index;		/* in profiles[], -1 for the default */
+	int off;		/* never start the camera for this app */
+	int width, height;
+	__u32 format;		/* V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_NV12 */
+	int fps;		/* 0: whatever the camera delivers */
+	int linger;		/* seconds to keep running without clients */
+};
+
+#define MAX_PROFILES 32
+static struct profile profiles[MAX_PROFILES];
+static int n_profiles;
+static struct profile default_profile = {
+	.app = "default", .index = -1, .linger = 3
+};
+
+/*
+ * Relay settings from --config, re-read on SIGHUP or RECONFIGURE. The
+ * command line gives cmdline_profile, the file overrides its fields in
+ * default_profile.
+ */
+static struct profile cmdline_profile;
+static char config_filter[256];		/* extra GStreamer elements */
+static char running_filter[256];	/* ... in the running pipeline */
+
+/* Resource limits of a pipeline's scope, see start_pipeline() */
+struct scope_limits {
+	int cpu_quota;			/* % of one CPU, 0 for none */
+	int cpu_weight;			/* 1-10000, 0 for systemd's default */
+	unsigned long long memory_high;	/* bytes, 0 for none */
+};
+static struct scope_limits config_limits;
+static volatile sig_atomic_t reload_wanted;
+static pthread_t main_thread;
+
+/* RECONFIGURE handoff, like the snapshot one below */
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reload_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long reload_seq;
+static char reload_result[128];
+static long reload_ms;
+
+/* A process that has the device open */
+struct client {
+	pid_t pid;
+	char comm[16];
+	char exe[64];
+};
+
+#define MAX_CLIENTS 8
+
+/* Relay state and counters, read by the control thread */
+static atomic_int relay_state;		/* 1 while the pipeline runs, 2 paused */
+static atomic_int pipeline_pid;
+static atomic_ullong frames_relayed;
+static atomic_uint pipeline_starts;
+static atomic_uint snapshots_served;
+static atomic_uint config_reloads;
+static atomic_int running_profile = -1;	/* index, -1 for the default */
+
+/*
+ * Snapshot handoff. The control thread sets snap_wanted and waits; the
+ * relay loop copies the next pipeline frame into snap_buf, bumps snap_seq
+ * and signals. Only the control thread sets snap_wanted, so it can read
+ * snap_buf without the lock once snap_seq has moved.
+ */
+static pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snap_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int snap_wanted;
+static unsigned long long snap_seq;
+static char *snap_buf;
+static int snap_width, snap_height, snap_bytes;
+static __u32 snap_format;
+
 static void handle_signal(int sig)
 {
 	(void)sig;
 	running = 0;
 }
 
+static void handle_reload(int sig)
+{
+	(void)sig;
+	reload_wanted = 1;
+}
+
+/* ── Flight recorder ────────────────────────────────────────────────── */
+
+/*
+ * With --flight FILE, the monitor keeps its recent events in a ring in
+ * FILE, mapped shared: it outlives a crashed monitor, and
+ * camera-relay-flight.py decodes it at any time. Recording an event is a
+ * clock read, an atomic increment and a 24 byte store, without locks, so
+ * the relay loop records every frame and all threads can record.
+ *
+ * The ring is copied to FILE.<reason> on SIGUSR1 (usr1), a fatal signal
+ * (crash), STALL_MS without a frame while relaying (stall) and a pipeline
+ * that ends by itself (failed). The ring of the previous run is kept as
+ * FILE.prev, for a monitor that was killed outright.
+ */
+#define FLIGHT_EVENTS 16384	/* power of two; 4.5 min of 30 fps frames */
+#define STALL_MS 1000
+
+enum flight_type {
+	FL_FRAME_IN = 1,	/* value: bytes read from the pipeline */
+	FL_FRAME_OUT,		/* value: bytes written to the device */
+	FL_CLIENTS,		/* value: other processes with the device open */
+	FL_EVENT,		/* value: streaming readers in a client event */
+	FL_PIPELINE_START,	/* value: pid */
+	FL_PIPELINE_STOP,	/* value: wait status, arg: 1 if killed */
+	FL_PIPELINE_EOF,	/* value: bytes of the short read */
+	FL_STALL,		/* value: ms since the last frame */
+	FL_PAUSE,
+	FL_RESUME,
+	FL_RECONFIGURE,		/* value: ms to apply */
+	FL_SNAPSHOT,
+	FL_DUMP,		/* arg: reason */
+	FL_CRASH,		/* value: signal */
+};
+
+enum flight_reason { FL_LIVE, FL_USR1, FL_CRASHED, FL_STALLED, FL_FAILED };
+static const char *const flight_reasons[] = {
+	"live", "usr1", "crash", "stall", "failed"
+};
+
+/* The file layout, read by camera-relay-flight.py */
+struct flight_event {
+	uint64_t time;		/* CLOCK_MONOTONIC, ns */
+	uint32_t value;
+	uint16_t type;
+	uint16_t arg;
+	_Atomic uint64_t seq;	/* sequence number + 1, stored last */
+};
+
+struct flight_header {
+	char magic[8];		/* "CRFLIGHT" */
+	uint32_t version;	/* 1 */
+	uint32_t capacity;	/* events in the ring */
+	uint32_t event_size;
+	int32_t pid;
+	uint64_t start_mono;	/* CLOCK_MONOTONIC at start, ns */
+	int64_t start_real;	/* CLOCK_REALTIME at start, ns */
+	uint32_t reason;	/* of the dump, enum flight_reason */
+	uint32_t reserved;
+	_Atomic uint64_t head;	/* next sequence number */
+	uint64_t pad;
+};
+
+_Static_assert(sizeof(struct flight_event) == 24, "flight event layout");
+_Static_assert(sizeof(struct flight_header) == 64, "flight header layout");
+
+static struct flight_header *flight;
+static struct flight_event *flight_ring;
+static char flight_dumps[5][256];	/* dump paths, for signal handlers */
+static atomic_ullong last_frame_ns;	/* 0 until the pipeline's first */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Record an event, returns its time. Async-signal-safe. */
+static uint64_t flight_record(int type, int arg, uint32_t value)
+{
+	uint64_t time = now_ns();
+
+	if (!flight)
+		return time;
+
+	uint64_t seq = atomic_fetch_add_explicit(&flight->head, 1,
+						 memory_order_relaxed);
+	struct flight_event *e = &flight_ring[seq & (FLIGHT_EVENTS - 1)];
+
+	/* A reader skips the slot while it is rewritten */
+	atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	e->time = time;
+	e->value = value;
+	e->type = type;
+	e->arg = arg;
+	atomic_store_explicit(&e->seq, seq + 1, memory_order_release);
+	return time;
+}
+
+/* Copy the ring to FILE.<reason>. Async-signal-safe. */
+static void flight_dump(int reason)
+{
+	struct flight_header header;
+	size_t ring = sizeof(*flight_ring) * FLIGHT_EVENTS;
+
+	if (!flight)
+		return;
+	flight_record(FL_DUMP, reason, 0);
+
+	int fd = open(flight_dumps[reason], O_WRONLY | O_CREAT | O_TRUNC |
+		      O_CLOEXEC, 0600);
+	if (fd < 0)
+		return;
+	memcpy(&header, flight, sizeof(header));
+	header.reason = reason;
+	/* Dumps go to tmpfs, where writes aren't short */
+	if (write(fd, &header, sizeof(header)) == sizeof(header))
+		(void)!write(fd, flight_ring, ring);
+	close(fd);
+}
+
+static void handle_dump(int sig)
+{
+	(void)sig;
+	flight_dump(FL_USR1);
+}
+
+/* Dump, then raise the signal again: SA_RESETHAND restored its default
+ * action, which runs once the handler returns. */
+static void handle_crash(int sig)
+{
+	flight_record(FL_CRASH, 0, sig);
+	flight_dump(FL_CRASHED);
+	raise(sig);
+}
+
+static int flight_open(const char *path)
+{
+	size_t size = sizeof(struct flight_header) +
+		      sizeof(struct flight_event) * FLIGHT_EVENTS;
+	char prev[256];
+	struct timespec real;
+
+	for (int i = 1; i < 5; i++)
+		if (snprintf(flight_dumps[i], sizeof(flight_dumps[i]),
+			     "%s.%s", path, flight_reasons[i]) >=
+		    (int)sizeof(flight_dumps[i]))
+			return -1;
+	snprintf(prev, sizeof(prev), "%s.prev", path);
+	rename(path, prev);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		fprintf(stderr, "[monitor] Flight recorder %s: %s\n", path,
+			strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "[monitor] Flight recorder mmap: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	struct flight_header *h = map;
+	clock_gettime(CLOCK_REALTIME, &real);
+	h->version = 1;
+	h->capacity = FLIGHT_EVENTS;
+	h->event_size = sizeof(struct flight_event);
+	h->pid = getpid();
+	h->start_mono = now_ns();
+	h->start_real = (int64_t)real.tv_sec * 1000000000 + real.tv_nsec;
+	memcpy(h->magic, "CRFLIGHT", 8);
+	flight_ring = (struct flight_event *)(h + 1);
+	flight = h;
+
+	struct sigaction sa = { .sa_handler = handle_crash,
+				.sa_flags = SA_RESETHAND };
+	sigaction(SIGSEGV, &sa, NULL);
+	sigaction(SIGBUS, &sa, NULL);
+	sigaction(SIGFPE, &sa, NULL);
+	sigaction(SIGILL, &sa, NULL);
+	sigaction(SIGABRT, &sa, NULL);
+	sa.sa_handler = handle_dump;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+	return 0;
+}
+
+/*
+ * Watch for frames that stop coming while the pipeline runs. The relay
+ * loop blocks in read() then, so it can't notice by itself.
+ */
+static void *watchdog_thread(void *arg)
+{
+	int stalled = 0;
+
+	(void)arg;
+	for (;;) {
+		usleep(250000);
+		uint64_t last = atomic_load(&last_frame_ns);
+		uint64_t ms = (now_ns() - last) / 1000000;
+
+		if (atomic_load(&relay_state) != 1 || !last ||
+		    ms < STALL_MS) {
+			stalled = 0;
+			continue;
+		}
+		if (stalled)
+			continue;
+		stalled = 1;
+		fprintf(stderr, "[monitor] No frame for %llu ms\n",
+			(unsigned long long)ms);
+		flight_record(FL_STALL, 0, ms);
+		flight_dump(FL_STALLED);
+	}
+	return NULL;
+}
+
 static int xioctl(int fd, unsigned long request, void *arg)
 {
 	int r;
@@ -59,8 +457,38 @@ static int xioctl(int fd, unsigned long request, void *arg)
 	return r;
 }
 
+/* Fill in the comm and executable name of a client process */
+static void name_client(struct client *c, long pid)
+{
+	char path[64], exe[256];
+	ssize_t n;
+	int fd;
+
+	c->pid = pid;
+	c->comm[0] = c->exe[0] = '\0';
+
+	snprintf(path, sizeof(path), "/proc/%ld/comm", pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		n = read(fd, c->comm, sizeof(c->comm) - 1);
+		c->comm[n > 0 ? n : 0] = '\0';
+		c->comm[strcspn(c->comm, "\n")] = '\0';
+		close(fd);
+	}
+
+	snprintf(path, sizeof(path), "/proc/%ld/exe", pid);
+	n = readlink(path, exe, sizeof(exe) - 1);
+	if (n > 0) {
+		exe[n] = '\0';
+		const char *base = strrchr(exe, '/');
+		snprintf(c->exe, sizeof(c->exe), "%.63s",
+			 base ? base + 1 : exe);
+	}
+}
+
 /* Count processes (other than ours and our children) that have this
- * device open. Skips our PID and the pipeline child PID.
+ * device open. Skips our PID and the pipeline child PID. With a list,
+ * the first max of them are named for the profile lookup.
  *
  * Uses stat() + dev_t comparison on fd symlinks — this is path-
  * independent and works regardless of how the device was opened
@@ -68,7 +496,8 @@ static int xioctl(int fd, unsigned long request, void *arg)
  * processes for efficiency.
  */
 static int count_other_openers(dev_t dev_id, pid_t our_pid,
-			       pid_t child_pid)
+			       pid_t child_pid, struct client *list,
+			       int max)
 {
 	DIR *proc_dir;
 	struct dirent *proc_entry;
@@ -132,39 +561,515 @@ static int count_other_openers(dev_t dev_id, pid_t our_pid,
 			}
 		}
 		closedir(fd_dir);
-		if (found)
+		if (found) {
+			if (list && count < max)
+				name_client(&list[count], pid);
 			count++;
+		}
 	}
 	closedir(proc_dir);
+
+	/* Only the relay loop counts, it owns last_count */
+	static int last_count = -1;
+	if (count != last_count) {
+		flight_record(FL_CLIENTS, 0, count);
+		last_count = count;
+	}
 	return count;
 }
 
-/* Open device for writing, set format, write initial black frame.
- * Returns fd on success, -1 on failure. */
-static int open_writer(const char *device, int width, int height,
-		       int frame_size, const char *black_frame)
+/* ── Capture profiles ───────────────────────────────────────────────── */
+
+static int frame_size_of(int width, int height, __u32 format)
 {
-	int fd = open(device, O_WRONLY);
-	if (fd < 0) {
-		fprintf(stderr, "[monitor] Cannot open %s: %s\n",
-			device, strerror(errno));
+	if (format == V4L2_PIX_FMT_NV12)
+		return width * height * 3 / 2;
+	return width * height * 2;
+}
+
+static const char *format_name(__u32 format)
+{
+	return format == V4L2_PIX_FMT_NV12 ? "NV12" : "YUYV";
+}
+
+/*
+ * Load the --profiles file, replacing the profiles loaded before. Bad
+ * lines are reported and skipped, sizes are limited to the frame size
+ * given on the command line, which the buffers are allocated for. A
+ * missing file is the same as an empty one, so one created later is
+ * picked up on the next reload.
+ */
+static int load_profiles(const char *path)
+{
+	FILE *f = fopen(path, "re");
+	char line[256];
+	int lineno = 0;
+
+	n_profiles = 0;
+	if (!f) {
+		if (errno == ENOENT)
+			return 0;
+		fprintf(stderr, "[monitor] Profiles %s: %s\n", path,
+			strerror(errno));
 		return -1;
 	}
 
+	while (fgets(line, sizeof(line), f)) {
+		char app[64], size[32] = "-", fps[16] = "-";
+		char format[16] = "-", linger[16] = "-";
+		struct profile *p = &profiles[n_profiles];
+
+		lineno++;
+		line[strcspn(line, "#")] = '\0';
+		if (sscanf(line, "%63s %31s %15s %15s %15s", app, size, fps,
+			   format, linger) < 1)
+			continue;
+		if (n_profiles == MAX_PROFILES) {
+			fprintf(stderr, "[monitor] %s: more than %d profiles,"
+				" rest ignored\n", path, MAX_PROFILES);
+			break;
+		}
+
+		*p = default_profile;
+		p->index = n_profiles;
+		snprintf(p->app, sizeof(p->app), "%s", app);
+		if (!strcmp(size, "off")) {
+			p->off = 1;
+			n_profiles++;
+			continue;
+		}
+
+		if (strcmp(size, "-") &&
+		    sscanf(size, "%dx%d", &p->width, &p->height) != 2)
+			goto bad;
+		if (strcmp(fps, "-"))
+			p->fps = atoi(fps);
+		if (!strcasecmp(format, "NV12"))
+			p->format = V4L2_PIX_FMT_NV12;
+		else if (strcasecmp(format, "YUYV") &&
+			 strcasecmp(format, "YUY2") && strcmp(format, "-"))
+			goto bad;
+		if (strcmp(linger, "-"))
+			p->linger = atoi(linger);
+
+		if (p->width < 2 || p->height < 2 || p->width % 2 ||
+		    p->height % 2 || p->fps < 0 || p->fps > 120 ||
+		    p->linger < 0 ||
+		    frame_size_of(p->width, p->height, p->format) >
+		    buffer_bytes)
+			goto bad;
+		n_profiles++;
+		continue;
+bad:
+		fprintf(stderr, "[monitor] %s:%d: invalid profile, ignored\n",
+			path, lineno);
+	}
+	fclose(f);
+
+	fprintf(stderr, "[monitor] %d profile(s) from %s\n", n_profiles,
+		path);
+	return 0;
+}
+
+/*
+ * Load the --config file into default_profile and config_filter. Each line
+ * is a setting and its value:
+ *   size    960x540          default capture size, at most the command
+ *                            line's
+ *   fps     30               default frame rate, 0 for the camera's
+ *   format  NV12             default format, YUYV or NV12
+ *   linger  5                default linger (s)
+ *   filter  videobalance saturation=0.85
+ *                            GStreamer elements before the caps, after a
+ *                            videoconvert (added if the pipeline has none)
+ *   cpu_quota    150%        with --scope: CPU time cap, in % of one CPU
+ *   cpu_weight   50          with --scope: CPU share (100 is the default)
+ *   memory_high  512M        with --scope: memory above which the
+ *                            pipeline is throttled and reclaimed
+ * Settings that aren't in the file keep the command line's values, so a
+ * missing file is the same as an empty one.
+ */
+static void load_config(const char *path)
+{
+	FILE *f = fopen(path, "re");
+	char line[320];
+	int lineno = 0;
+
+	default_profile = cmdline_profile;
+	config_filter[0] = '\0';
+	memset(&config_limits, 0, sizeof(config_limits));
+	if (!f) {
+		if (errno != ENOENT)
+			fprintf(stderr, "[monitor] Config %s: %s\n", path,
+				strerror(errno));
+		return;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct profile p = default_profile;
+		char key[16], *value;
+		int n;
+
+		lineno++;
+		line[strcspn(line, "#\n")] = '\0';
+		if (sscanf(line, "%15s %n", key, &n) < 1)
+			continue;
+		value = line + n;
+		value[strcspn(value, "\r")] = '\0';
+		for (char *end = value + strlen(value);
+		     end > value && (end[-1] == ' ' || end[-1] == '\t');)
+			*--end = '\0';
+
+		if (!strcmp(key, "size")) {
+			if (sscanf(value, "%dx%d", &p.width, &p.height) != 2)
+				goto bad;
+		} else if (!strcmp(key, "fps")) {
+			p.fps = atoi(value);
+		} else if (!strcmp(key, "format")) {
+			if (!strcasecmp(value, "NV12"))
+				p.format = V4L2_PIX_FMT_NV12;
+			else if (!strcasecmp(value, "YUYV") ||
+				 !strcasecmp(value, "YUY2"))
+				p.format = V4L2_PIX_FMT_YUYV;
+			else
+				goto bad;
+		} else if (!strcmp(key, "linger")) {
+			p.linger = atoi(value);
+		} else if (!strcmp(key, "filter") &&
+			   strlen(value) < sizeof(config_filter)) {
+			strcpy(config_filter, value);
+			continue;
+		} else if (!strcmp(key, "cpu_quota")) {
+			char *end;
+			long quota = strtol(value, &end, 10);
+
+			if (quota < 1 || quota > 100 * 1024 ||
+			    (*end && strcmp(end, "%")))
+				goto bad;
+			config_limits.cpu_quota = quota;
+			continue;
+		} else if (!strcmp(key, "cpu_weight")) {
+			int weight = atoi(value);
+
+			if (weight < 1 || weight > 10000)
+				goto bad;
+			config_limits.cpu_weight = weight;
+			continue;
+		} else if (!strcmp(key, "memory_high")) {
+			char *end;
+			unsigned long long bytes = strtoull(value, &end, 10);
+
+			switch (*end) {
+			case 'G': case 'g': bytes <<= 10;	/* fall through */
+			case 'M': case 'm': bytes <<= 10;	/* fall through */
+			case 'K': case 'k': bytes <<= 10; end++;
+			}
+			if (bytes < (1 << 20) || *end)
+				goto bad;
+			config_limits.memory_high = bytes;
+			continue;
+		} else {
+			goto bad;
+		}
+
+		if (p.width < 2 || p.height < 2 || p.width % 2 ||
+		    p.height % 2 || p.fps < 0 || p.fps > 120 ||
+		    p.linger < 0 ||
+		    frame_size_of(p.width, p.height, p.format) > buffer_bytes)
+			goto bad;
+		default_profile = p;
+		continue;
+bad:
+		fprintf(stderr, "[monitor] %s:%d: invalid setting, ignored\n",
+			path, lineno);
+	}
+	fclose(f);
+
+	fprintf(stderr, "[monitor] Config %s: %dx%d %s, %d fps,"
+		" linger %d s%s%s\n", path, default_profile.width, default_profile.height,
+		format_name(default_profile.format), default_profile.fps,
+		default_profile.linger, config_filter[0] ? ", filter " : "",
+		config_filter);
+	if (config_limits.cpu_quota || config_limits.cpu_weight ||
+	    config_limits.memory_high)
+		fprintf(stderr, "[monitor] Pipeline limits: cpu_quota %d%%,"
+			" cpu_weight %d, memory_high %llu MiB\n",
+			config_limits.cpu_quota, config_limits.cpu_weight,
+			config_limits.memory_high >> 20);
+}
+
+static const struct profile *match_profile(const struct client *c)
+{
+	for (int i = 0; i < n_profiles; i++) {
+		const char *app = profiles[i].app;
+
+		if (fnmatch(app, c->comm, 0) == 0 ||
+		    (c->exe[0] && fnmatch(app, c->exe, 0) == 0))
+			return &profiles[i];
+	}
+	return &default_profile;
+}
+
+/* The clients of the last profile choice, see log_clients() */
+static struct client chosen_clients[MAX_CLIENTS];
+static int n_chosen_clients;
+
+/*
+ * Count the clients the camera runs for, i.e. the ones whose profile isn't
+ * "off". With chosen, also pick the profile for them: they share a single
+ * stream, so the largest frame wins, then the highest frame rate, and the
+ * longest linger. Clients past MAX_CLIENTS get the default profile.
+ */
+static int active_clients(dev_t dev_id, pid_t our_pid, pid_t child_pid,
+			  struct profile *chosen)
+{
+	struct client list[MAX_CLIENTS];
+	const struct profile *best = NULL;
+	int active = 0, linger = 0;
+
+	if (!n_profiles) {
+		if (chosen)
+			*chosen = default_profile;
+		return count_other_openers(dev_id, our_pid, child_pid,
+					   NULL, 0);
+	}
+
+	int count = count_other_openers(dev_id, our_pid, child_pid, list,
+					MAX_CLIENTS);
+	for (int i = 0; i < count; i++) {
+		const struct profile *p = i < MAX_CLIENTS ?
+			match_profile(&list[i]) : &default_profile;
+
+		if (p->off)
+			continue;
+		active++;
+
+		/* fps 0 is the camera's full rate */
+		long area = (long)p->width * p->height;
+		long best_area = best ? (long)best->width * best->height : 0;
+		int fps = p->fps ? p->fps : 1000;
+		int best_fps = best && best->fps ? best->fps : 1000;
+		if (!best || area > best_area ||
+		    (area == best_area && fps > best_fps))
+			best = p;
+		if (p->linger > linger)
+			linger = p->linger;
+	}
+
+	if (chosen && best) {
+		*chosen = *best;
+		chosen->linger = linger;
+		n_chosen_clients = count < MAX_CLIENTS ? count : MAX_CLIENTS;
+		memcpy(chosen_clients, list,
+		       n_chosen_clients * sizeof(*list));
+	}
+	return active;
+}
+
+/*
+ * Log the profile each client of the last choice got. Only when a
+ * pipeline starts or the profile changes: the IDLE /proc fallback picks
+ * a profile every 2 s while a browser keeps the device open.
+ */
+static void log_clients(void)
+{
+	for (int i = 0; i < n_chosen_clients; i++)
+		fprintf(stderr, "[monitor] Client %d (%s): %s\n",
+			chosen_clients[i].pid, chosen_clients[i].comm,
+			match_profile(&chosen_clients[i])->app);
+}
+
+/*
+ * With --binning the patched SoftISP bins half and a quarter of the full
+ * size during the debayer, but only for RGB output; any other size, or
+ * YUV, is a centre crop of the sensor.
+ */
+static int binning_enabled;
+
+/*
+ * The caps libcamerasrc is asked for so the device size keeps the full
+ * view: the smallest binned size that holds it, else the full size of
+ * the command line. Returns the binning factor, 0 with empty caps if the
+ * device has the full size.
+ */
+static int source_caps(char *caps, size_t size)
+{
+	int width = cmdline_profile.width, height = cmdline_profile.height;
+	int bin = 1;
+
+	caps[0] = '\0';
+	if (frame_width == width && frame_height == height)
+		return 0;
+
+	if (binning_enabled)
+		for (bin = 4; bin > 1; bin /= 2)
+			if (frame_width <= width / bin &&
+			    frame_height <= height / bin)
+				break;
+	if (bin > 1)
+		snprintf(caps, size, "video/x-raw,format={RGBx,BGRx,RGBA,"
+			 "BGRA,RGB,BGR},width=%d,height=%d",
+			 width / bin, height / bin);
+	else
+		snprintf(caps, size, "video/x-raw,width=%d,height=%d",
+			 width, height);
+	return bin;
+}
+
+/*
+ * The pipeline command with its video/x-raw caps replaced by the device
+ * format and the profile's frame rate, and the config's filter elements
+ * in front of them. Records the filter in running_filter.
+ *
+ * Below the full size, libcamerasrc is asked for source_caps() and
+ * videoscale brings that to the device size: the SoftISP would crop a
+ * smaller size out of the centre, a zoomed-in view.
+ */
+static char **profile_cmd(char **cmd, const struct profile *p)
+{
+	/* A filter word takes at least two of its characters */
+	static char *argv[128 + sizeof(config_filter) / 2 + 7];
+	static char caps[160], source[160];
+	static char filter[sizeof(config_filter)];
+	int convert = 0, filtered = 0, camera = 0, sourced = 0, i, j = 0;
+	int bin;
+
+	strcpy(running_filter, config_filter);
+	strcpy(filter, config_filter);
+	bin = source_caps(source, sizeof(source));
+
+	for (i = 0; cmd[i]; i++) {
+		if (i == 127)
+			return cmd;
+		if (strcmp(cmd[i], "videoconvert") == 0)
+			convert = 1;
+
+
+		/* "libcamerasrc ... !" becomes "libcamerasrc ... ! source !" */
+		if (strcmp(cmd[i], "libcamerasrc") == 0) {
+			camera = 1;
+		} else if (camera && bin && !sourced &&
+			   strcmp(cmd[i], "!") == 0) {
+			argv[j++] = "!";
+			argv[j++] = source;
+			sourced = 1;
+		}
+
+		if (strncmp(cmd[i], "video/x-raw", 11) == 0) {
+			int n = snprintf(caps, sizeof(caps),
+				"video/x-raw,format=%s,width=%d,height=%d",
+				frame_format == V4L2_PIX_FMT_NV12 ?
+					"NV12" : "YUY2",
+				frame_width, frame_height);
+			if (p->fps)
+				snprintf(caps + n, sizeof(caps) - n,
+					 ",framerate=%d/1", p->fps);
+
+			/* "! caps" becomes "! [videoconvert !] filter
+			 * [! videoscale] ! caps" */
+			char *save, *word = filtered ? NULL :
+				strtok_r(filter, " \t", &save);
+			filtered = 1;
+			if ((word || (sourced && bin > 1)) && !convert) {
+				argv[j++] = "videoconvert";
+				argv[j++] = "!";
+			}
+			if (word) {
+				for (; word; word = strtok_r(NULL, " \t",
+							    &save))
+					argv[j++] = word;
+				argv[j++] = "!";
+			}
+			if (sourced) {
+				argv[j++] = "videoscale";
+				argv[j++] = "!";
+			}
+			argv[j++] = caps;
+			continue;
+		}
+		argv[j++] = cmd[i];
+	}
+	argv[j] = NULL;
+	return argv;
+}
+
+/* BT.601 black: Y=0x10, U=V=0x80 */
+static void fill_black(char *buf, int width, int height, __u32 format)
+{
+	int pixels = width * height;
+
+	if (format == V4L2_PIX_FMT_NV12) {
+		memset(buf, 0x10, pixels);
+		memset(buf + pixels, 0x80, pixels / 2);
+		return;
+	}
+	for (int i = 0; i < pixels * 2; i += 4) {
+		buf[i + 0] = 0x10;
+		buf[i + 1] = 0x80;
+		buf[i + 2] = 0x10;
+		buf[i + 3] = 0x80;
+	}
+}
+
+/* Set the format on the writer fd and fill the black frame for it.
+ * v4l2loopback keeps its format while a reader holds buffers, so the
+ * format the device actually took is read back into frame_width,
+ * frame_height, frame_format and frame_bytes. */
+static void set_format(int fd, int width, int height, __u32 format,
+		       char *black_frame)
+{
 	struct v4l2_format fmt;
 	memset(&fmt, 0, sizeof(fmt));
 	fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
 	fmt.fmt.pix.width = width;
 	fmt.fmt.pix.height = height;
-	fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-	fmt.fmt.pix.sizeimage = frame_size;
+	fmt.fmt.pix.pixelformat = format;
+	fmt.fmt.pix.sizeimage = frame_size_of(width, height, format);
 	fmt.fmt.pix.field = V4L2_FIELD_NONE;
 
 	if (xioctl(fd, VIDIOC_S_FMT, &fmt) < 0)
 		fprintf(stderr, "[monitor] S_FMT warning: %s\n",
 			strerror(errno));
 
-	if (write(fd, black_frame, frame_size) != frame_size)
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	if (xioctl(fd, VIDIOC_G_FMT, &fmt) == 0 &&
+	    (fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV ||
+	     fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_NV12) &&
+	    frame_size_of(fmt.fmt.pix.width, fmt.fmt.pix.height,
+			  fmt.fmt.pix.pixelformat) <= buffer_bytes) {
+		if (fmt.fmt.pix.width != (__u32)width ||
+		    fmt.fmt.pix.height != (__u32)height ||
+		    fmt.fmt.pix.pixelformat != format)
+			fprintf(stderr, "[monitor] Device kept %ux%u %s\n",
+				fmt.fmt.pix.width, fmt.fmt.pix.height,
+				format_name(fmt.fmt.pix.pixelformat));
+		width = fmt.fmt.pix.width;
+		height = fmt.fmt.pix.height;
+		format = fmt.fmt.pix.pixelformat;
+	}
+
+	frame_width = width;
+	frame_height = height;
+	frame_format = format;
+	frame_bytes = frame_size_of(width, height, format);
+	fill_black(black_frame, width, height, format);
+}
+
+/* Open device for writing, set format, write initial black frame.
+ * Returns fd on success, -1 on failure. */
+static int open_writer(const char *device, int width, int height,
+		       __u32 format, char *black_frame)
+{
+	int fd = open(device, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "[monitor] Cannot open %s: %s\n",
+			device, strerror(errno));
+		return -1;
+	}
+
+	set_format(fd, width, height, format, black_frame);
+	if (write(fd, black_frame, frame_bytes) != frame_bytes)
 		fprintf(stderr, "[monitor] Initial write warning: %s\n",
 			strerror(errno));
 
@@ -198,26 +1103,696 @@ static __u32 try_subscribe_events(int fd)
 	return 0;
 }
 
-/* Read exactly n bytes from fd. Returns n on success, <n on EOF/error. */
-static int read_full(int fd, char *buf, int n)
-{
-	int total = 0;
-	while (total < n) {
-		int r = read(fd, buf + total, n - total);
-		if (r <= 0) {
-			if (r == -1 && errno == EINTR)
+static void note_event(const struct v4l2_event *ev)
+{
+	__u32 count;
+
+	memcpy(&count, ev->u.data, sizeof(count));
+	flight_record(FL_EVENT, 0, count);
+	streaming_readers = count;
+	if (count > 0)
+		counts_trusted = 1;
+}
+
+/* Drain pending client usage events without blocking */
+static void read_events(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLPRI };
+
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLPRI)) {
+		struct v4l2_event ev;
+		memset(&ev, 0, sizeof(ev));
+		if (xioctl(fd, VIDIOC_DQEVENT, &ev) < 0)
+			break;
+		note_event(&ev);
+	}
+}
+
+/* Clients hold the device open, but none of them is streaming */
+static int readers_idle(void)
+{
+	return counts_trusted && streaming_readers == 0;
+}
+
+/*
+ * Writer cycling. After a pipeline cycle the writer goes back to the
+ * default format and its client usage events are armed again. On
+ * v4l2loopback 0.13+ both happen on the open fd: S_FMT, then the event is
+ * unsubscribed and subscribed again, and the initial event brings the
+ * current reader count. On 0.12.x (0.12.7 at least) events break for good
+ * after the first pipeline cycle and only a new opener gets working ones.
+ * There a spare writer, opened while the relay ran, takes over from the
+ * old fd, so the device never goes without a producer and the next client
+ * doesn't wait for an open and S_FMT.
+ */
+#define V4L2LOOPBACK_EVENTS_FIXED ((0 << 16) | (13 << 8) | 0)
+
+static int writer_in_place;	/* re-arm on the open fd, else swap */
+static int spare_fd = -1;	/* next writer on 0.12.x */
+
+/* The v4l2loopback version of the device, 0 if unknown */
+static __u32 loopback_version(int fd)
+{
+	struct v4l2_capability cap;
+
+	memset(&cap, 0, sizeof(cap));
+	if (xioctl(fd, VIDIOC_QUERYCAP, &cap) < 0 ||
+	    strcmp((const char *)cap.driver, "v4l2 loopback") != 0)
+		return 0;
+	return cap.version;
+}
+
+/* Wait briefly for the initial event of a subscription (not sent by all
+ * v4l2loopback versions). It has the current reader count. Returns 1 if
+ * it came. */
+static int drain_initial_event(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLPRI };
+	struct v4l2_event ev;
+
+	if (poll(&pfd, 1, 200) <= 0)
+		return 0;
+	memset(&ev, 0, sizeof(ev));
+	if (xioctl(fd, VIDIOC_DQEVENT, &ev) < 0)
+		return 0;
+	note_event(&ev);
+	return 1;
+}
+
+/* Pick how the writer is cycled, from the driver version and whether the
+ * first subscription sent its initial event */
+static void choose_writer_cycling(int fd, const char *device,
+				  __u32 event_type, int initial_event)
+{
+	__u32 version = loopback_version(fd);
+	int fixed;
+
+	if (version)
+		fprintf(stderr, "[monitor] v4l2loopback %u.%u.%u\n",
+			version >> 16, (version >> 8) & 0xff, version & 0xff);
+	fixed = version ? version >= V4L2LOOPBACK_EVENTS_FIXED :
+			  event_type == V4L2_EVENT_CLIENT_USAGE_NEW;
+	writer_in_place = fixed && (!event_type || initial_event);
+	if (writer_in_place) {
+		fprintf(stderr, "[monitor] Re-arming the writer in place"
+			" after each cycle\n");
+		return;
+	}
+
+	spare_fd = open(device, O_WRONLY | O_CLOEXEC);
+	fprintf(stderr, "[monitor] Re-opening the writer after each cycle,"
+		" %s\n", spare_fd >= 0 ? "with a spare writer" :
+		strerror(errno));
+}
+
+/* Subscribe the events again on the same fd. Returns 1 if the initial
+ * event shows they work. */
+static int rearm_events(int fd, __u32 event_type)
+{
+	struct v4l2_event_subscription sub;
+
+	streaming_readers = -1;
+	memset(&sub, 0, sizeof(sub));
+	sub.type = event_type;
+	xioctl(fd, VIDIOC_UNSUBSCRIBE_EVENT, &sub);
+	sub.flags = V4L2_EVENT_SUB_FL_SEND_INITIAL;
+	if (xioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0)
+		return 0;
+	return drain_initial_event(fd);
+}
+
+/*
+ * Hand the device over to a new writer with the format of profile p, and
+ * close the old one. With the format unchanged the new writer produces
+ * before the old one closes; a new format can only be set once it has.
+ * Returns the new fd, or the old one if no writer could be opened.
+ */
+static int swap_writer(int fd, const char *device, const struct profile *p,
+		       char *black_frame, __u32 *event_type)
+{
+	int same = p->width == frame_width && p->height == frame_height &&
+		   p->format == frame_format;
+	int next = spare_fd;
+	ssize_t n;
+
+	spare_fd = -1;
+	if (next < 0)
+		next = open(device, O_WRONLY | O_CLOEXEC);
+	if (next < 0) {
+		fprintf(stderr, "[monitor] Cannot open %s: %s\n",
+			device, strerror(errno));
+		return fd;
+	}
+
+	/* May fail with EBUSY where only one writer may produce; the write
+	 * after close() takes over then */
+	if (same)
+		n = write(next, black_frame, frame_bytes);
+	close(fd);
+	streaming_readers = -1;
+	if (!same)
+		set_format(next, p->width, p->height, p->format, black_frame);
+	n = write(next, black_frame, frame_bytes);
+	if (n != frame_bytes)
+		fprintf(stderr, "[monitor] Initial write warning: %s\n",
+			strerror(errno));
+
+	if (*event_type) {
+		*event_type = try_subscribe_events(next);
+		if (*event_type)
+			drain_initial_event(next);
+		else
+			fprintf(stderr, "[monitor] Event re-sub failed,"
+				" using /proc polling\n");
+	}
+
+	spare_fd = open(device, O_WRONLY | O_CLOEXEC);
+	if (spare_fd < 0)
+		fprintf(stderr, "[monitor] No spare writer: %s\n",
+			strerror(errno));
+	return next;
+}
+
+/*
+ * Put the writer in the format of profile p and, with rearm, arm its
+ * events again for the next cycle. Returns the writer fd.
+ */
+static int cycle_writer(int fd, const char *device, const struct profile *p,
+			char *black_frame, __u32 *event_type, int rearm)
+{
+	if (!writer_in_place)
+		return swap_writer(fd, device, p, black_frame, event_type);
+
+	if (p->width != frame_width || p->height != frame_height ||
+	    p->format != frame_format)
+		set_format(fd, p->width, p->height, p->format, black_frame);
+	if (!rearm || !*event_type || rearm_events(fd, *event_type))
+		return fd;
+
+	fprintf(stderr, "[monitor] Events did not re-arm, re-opening the"
+		" writer after each cycle from now on\n");
+	writer_in_place = 0;
+	return swap_writer(fd, device, p, black_frame, event_type);
+}
+
+/* Read exactly n bytes from fd. Returns n on success, <n on EOF/error. */
+static int read_full(int fd, char *buf, int n)
+{
+	int total = 0;
+	while (total < n) {
+		int r = read(fd, buf + total, n - total);
+		if (r <= 0) {
+			if (r == -1 && errno == EINTR)
+				continue;
+			return total;  /* EOF or error */
+		}
+		total += r;
+	}
+	return total;
+}
+
+/* ── Pipeline scope ─────────────────────────────────────────────────── */
+
+/*
+ * With --scope, every pipeline runs in a transient systemd scope of its
+ * own (systemd-run --user --scope), a cgroup under the user's app.slice
+ * instead of the monitor's. The limits from --config become the scope's
+ * CPUQuota (cpu.max), CPUWeight (cpu.weight) and MemoryHigh (memory.high),
+ * so a SoftISP or converter gone wrong can't starve the desktop; changed
+ * limits apply from the next pipeline start. systemd-run execs the
+ * pipeline in its own process, so the pid stays the pipeline's.
+ *
+ * The scope's cgroup also accounts the session. STATUS shows its CPU time,
+ * throttling, CPU and memory pressure (PSI) and peak memory while the
+ * pipeline runs, and the totals of the last session after it stopped;
+ * each session's totals are logged when it stops.
+ */
+static int scope_enabled;
+
+struct session_stats {
+	unsigned long long wall_ms;
+	unsigned long long cpu_usec, throttled_usec;
+	unsigned long long cpu_some_usec, memory_some_usec;
+	double cpu_some_avg10, memory_some_avg10;
+	unsigned long long memory_peak;
+};
+
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct session_stats last_session;
+static int have_last_session;
+static atomic_ullong session_start_ns;
+
+/* The pipeline command wrapped in systemd-run. Built before fork(), like
+ * trace_environ(). */
+static char **scope_cmd(char **cmd)
+{
+	static char *argv[256];
+	static char unit[64], quota[40], weight[40], high[56];
+	int n = 0;
+
+	if (!scope_enabled)
+		return cmd;
+
+	snprintf(unit, sizeof(unit), "--unit=camera-relay-pipeline-%d-%u",
+		 getpid(), atomic_load(&pipeline_starts) + 1);
+	argv[n++] = "systemd-run";
+	argv[n++] = "--user";
+	argv[n++] = "--scope";
+	argv[n++] = "--quiet";
+	argv[n++] = "--collect";
+	argv[n++] = unit;
+	if (config_limits.cpu_quota) {
+		snprintf(quota, sizeof(quota), "--property=CPUQuota=%d%%",
+			 config_limits.cpu_quota);
+		argv[n++] = quota;
+	}
+	if (config_limits.cpu_weight) {
+		snprintf(weight, sizeof(weight), "--property=CPUWeight=%d",
+			 config_limits.cpu_weight);
+		argv[n++] = weight;
+	}
+	if (config_limits.memory_high) {
+		snprintf(high, sizeof(high), "--property=MemoryHigh=%llu",
+			 config_limits.memory_high);
+		argv[n++] = high;
+	}
+	argv[n++] = "--";
+	for (int i = 0; cmd[i] && n < 255; i++)
+		argv[n++] = cmd[i];
+	argv[n] = NULL;
+	return argv;
+}
+
+/* The cgroup directory of the pipeline's scope. Returns 0, or -1 if the
+ * pipeline isn't in one (yet: systemd-run creates it before the exec). */
+static int pipeline_cgroup(pid_t pid, char *path, size_t size)
+{
+	char line[512];
+	int ret = -1;
+
+	snprintf(line, sizeof(line), "/proc/%d/cgroup", pid);
+	FILE *f = fopen(line, "re");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (strncmp(line, "0::", 3) != 0 ||
+		    !strstr(line, "/camera-relay-pipeline-"))
+			continue;
+		snprintf(path, size, "/sys/fs/cgroup%s", line + 3);
+		ret = 0;
+		break;
+	}
+	fclose(f);
+	return ret;
+}
+
+/* Read a cgroup attribute file. Returns its length, or -1. */
+static int read_cgroup(const char *cgroup, const char *name, char *buf,
+		       size_t size)
+{
+	char path[700];
+
+	snprintf(path, sizeof(path), "%s/%s", cgroup, name);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	ssize_t len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+	return len;
+}
+
+/* The "some" line of a PSI file: share stalled over 10 s, total stall */
+static void read_pressure(const char *cgroup, const char *name,
+			  double *avg10, unsigned long long *total_usec)
+{
+	char buf[256];
+
+	*avg10 = 0;
+	*total_usec = 0;
+	if (read_cgroup(cgroup, name, buf, sizeof(buf)) > 0)
+		sscanf(buf, "some avg10=%lf avg60=%*f avg300=%*f total=%llu",
+		       avg10, total_usec);
+}
+
+static int read_session(pid_t pid, struct session_stats *s)
+{
+	char cgroup[600], buf[1024], *line;
+
+	if (pipeline_cgroup(pid, cgroup, sizeof(cgroup)) < 0 ||
+	    read_cgroup(cgroup, "cpu.stat", buf, sizeof(buf)) < 0)
+		return -1;
+
+	memset(s, 0, sizeof(*s));
+	for (line = buf; line; line = strchr(line, '\n')) {
+		line += *line == '\n';
+		sscanf(line, "usage_usec %llu", &s->cpu_usec);
+		sscanf(line, "throttled_usec %llu", &s->throttled_usec);
+	}
+	read_pressure(cgroup, "cpu.pressure", &s->cpu_some_avg10,
+		      &s->cpu_some_usec);
+	read_pressure(cgroup, "memory.pressure", &s->memory_some_avg10,
+		      &s->memory_some_usec);
+	/* memory.peak needs 5.19; the current usage is the next best */
+	if (read_cgroup(cgroup, "memory.peak", buf, sizeof(buf)) > 0 ||
+	    read_cgroup(cgroup, "memory.current", buf, sizeof(buf)) > 0)
+		s->memory_peak = strtoull(buf, NULL, 10);
+	s->wall_ms = (now_ns() - atomic_load(&session_start_ns)) / 1000000;
+	return 0;
+}
+
+/*
+ * A session as STATUS lines, with prefix "session" or "last_session":
+ *   <prefix>.wall_ms=<ms>
+ *   <prefix>.cpu_ms=<ms>
+ *   <prefix>.throttled_ms=<ms>              held back by cpu_quota
+ *   <prefix>.cpu_pressure=<avg10 %> <ms>    waiting for a CPU
+ *   <prefix>.memory_pressure=<avg10 %> <ms> waiting for memory
+ *   <prefix>.memory_peak_kb=<KiB>
+ */
+static void print_session(int fd, const char *prefix,
+			  const struct session_stats *s)
+{
+	dprintf(fd, "%s.wall_ms=%llu\n"
+		"%s.cpu_ms=%llu\n"
+		"%s.throttled_ms=%llu\n"
+		"%s.cpu_pressure=%.2f %llu\n"
+		"%s.memory_pressure=%.2f %llu\n"
+		"%s.memory_peak_kb=%llu\n",
+		prefix, s->wall_ms,
+		prefix, s->cpu_usec / 1000,
+		prefix, s->throttled_usec / 1000,
+		prefix, s->cpu_some_avg10, s->cpu_some_usec / 1000,
+		prefix, s->memory_some_avg10, s->memory_some_usec / 1000,
+		prefix, s->memory_peak >> 10);
+}
+
+static void serve_session(int fd, pid_t pid)
+{
+	struct session_stats s;
+	int have_last;
+
+	if (!scope_enabled)
+		return;
+	if (pid > 0 && read_session(pid, &s) == 0)
+		print_session(fd, "session", &s);
+
+	pthread_mutex_lock(&session_lock);
+	s = last_session;
+	have_last = have_last_session;
+	pthread_mutex_unlock(&session_lock);
+	if (have_last)
+		print_session(fd, "last_session", &s);
+}
+
+/* Take the totals of the pipeline's session, before it is stopped */
+static void finish_session(pid_t pid)
+{
+	struct session_stats s;
+
+	if (!scope_enabled || read_session(pid, &s) < 0)
+		return;
+
+	pthread_mutex_lock(&session_lock);
+	last_session = s;
+	have_last_session = 1;
+	pthread_mutex_unlock(&session_lock);
+
+	fprintf(stderr, "[monitor] Session: %llu ms CPU in %llu s,"
+		" throttled %llu ms, peak %llu MiB, stalled on CPU %llu ms,"
+		" on memory %llu ms\n", s.cpu_usec / 1000, s.wall_ms / 1000,
+		s.throttled_usec / 1000, s.memory_peak >> 20,
+		s.cpu_some_usec / 1000, s.memory_some_usec / 1000);
+}
+
+/* ── Pipeline tracing ───────────────────────────────────────────────── */
+
+/*
+ * With --trace, the pipeline runs with GStreamer's latency tracer, which
+ * writes a line per buffer and element to the debug log. GST_DEBUG_FILE
+ * points the log at a private pipe (fd 4 in the child), so it doesn't mix
+ * with the log file, and a thread parses it as it comes. Other debug
+ * output (a GST_DEBUG the user set) is passed on to stderr.
+ */
+#define MAX_TRACE_STATS 16
+
+struct trace_stat {
+	char name[48];		/* element, or "pipeline" for src to sink */
+	unsigned long long count, sum_ns, max_ns;
+};
+
+static int trace_enabled;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_stat trace_stats[MAX_TRACE_STATS];
+static int n_trace_stats;
+static pthread_t trace_thread;
+static int trace_running;
+
+/* Copy the value of "key=(type)value," from a tracer line */
+static int trace_field(const char *line, const char *key, char *out,
+		       size_t size)
+{
+	const char *p = strstr(line, key);
+	size_t n;
+
+	if (!p)
+		return -1;
+	p = strchr(p + strlen(key), ')');
+	if (!p)
+		return -1;
+	p++;
+	n = strcspn(p, ",;");
+	if (n >= size)
+		n = size - 1;
+	memcpy(out, p, n);
+	out[n] = '\0';
+	return 0;
+}
+
+static void trace_line(const char *line)
+{
+	char name[48], time[24];
+
+	if (!strstr(line, "GST_TRACER")) {
+		fprintf(stderr, "%s\n", line);
+		return;
+	}
+
+	if (strstr(line, "element-latency,")) {
+		if (trace_field(line, " element=", name, sizeof(name)) < 0)
+			return;
+	} else if (strstr(line, ": latency,") || strstr(line, " latency,")) {
+		strcpy(name, "pipeline");
+	} else {
+		return;
+	}
+	if (trace_field(line, " time=", time, sizeof(time)) < 0)
+		return;
+
+	unsigned long long ns = strtoull(time, NULL, 10);
+
+	pthread_mutex_lock(&trace_lock);
+	int i;
+	for (i = 0; i < n_trace_stats; i++)
+		if (!strcmp(trace_stats[i].name, name))
+			break;
+	if (i == n_trace_stats && n_trace_stats < MAX_TRACE_STATS) {
+		snprintf(trace_stats[i].name, sizeof(trace_stats[i].name),
+			 "%s", name);
+		n_trace_stats++;
+	}
+	if (i < n_trace_stats) {
+		struct trace_stat *t = &trace_stats[i];
+		t->count++;
+		t->sum_ns += ns;
+		if (ns > t->max_ns)
+			t->max_ns = ns;
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/* Split the trace pipe into lines until the pipeline closes it */
+static void *trace_reader(void *arg)
+{
+	int fd = (int)(intptr_t)arg;
+	char buf[8192];
+	size_t len = 0;
+	ssize_t r;
+
+	while ((r = read(fd, buf + len, sizeof(buf) - 1 - len)) != 0) {
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		len += r;
+		buf[len] = '\0';
+
+		char *line = buf, *nl;
+		while ((nl = strchr(line, '\n'))) {
+			*nl = '\0';
+			trace_line(line);
+			line = nl + 1;
+		}
+		len -= line - buf;
+		memmove(buf, line, len);
+		/* A line longer than the buffer isn't a tracer line */
+		if (len == sizeof(buf) - 1)
+			len = 0;
+	}
+	close(fd);
+	return NULL;
+}
+
+/*
+ * The environment for a traced pipeline: ours, with the tracer and a debug
+ * log on fd 4 added. Built before fork(), the control thread may hold the
+ * malloc lock.
+ */
+static char **trace_environ(void)
+{
+	extern char **environ;
+	static char *env[256];
+	static char debug[512];
+	const char *user = getenv("GST_DEBUG");
+	int n = 0;
+
+	for (char **e = environ; *e && n < 250; e++) {
+		if (!strncmp(*e, "GST_TRACERS=", 12) ||
+		    !strncmp(*e, "GST_DEBUG=", 10) ||
+		    !strncmp(*e, "GST_DEBUG_FILE=", 15) ||
+		    !strncmp(*e, "GST_DEBUG_NO_COLOR=", 19))
+			continue;
+		env[n++] = *e;
+	}
+	snprintf(debug, sizeof(debug), "GST_DEBUG=%s%sGST_TRACER:7",
+		 user ? user : "", user && *user ? "," : "");
+	env[n++] = "GST_TRACERS=latency(flags=pipeline+element)";
+	env[n++] = debug;
+	env[n++] = "GST_DEBUG_FILE=/dev/fd/4";
+	env[n++] = "GST_DEBUG_NO_COLOR=1";
+	env[n] = NULL;
+	return env;
+}
+
+/* Read a thread's name and CPU time (user + system ticks) from its
+ * /proc/<pid>/task/<tid>/stat. Returns 0 or -1. */
+static int task_cpu(const char *path, char *name, size_t size,
+		    unsigned long *ticks)
+{
+	char stat[512];
+	unsigned long utime, stime;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+	ssize_t len = read(fd, stat, sizeof(stat) - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+	stat[len] = '\0';
+
+	/* The name is in parentheses and may contain anything */
+	char *open_paren = strchr(stat, '(');
+	char *close_paren = strrchr(stat, ')');
+	if (!open_paren || !close_paren || close_paren < open_paren)
+		return -1;
+	snprintf(name, size, "%.*s", (int)(close_paren - open_paren - 1),
+		 open_paren + 1);
+	if (sscanf(close_paren + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u"
+		   " %*u %*u %lu %lu", &utime, &stime) != 2)
+		return -1;
+	*ticks = utime + stime;
+	return 0;
+}
+
+/* CPU ticks of the relay loop (the main thread) when the pipeline started */
+static atomic_ulong relay_ticks_base;
+
+static unsigned long relay_ticks(void)
+{
+	char path[64], name[20];
+	unsigned long ticks = 0;
+
+	snprintf(path, sizeof(path), "/proc/self/task/%d/stat", getpid());
+	task_cpu(path, name, sizeof(name), &ticks);
+	return ticks;
+}
+
+/*
+ * Tracer stats and per-thread CPU time of the pipeline, as STATUS lines:
+ *   latency.<element>=<avg us> <max us> <buffers>
+ *   cpu.<thread>=<ms>
+ * CPU is per pipeline thread name since the pipeline started (GstTask
+ * names its threads element:pad, e.g. queue0:src), and cpu.relay is the
+ * monitor's copy loop over the same time.
+ */
+static void serve_trace(int fd, pid_t pid)
+{
+	pthread_mutex_lock(&trace_lock);
+	for (int i = 0; i < n_trace_stats; i++) {
+		const struct trace_stat *t = &trace_stats[i];
+		dprintf(fd, "latency.%s=%llu %llu %llu\n", t->name,
+			t->count ? t->sum_ns / t->count / 1000 : 0,
+			t->max_ns / 1000, t->count);
+	}
+	pthread_mutex_unlock(&trace_lock);
+
+	if (pid <= 0)
+		return;
+
+	struct { char name[20]; unsigned long ticks; } threads[32];
+	int n = 0;
+	char path[300];
+	long hz = sysconf(_SC_CLK_TCK);
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	DIR *dir = opendir(path);
+	if (!dir)
+		return;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		char name[20];
+		unsigned long ticks;
+		int i;
+
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/proc/%d/task/%s/stat", pid,
+			 entry->d_name);
+		if (task_cpu(path, name, sizeof(name), &ticks) < 0)
+			continue;
+
+		for (i = 0; i < n; i++)
+			if (!strcmp(threads[i].name, name))
+				break;
+		if (i == n) {
+			if (n == 32)
 				continue;
-			return total;  /* EOF or error */
+			strcpy(threads[n].name, name);
+			threads[n++].ticks = 0;
 		}
-		total += r;
+		threads[i].ticks += ticks;
 	}
-	return total;
+	closedir(dir);
+
+	for (int i = 0; i < n; i++)
+		dprintf(fd, "cpu.%s=%lu\n", threads[i].name,
+			threads[i].ticks * 1000 / hz);
+	dprintf(fd, "cpu.relay=%lu\n",
+		(relay_ticks() - atomic_load(&relay_ticks_base)) * 1000 / hz);
 }
 
 /* Start pipeline subprocess. Stdout goes to a pipe.
  * Returns pipe read fd on success, -1 on failure. Sets *child_pid. */
 static int start_pipeline(char **cmd, pid_t *child_pid)
 {
+	cmd = scope_cmd(cmd);
+
 	/* Log the pipeline command for debugging */
 	fprintf(stderr, "[monitor] Pipeline:");
 	for (int i = 0; cmd[i]; i++)
@@ -238,12 +1813,28 @@ static int start_pipeline(char **cmd, pid_t *child_pid)
 	 * without blocking on the reader. */
 	fcntl(pipefd[0], F_SETPIPE_SZ, 8388608);
 
+	int tracefd[2] = { -1, -1 };
+	char **env = NULL;
+	if (trace_enabled) {
+		if (pipe2(tracefd, O_CLOEXEC) < 0) {
+			fprintf(stderr, "[monitor] Trace pipe: %s\n",
+				strerror(errno));
+			tracefd[0] = tracefd[1] = -1;
+		} else {
+			env = trace_environ();
+		}
+	}
+
 	pid_t pid = fork();
 	if (pid < 0) {
 		fprintf(stderr, "[monitor] fork() failed: %s\n",
 			strerror(errno));
 		close(pipefd[0]);
 		close(pipefd[1]);
+		if (tracefd[0] >= 0) {
+			close(tracefd[0]);
+			close(tracefd[1]);
+		}
 		return -1;
 	}
 
@@ -254,12 +1845,20 @@ static int start_pipeline(char **cmd, pid_t *child_pid)
 		close(pipefd[0]);
 		dup2(pipefd[1], 3);
 		close(pipefd[1]);
+		/* Trace pipe → fd 4, without O_CLOEXEC */
+		if (tracefd[1] == 4)
+			fcntl(4, F_SETFD, 0);
+		else if (tracefd[1] >= 0)
+			dup2(tracefd[1], 4);
 		int devnull = open("/dev/null", O_WRONLY);
 		if (devnull >= 0) {
 			dup2(devnull, STDOUT_FILENO);
 			close(devnull);
 		}
-		execvp(cmd[0], cmd);
+		if (env)
+			execvpe(cmd[0], cmd, env);
+		else
+			execvp(cmd[0], cmd);
 		fprintf(stderr, "[monitor] exec failed: %s\n",
 			strerror(errno));
 		_exit(127);
@@ -267,41 +1866,748 @@ static int start_pipeline(char **cmd, pid_t *child_pid)
 
 	/* Parent: close write end, return read end */
 	close(pipefd[1]);
+	if (tracefd[0] >= 0) {
+		close(tracefd[1]);
+		pthread_mutex_lock(&trace_lock);
+		n_trace_stats = 0;
+		pthread_mutex_unlock(&trace_lock);
+		trace_running = pthread_create(&trace_thread, NULL,
+					       trace_reader,
+					       (void *)(intptr_t)tracefd[0])
+				== 0;
+		if (!trace_running)
+			close(tracefd[0]);
+	}
 	*child_pid = pid;
+	flight_record(FL_PIPELINE_START, 0, pid);
+	atomic_store(&last_frame_ns, 0);
+	atomic_store(&relay_ticks_base, relay_ticks());
+	atomic_store(&session_start_ns, now_ns());
+	atomic_store(&pipeline_pid, pid);
+	atomic_fetch_add(&pipeline_starts, 1);
+	atomic_store(&relay_state, 1);
 	return pipefd[0];
 }
 
 /* Stop pipeline subprocess and reap it. */
 static void stop_pipeline(pid_t pid, int pipe_fd)
 {
+	finish_session(pid);
+	atomic_store(&relay_state, 0);
+	atomic_store(&pipeline_pid, 0);
+
 	if (pipe_fd >= 0)
 		close(pipe_fd);
 
 	kill(pid, SIGTERM);
+	kill(pid, SIGCONT);	/* in case it was paused */
 
 	/* Wait up to 3 seconds for graceful exit */
-	for (int i = 0; i < 30; i++) {
-		int status;
+	int i, status = 0;
+	for (i = 0; i < 30; i++) {
 		if (waitpid(pid, &status, WNOHANG) != 0)
-			return;
+			break;
 		usleep(100000);
 	}
 
 	/* Force kill */
-	kill(pid, SIGKILL);
-	waitpid(pid, NULL, 0);
+	if (i == 30) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+	}
+	flight_record(FL_PIPELINE_STOP, i == 30, status);
+
+	/* The trace reader ends at EOF, now that the pipeline is gone */
+	if (trace_running) {
+		pthread_join(trace_thread, NULL);
+		trace_running = 0;
+	}
+}
+
+/* ── Control socket ─────────────────────────────────────────────────── */
+
+/* Write all of buf, retrying short writes. Returns 0 or -1. */
+static int write_all(int fd, const void *buf, size_t n)
+{
+	const char *p = buf;
+	while (n > 0) {
+		ssize_t w = write(fd, p, n);
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += w;
+		n -= w;
+	}
+	return 0;
+}
+
+/* Called by the relay loop for every frame while a snapshot is wanted */
+static void offer_snapshot(const char *frame)
+{
+	pthread_mutex_lock(&snap_lock);
+	snap_width = frame_width;
+	snap_height = frame_height;
+	snap_format = frame_format;
+	snap_bytes = frame_bytes;
+	memcpy(snap_buf, frame, snap_bytes);
+	flight_record(FL_SNAPSHOT, 0, snap_bytes);
+	snap_seq++;
+	atomic_store(&snap_wanted, 0);
+	pthread_cond_broadcast(&snap_cond);
+	pthread_mutex_unlock(&snap_lock);
+}
+
+/* Wait for the relay loop to hand over the next frame. Returns 0 when
+ * snap_buf holds it, -1 on timeout. */
+static int grab_frame(int timeout_sec)
+{
+	struct timespec deadline;
+	int got;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_sec;
+
+	pthread_mutex_lock(&snap_lock);
+	unsigned long long seq = snap_seq;
+	atomic_store(&snap_wanted, 1);
+	while (snap_seq == seq &&
+	       pthread_cond_timedwait(&snap_cond, &snap_lock, &deadline) == 0)
+		;
+	got = snap_seq != seq;
+	atomic_store(&snap_wanted, 0);
+	pthread_mutex_unlock(&snap_lock);
+
+	return got ? 0 : -1;
+}
+
+static inline uint8_t clamp_u8(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* YUY2 (BT.601 limited range, as the pipeline outputs it) to RGB888 */
+static void yuyv_to_rgb(const uint8_t *src, uint8_t *dst, int pixels)
+{
+	for (int i = 0; i < pixels; i += 2) {
+		int y0 = 298 * (src[0] - 16);
+		int y1 = 298 * (src[2] - 16);
+		int u = src[1] - 128;
+		int v = src[3] - 128;
+		int r = 409 * v + 128;
+		int g = -100 * u - 208 * v + 128;
+		int b = 516 * u + 128;
+
+		dst[0] = clamp_u8((y0 + r) >> 8);
+		dst[1] = clamp_u8((y0 + g) >> 8);
+		dst[2] = clamp_u8((y0 + b) >> 8);
+		dst[3] = clamp_u8((y1 + r) >> 8);
+		dst[4] = clamp_u8((y1 + g) >> 8);
+		dst[5] = clamp_u8((y1 + b) >> 8);
+		src += 4;
+		dst += 6;
+	}
+}
+
+/* NV12 to RGB888, each chroma sample covers 2x2 pixels */
+static void nv12_to_rgb(const uint8_t *src, uint8_t *dst, int width,
+			int height)
+{
+	const uint8_t *uv_plane = src + (size_t)width * height;
+
+	for (int y = 0; y < height; y++) {
+		const uint8_t *luma = src + (size_t)y * width;
+		const uint8_t *uv = uv_plane + (size_t)(y / 2) * width;
+
+		for (int x = 0; x < width; x += 2) {
+			int y0 = 298 * (luma[x] - 16);
+			int y1 = 298 * (luma[x + 1] - 16);
+			int u = uv[x] - 128;
+			int v = uv[x + 1] - 128;
+			int r = 409 * v + 128;
+			int g = -100 * u - 208 * v + 128;
+			int b = 516 * u + 128;
+
+			dst[0] = clamp_u8((y0 + r) >> 8);
+			dst[1] = clamp_u8((y0 + g) >> 8);
+			dst[2] = clamp_u8((y0 + b) >> 8);
+			dst[3] = clamp_u8((y1 + r) >> 8);
+			dst[4] = clamp_u8((y1 + g) >> 8);
+			dst[5] = clamp_u8((y1 + b) >> 8);
+			dst += 6;
+		}
+	}
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *p, size_t n)
+{
+	static uint32_t table[256];
+
+	if (!table[1]) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	while (n--)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint32_t adler32(const uint8_t *p, size_t n)
+{
+	uint32_t a = 1, b = 0;
+
+	while (n > 0) {
+		/* 5552 bytes is the most that can't overflow b */
+		size_t chunk = n < 5552 ? n : 5552;
+		n -= chunk;
+		while (chunk--) {
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+static uint8_t *put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+	return p + 4;
+}
+
+/* Close a PNG chunk whose type and data start at chunk + 4 */
+static uint8_t *end_chunk(uint8_t *chunk, uint32_t len)
+{
+	put_be32(chunk, len);
+	return put_be32(chunk + 8 + len, crc32_update(0, chunk + 4, len + 4));
+}
+
+/*
+ * Encode an RGB888 image as PNG. The zlib stream uses stored (uncompressed)
+ * deflate blocks: compressing a 1080p frame would cost far more CPU than
+ * the relay itself, and the snapshot only has to be a file any viewer opens.
+ * Returns a malloc'd buffer and sets *size, or NULL.
+ */
+static uint8_t *encode_png(const uint8_t *rgb, int width, int height,
+			   size_t *size)
+{
+	static const uint8_t signature[8] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+	};
+	size_t row = (size_t)width * 3;
+	size_t raw = (row + 1) * height;	/* filter byte per row */
+	size_t blocks = (raw + 65534) / 65535;
+	size_t idat = 2 + raw + blocks * 5 + 4;
+
+	if (idat > 0x7fffffff)
+		return NULL;
+
+	uint8_t *png = malloc(8 + 25 + 12 + idat + 12);
+	uint8_t *scanlines = malloc(raw);
+	if (!png || !scanlines) {
+		free(png);
+		free(scanlines);
+		return NULL;
+	}
+
+	uint8_t *p = png;
+	memcpy(p, signature, 8);
+	p += 8;
+
+	uint8_t *chunk = p;
+	memcpy(chunk + 4, "IHDR", 4);
+	p = put_be32(chunk + 8, width);
+	p = put_be32(p, height);
+	*p++ = 8;	/* bit depth */
+	*p++ = 2;	/* colour type: RGB */
+	*p++ = 0;	/* compression */
+	*p++ = 0;	/* filter */
+	*p++ = 0;	/* interlace */
+	p = end_chunk(chunk, 13);
+
+	chunk = p;
+	memcpy(chunk + 4, "IDAT", 4);
+	p = chunk + 8;
+	*p++ = 0x78;	/* zlib: deflate, 32K window */
+	*p++ = 0x01;
+
+	/* Scanlines, each prefixed with filter type 0 (none) */
+	for (int y = 0; y < height; y++) {
+		scanlines[y * (row + 1)] = 0;
+		memcpy(scanlines + y * (row + 1) + 1, rgb + y * row, row);
+	}
+
+	for (size_t done = 0; done < raw; ) {
+		size_t n = raw - done < 65535 ? raw - done : 65535;
+		*p++ = done + n == raw;		/* BFINAL, BTYPE=00 */
+		*p++ = n & 0xff;
+		*p++ = n >> 8;
+		*p++ = ~n & 0xff;
+		*p++ = (~n >> 8) & 0xff;
+		memcpy(p, scanlines + done, n);
+		p += n;
+		done += n;
+	}
+	p = put_be32(p, adler32(scanlines, raw));
+	free(scanlines);
+	p = end_chunk(chunk, p - (chunk + 8));
+
+	chunk = p;
+	memcpy(chunk + 4, "IEND", 4);
+	p = end_chunk(chunk, 0);
+
+	*size = p - png;
+	return png;
+}
+
+static void reply_error(int fd, const char *reason)
+{
+	dprintf(fd, "ERR %s\n", reason);
+}
+
+static void serve_status(int fd)
+{
+	int profile = atomic_load(&running_profile);
+
+	dprintf(fd, "OK\n"
+		"state=%s\n"
+		"width=%d\n"
+		"height=%d\n"
+		"format=%s\n"
+		"profile=%s\n"
+		"pipeline_pid=%d\n"
+		"pipeline_starts=%u\n"
+		"frames=%llu\n"
+		"snapshots=%u\n"
+		"reloads=%u\n"
+		"writer=%s\n",
+		atomic_load(&relay_state) == 2 ? "paused" :
+		atomic_load(&relay_state) ? "relay" : "idle",
+		frame_width, frame_height, format_name(frame_format),
+		profile >= 0 ? profiles[profile].app : "default",
+		atomic_load(&pipeline_pid),
+		atomic_load(&pipeline_starts),
+		atomic_load(&frames_relayed),
+		atomic_load(&snapshots_served),
+		atomic_load(&config_reloads),
+		writer_in_place ? "in-place" : "swap");
+	if (atomic_load(&relay_state))
+		serve_trace(fd, atomic_load(&pipeline_pid));
+	serve_session(fd, atomic_load(&pipeline_pid));
+}
+
+static void serve_snapshot(int fd, const char *format)
+{
+	uint8_t *rgb = NULL, *out;
+	size_t size;
+	char header[128];
+
+	if (!*format)
+		format = "png";
+	if (strcmp(format, "raw") && strcmp(format, "yuyv") &&
+	    strcmp(format, "nv12") && strcmp(format, "ppm") &&
+	    strcmp(format, "png")) {
+		reply_error(fd, "unknown format (raw, yuyv, nv12, ppm or png)");
+		return;
+	}
+	if (atomic_load(&relay_state) != 1) {
+		reply_error(fd, "relay idle or paused, no camera frames");
+		return;
+	}
+	/* Camera startup takes 2-3 s before the first frame */
+	if (grab_frame(5) < 0) {
+		reply_error(fd, "no frame from the pipeline");
+		return;
+	}
+
+	/* The frame's own format, raw frames aren't converted */
+	const char *native = snap_format == V4L2_PIX_FMT_NV12 ?
+		"nv12" : "yuyv";
+	int pixels = snap_width * snap_height;
+
+	if (!strcmp(format, "raw"))
+		format = native;
+	if (!strcmp(format, "yuyv") || !strcmp(format, "nv12")) {
+		if (strcmp(format, native)) {
+			reply_error(fd, "frame is in the other YUV format,"
+				    " use raw");
+			return;
+		}
+		out = (uint8_t *)snap_buf;
+		size = snap_bytes;
+	} else {
+		rgb = malloc((size_t)pixels * 3);
+		if (!rgb) {
+			reply_error(fd, "out of memory");
+			return;
+		}
+		if (snap_format == V4L2_PIX_FMT_NV12)
+			nv12_to_rgb((const uint8_t *)snap_buf, rgb,
+				    snap_width, snap_height);
+		else
+			yuyv_to_rgb((const uint8_t *)snap_buf, rgb, pixels);
+
+		if (!strcmp(format, "ppm")) {
+			out = rgb;
+			size = (size_t)pixels * 3;
+		} else {
+			out = encode_png(rgb, snap_width, snap_height, &size);
+			if (!out) {
+				free(rgb);
+				reply_error(fd, "PNG encoding failed");
+				return;
+			}
+		}
+	}
+
+	snprintf(header, sizeof(header), "OK %s %d %d %zu\n",
+		 format, snap_width, snap_height, size);
+	if (write_all(fd, header, strlen(header)) == 0) {
+		if (!strcmp(format, "ppm"))
+			dprintf(fd, "P6\n%d %d\n255\n", snap_width,
+				snap_height);
+		if (write_all(fd, out, size) == 0)
+			atomic_fetch_add(&snapshots_served, 1);
+	}
+
+	if (out != rgb && out != (uint8_t *)snap_buf)
+		free(out);
+	free(rgb);
+}
+
+/*
+ * Have the relay loop re-read the settings and wait for it to apply them.
+ * It does so between two frames, or at once while idle or paused.
+ */
+static void serve_reconfigure(int fd)
+{
+	struct timespec deadline;
+	unsigned long seq;
+	int done;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 10;
+
+	pthread_mutex_lock(&reload_lock);
+	seq = reload_seq;
+	pthread_kill(main_thread, SIGHUP);
+	while (reload_seq == seq &&
+	       pthread_cond_timedwait(&reload_cond, &reload_lock,
+				      &deadline) == 0)
+		;
+	done = reload_seq != seq;
+	if (done)
+		dprintf(fd, "OK\nresult=%s\ntime_ms=%ld\n", reload_result,
+			reload_ms);
+	pthread_mutex_unlock(&reload_lock);
+
+	if (!done)
+		reply_error(fd, "no frame yet, settings apply at the next one");
+}
+
+/* Read one command line, dispatch it. */
+static void serve_client(int fd)
+{
+	char line[128];
+	size_t len = 0;
+
+	while (len < sizeof(line) - 1) {
+		ssize_t r = read(fd, line + len, 1);
+		if (r <= 0 || line[len] == '\n')
+			break;
+		len++;
+	}
+	line[len] = '\0';
+	if (len && line[len - 1] == '\r')
+		line[--len] = '\0';
+
+	char *arg = strchr(line, ' ');
+	if (arg)
+		*arg++ = '\0';
+	else
+		arg = line + len;
+
+	if (!strcmp(line, "STATUS"))
+		serve_status(fd);
+	else if (!strcmp(line, "SNAPSHOT"))
+		serve_snapshot(fd, arg);
+	else if (!strcmp(line, "RECONFIGURE"))
+		serve_reconfigure(fd);
+	else
+		reply_error(fd, "unknown command");
+}
+
+static void *control_thread(void *arg)
+{
+	int listen_fd = (int)(intptr_t)arg;
+
+	for (;;) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "[monitor] Control accept: %s\n",
+				strerror(errno));
+			return NULL;
+		}
+
+		/* A stuck client must not block the next one for long */
+		struct timeval tv = { .tv_sec = 10 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		serve_client(fd);
+		close(fd);
+	}
+}
+
+static int bind_control(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "[monitor] Control socket path too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    chmod(path, 0600) < 0 || listen(fd, 4) < 0) {
+		fprintf(stderr, "[monitor] Control socket %s: %s\n",
+			path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Start a helper thread with the termination and reload signals
+ * blocked, so they keep interrupting the relay loop in the main thread. */
+static int start_thread(void *(*fn)(void *), void *arg, const char *name)
+{
+	sigset_t block, old;
+	pthread_t thread;
+	int ret;
+
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	sigaddset(&block, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	ret = pthread_create(&thread, NULL, fn, arg);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (ret) {
+		fprintf(stderr, "[monitor] %s thread: %s\n", name,
+			strerror(ret));
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+/*
+ * Client mode: send one command to a running monitor. The payload of an
+ * "OK" reply goes to stdout, an "ERR" reason to stderr.
+ */
+static int client_main(const char *path, const char *command)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char header[128];
+	size_t len = 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return 1;
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr,
+			      sizeof(addr)) < 0) {
+		fprintf(stderr, "Cannot connect to %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	struct timeval tv = { .tv_sec = 15 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	dprintf(fd, "%s\n", command);
+
+	while (len < sizeof(header) - 1) {
+		ssize_t r = read(fd, header + len, 1);
+		if (r <= 0 || header[len] == '\n')
+			break;
+		len++;
+	}
+	header[len] = '\0';
+
+	if (strncmp(header, "OK", 2) != 0) {
+		fprintf(stderr, "%s\n", len > 4 && !strncmp(header, "ERR ", 4) ?
+			header + 4 : "no reply from the monitor");
+		close(fd);
+		return 1;
+	}
+
+	char buf[65536];
+	ssize_t r;
+	while ((r = read(fd, buf, sizeof(buf))) > 0) {
+		if (write_all(STDOUT_FILENO, buf, r) < 0) {
+			close(fd);
+			return 1;
+		}
+	}
+	close(fd);
+	return r < 0 ? 1 : 0;
+}
+
+/* Switch the device to the format of profile p if needed, then start the
+ * pipeline for it. Returns the pipe fd or -1. */
+static int start_profile(int *fd, const char *device, const struct profile *p,
+			 char *black_frame, __u32 *event_type, char **cmd,
+			 pid_t *child_pid)
+{
+	if (n_profiles) {
+		log_clients();
+		fprintf(stderr, "[monitor] Profile %s: %dx%d %s, %d fps,"
+			" linger %d s\n", p->app, p->width, p->height,
+			format_name(p->format), p->fps, p->linger);
+	}
+
+	if (p->width != frame_width || p->height != frame_height ||
+	    p->format != frame_format)
+		*fd = cycle_writer(*fd, device, p, black_frame, event_type, 0);
+	atomic_store(&running_profile, p->index);
+	return start_pipeline(profile_cmd(cmd, p), child_pid);
+}
+
+/* Re-read --config and --profiles, on SIGHUP or RECONFIGURE */
+static void reload_settings(const char *config_path,
+			    const char *profiles_path)
+{
+	reload_wanted = 0;
+	if (config_path)
+		load_config(config_path);
+	if (profiles_path)
+		load_profiles(profiles_path);
+	atomic_fetch_add(&config_reloads, 1);
+}
+
+/* Report how the reload went, to the log and a waiting RECONFIGURE */
+static void reload_done(const char *result, const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&reload_lock);
+	snprintf(reload_result, sizeof(reload_result), "%s", result);
+	reload_ms = (now.tv_sec - start->tv_sec) * 1000 +
+		    (now.tv_nsec - start->tv_nsec) / 1000000;
+	reload_seq++;
+	pthread_cond_broadcast(&reload_cond);
+	pthread_mutex_unlock(&reload_lock);
+	flight_record(FL_RECONFIGURE, 0, reload_ms);
+
+	fprintf(stderr, "[monitor] Reconfigured: %s (%ld ms)\n", result,
+		reload_ms);
+}
+
+/* The running pipeline, of profile run, doesn't deliver what want asks */
+static int needs_restart(const struct profile *run, const struct profile *want)
+{
+	return want->width != frame_width || want->height != frame_height ||
+	       want->format != frame_format || want->fps != run->fps ||
+	       strcmp(config_filter, running_filter) != 0;
+}
+
+/*
+ * Apply reloaded settings to the running pipeline, between two frames.
+ * The writer fd stays open: the device format is set on it only when the
+ * clients' profile asks for another one, and the pipeline is restarted
+ * only when its caps or filter change, i.e. the device took the new
+ * format, or the frame rate or filter differ. Returns the pipe fd, -1 if
+ * the pipeline didn't start again.
+ */
+static int reconfigure(int fd, int pipe_fd, struct profile *run,
+		       const struct profile *want, char *black_frame,
+		       char **cmd, pid_t *child_pid, char *result,
+		       size_t size)
+{
+	int width = frame_width, height = frame_height;
+	__u32 format = frame_format;
+	int n = 0;
+
+	run->linger = want->linger;
+	if (n_profiles && want->index != atomic_load(&running_profile))
+		log_clients();
+	atomic_store(&running_profile, want->index);
+	if (want->width != width || want->height != height ||
+	    want->format != format) {
+		set_format(fd, want->width, want->height, want->format,
+			   black_frame);
+		if (frame_width != width || frame_height != height ||
+		    frame_format != format)
+			n = snprintf(result, size, "format %dx%d %s, ",
+				     frame_width, frame_height,
+				     format_name(frame_format));
+		else
+			n = snprintf(result, size, "device kept its format, ");
+	}
+	if (frame_width == width && frame_height == height &&
+	    frame_format == format && want->fps == run->fps &&
+	    !strcmp(config_filter, running_filter)) {
+		snprintf(result + n, size - n, "no restart needed");
+		return pipe_fd;
+	}
+
+	stop_pipeline(*child_pid, pipe_fd);
+	*child_pid = 0;
+	if (frame_width != width || frame_height != height ||
+	    frame_format != format)
+		(void)!write(fd, black_frame, frame_bytes);
+
+	*run = *want;
+	snprintf(result + n, size - n, "pipeline restarted");
+	return start_pipeline(profile_cmd(cmd, want), child_pid);
 }
 
 int main(int argc, char *argv[])
 {
 	const char *device;
+	const char *control_path = NULL;
+	const char *profiles_path = NULL;
+	const char *config_path = NULL;
+	const char *flight_path = NULL;
 	int width = 1920, height = 1080;
 	int frame_size;
 
+	if (argc == 4 && strcmp(argv[1], "--client") == 0)
+		return client_main(argv[2], argv[3]);
+
 	if (argc < 4) {
 		fprintf(stderr,
 			"Usage: %s <device> <width> <height>"
-			" -- <pipeline command...>\n", argv[0]);
+			" [--control <socket>] [--profiles <file>]"
+			" [--config <file>] [--flight <file>] [--trace]"
+			" [--scope] [--binning]"
+			" -- <pipeline command...>\n"
+			"       %s --client <socket> <command>\n",
+			argv[0], argv[0]);
 		return 1;
 	}
 
@@ -310,37 +2616,71 @@ int main(int argc, char *argv[])
 	height = atoi(argv[3]);
 	frame_size = width * height * 2;  /* YUY2: 2 bytes/pixel */
 
-	/* Find pipeline command after "--" */
+	/* Options, then the pipeline command after "--" */
 	char **pipeline_cmd = NULL;
 	for (int i = 4; i < argc; i++) {
-		if (strcmp(argv[i], "--") == 0 && i + 1 < argc) {
-			pipeline_cmd = &argv[i + 1];
+		if (strcmp(argv[i], "--") == 0) {
+			if (i + 1 < argc)
+				pipeline_cmd = &argv[i + 1];
 			break;
 		}
+		if (strcmp(argv[i], "--control") == 0 && i + 1 < argc) {
+			control_path = argv[++i];
+		} else if (strcmp(argv[i], "--trace") == 0) {
+			trace_enabled = 1;
+		} else if (strcmp(argv[i], "--scope") == 0) {
+			scope_enabled = 1;
+		} else if (strcmp(argv[i], "--binning") == 0) {
+			binning_enabled = 1;
+		} else if (strcmp(argv[i], "--profiles") == 0 &&
+			   i + 1 < argc) {
+			profiles_path = argv[++i];
+		} else if (strcmp(argv[i], "--config") == 0 &&
+			   i + 1 < argc) {
+			config_path = argv[++i];
+		} else if (strcmp(argv[i], "--flight") == 0 &&
+			   i + 1 < argc) {
+			flight_path = argv[++i];
+		} else {
+			fprintf(stderr, "ERROR: Unknown option %s\n",
+				argv[i]);
+			return 1;
+		}
 	}
 	if (!pipeline_cmd) {
 		fprintf(stderr, "ERROR: No pipeline command given after --\n");
 		return 1;
 	}
 
+	buffer_bytes = frame_size;
+	default_profile.width = width;
+	default_profile.height = height;
+	default_profile.format = V4L2_PIX_FMT_YUYV;
+	cmdline_profile = default_profile;
+	if (config_path)
+		load_config(config_path);
+	if (profiles_path)
+		load_profiles(profiles_path);
+
 	setvbuf(stdout, NULL, _IOLBF, 0);
 
+	main_thread = pthread_self();
 	signal(SIGINT, handle_signal);
 	signal(SIGTERM, handle_signal);
+	signal(SIGHUP, handle_reload);
 	signal(SIGPIPE, SIG_IGN);
 
-	/* Allocate YUY2 black frame (BT.601: Y=0x10, U=V=0x80) */
+	/*
+	 * Buffers are sized for the command line format, YUY2 at
+	 * width x height; profiles and the config can only ask for smaller
+	 * frames.
+	 * open_writer() fills the black frame for the device format.
+	 */
 	char *black_frame = malloc(frame_size);
 	if (!black_frame) {
 		fprintf(stderr, "ERROR: Cannot allocate frame buffer\n");
 		return 1;
 	}
-	for (int i = 0; i < frame_size; i += 4) {
-		black_frame[i + 0] = 0x10;
-		black_frame[i + 1] = 0x80;
-		black_frame[i + 2] = 0x10;
-		black_frame[i + 3] = 0x80;
-	}
 
 	/* Allocate relay frame buffer */
 	char *frame_buf = malloc(frame_size);
@@ -350,6 +2690,30 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	/* The control socket is optional, the relay works without it */
+	if (control_path) {
+		snap_buf = malloc(frame_size);
+		int control_fd = snap_buf ? bind_control(control_path) : -1;
+		if (control_fd >= 0 &&
+		    start_thread(control_thread, (void *)(intptr_t)control_fd,
+				 "Control") == 0) {
+			fprintf(stderr, "[monitor] Control socket %s\n",
+				control_path);
+		} else {
+			if (control_fd >= 0)
+				close(control_fd);
+			control_path = NULL;
+		}
+	}
+
+	/* The flight recorder is optional too */
+	if (flight_path) {
+		if (flight_open(flight_path) == 0 &&
+		    start_thread(watchdog_thread, NULL, "Watchdog") == 0)
+			fprintf(stderr, "[monitor] Flight recorder %s\n",
+				flight_path);
+	}
+
 	/* Get device stat for /proc polling (dev_t comparison) */
 	struct stat dev_stat;
 	if (stat(device, &dev_stat) < 0) {
@@ -362,7 +2726,9 @@ int main(int argc, char *argv[])
 	pid_t our_pid = getpid();
 
 	/* Open writer and set up device */
-	int fd = open_writer(device, width, height, frame_size, black_frame);
+	int fd = open_writer(device, default_profile.width,
+			     default_profile.height, default_profile.format,
+			     black_frame);
 	if (fd < 0) {
 		free(black_frame);
 		free(frame_buf);
@@ -371,14 +2737,15 @@ int main(int argc, char *argv[])
 
 	/* Try event-based client detection */
 	__u32 event_type = try_subscribe_events(fd);
-	int use_events = (event_type != 0);
 
-	if (use_events)
+	if (event_type)
 		fprintf(stderr,
 			"[monitor] Using events + /proc fallback\n");
 	else
 		fprintf(stderr,
 			"[monitor] No event support, using /proc polling\n");
+	choose_writer_cycling(fd, device, event_type,
+			      event_type && drain_initial_event(fd));
 
 	fprintf(stderr, "[monitor] Watching %s (%dx%d) dev=%u:%u\n",
 		device, width, height,
@@ -398,41 +2765,62 @@ int main(int argc, char *argv[])
 	 *        pipe. Read frames from pipe, write to device. Black
 	 *        frames are written during pipeline startup (before first
 	 *        real frame arrives). Monitor /proc for client disconnect.
+	 *        Paused (SIGSTOP) while open clients don't stream.
+	 *
+	 * After each pipeline stop, the writer's events are re-armed and
+	 * it goes back to the default format: in place, or by handing the
+	 * device to the spare writer where v4l2loopback 0.12.x events break
+	 * after the first pipeline cycle. See cycle_writer().
 	 *
-	 * After each pipeline stop, the device fd is closed and re-opened
-	 * to reset v4l2loopback's event queue (0.12.7 events break
-	 * permanently after the first pipeline cycle otherwise).
+	 * SIGHUP (or RECONFIGURE) re-reads the settings. They apply in the
+	 * state the relay is in, on the open writer fd: see reconfigure().
 	 */
 	int relay_active = 0;
 	int prev_clients = 0;
 	pid_t child_pid = 0;
 	int pipe_fd = -1;
 	int rapid_fails = 0;  /* pipeline failures without success */
-
-	if (use_events) {
-		/* Drain initial event (non-blocking — may not exist) */
-		struct pollfd pfd = { .fd = fd, .events = POLLPRI };
-		if (poll(&pfd, 1, 200) > 0) {
-			struct v4l2_event ev;
-			memset(&ev, 0, sizeof(ev));
-			xioctl(fd, VIDIOC_DQEVENT, &ev);
-		}
-	}
+	int pipeline_ended = 0;  /* EOF before we stopped it */
+	struct profile next = default_profile;	/* for the clients seen */
+	struct profile run = default_profile;	/* of the running pipeline */
 
 	int idle_polls = 0;  /* count poll timeouts for /proc fallback */
 
 	while (running) {
 		if (!relay_active) {
+			/*
+			 * New settings: only the device format to follow,
+			 * the next pipeline starts with them anyway.
+			 */
+			if (reload_wanted) {
+				const struct profile *p = &default_profile;
+				struct timespec start;
+				char result[64];
+
+				clock_gettime(CLOCK_MONOTONIC, &start);
+				reload_settings(config_path, profiles_path);
+				if (p->width != frame_width ||
+				    p->height != frame_height ||
+				    p->format != frame_format)
+					set_format(fd, p->width, p->height,
+						   p->format, black_frame);
+				snprintf(result, sizeof(result),
+					 "idle, device %dx%d %s",
+					 frame_width, frame_height,
+					 format_name(frame_format));
+				reload_done(result, &start);
+			}
+
 			/*
 			 * IDLE state: write black frame, watch for clients.
 			 * The write keeps ready_for_capture=1 so clients
 			 * can STREAMON at any time.
 			 */
-			(void)!write(fd, black_frame, frame_size);
+			(void)!write(fd, black_frame, frame_bytes);
 
 			int client_detected = 0;
 
-			if (use_events) {
+			if (event_type) {
 				/*
 				 * Wait for v4l2loopback event (zero CPU).
 				 * Use 2s timeout. On timeout, fall back to
@@ -450,6 +2838,7 @@ int main(int argc, char *argv[])
 					memset(&ev, 0, sizeof(ev));
 					if (xioctl(fd, VIDIOC_DQEVENT,
 						   &ev) == 0) {
+						note_event(&ev);
 						/*
 						 * Verify via /proc — PipeWire
 						 * briefly opens the device
@@ -458,15 +2847,16 @@ int main(int argc, char *argv[])
 						 */
 						usleep(100000);
 						int clients =
-							count_other_openers(
+							active_clients(
 							dev_stat.st_rdev,
-							our_pid, 0);
+							our_pid, 0, &next);
 						fprintf(stderr,
 							"[monitor] Event"
 							" fired, /proc"
 							" clients=%d\n",
 							clients);
-						if (clients > 0)
+						if (clients > 0 &&
+						    !readers_idle())
 							client_detected = 1;
 					}
 					idle_polls = 0;
@@ -477,10 +2867,12 @@ int main(int argc, char *argv[])
 					 * after fd re-open on some versions.
 					 */
 					idle_polls++;
-					int clients = count_other_openers(
+					int clients = active_clients(
 						dev_stat.st_rdev,
-						our_pid, 0);
-					if (clients > 0) {
+						our_pid, 0, &next);
+					/* Open but not streaming, e.g.
+					 * after a pause was released */
+					if (clients > 0 && !readers_idle()) {
 						fprintf(stderr,
 							"[monitor] /proc"
 							" fallback:"
@@ -493,8 +2885,8 @@ int main(int argc, char *argv[])
 				/*
 				 * No event support — poll /proc every 2s.
 				 */
-				int clients = count_other_openers(
-					dev_stat.st_rdev, our_pid, 0);
+				int clients = active_clients(
+					dev_stat.st_rdev, our_pid, 0, &next);
 				if (clients > 0 && prev_clients == 0)
 					client_detected = 1;
 				prev_clients = clients;
@@ -506,14 +2898,18 @@ int main(int argc, char *argv[])
 				fprintf(stderr,
 					"[monitor] Client connected"
 					" — starting pipeline\n");
-				pipe_fd = start_pipeline(pipeline_cmd,
-							 &child_pid);
+				pipe_fd = start_profile(&fd, device, &next,
+							black_frame,
+							&event_type,
+							pipeline_cmd,
+							&child_pid);
 				if (pipe_fd < 0) {
 					fprintf(stderr,
 						"[monitor] Failed to"
 						" start pipeline\n");
 					continue;
 				}
+				run = next;
 				relay_active = 1;
 				prev_clients = 0;
 				printf("START\n");
@@ -526,6 +2922,69 @@ int main(int argc, char *argv[])
 			 * keep the device active for clients.
 			 */
 			int need_stop = 0;
+			static int paused = 0;
+			static struct timespec paused_at;
+
+			if (paused) {
+				/*
+				 * PAUSED: the pipeline is stopped, wait
+				 * for a client to stream again (the event
+				 * resumes it at once) or to close the
+				 * device.
+				 */
+				struct pollfd pfd = {
+					.fd = fd, .events = POLLPRI
+				};
+				struct timespec now;
+
+				if (poll(&pfd, 1, 1000) > 0 &&
+				    (pfd.revents & POLLPRI))
+					read_events(fd);
+				clock_gettime(CLOCK_MONOTONIC, &now);
+
+				/*
+				 * New settings that the pipeline can't
+				 * take: release it, the next STREAMON
+				 * starts one with them.
+				 */
+				if (reload_wanted) {
+					struct profile want = default_profile;
+
+					reload_settings(config_path,
+							profiles_path);
+					active_clients(dev_stat.st_rdev,
+						       our_pid, child_pid,
+						       &want);
+					need_stop = needs_restart(&run, &want);
+					run.linger = want.linger;
+					reload_done(need_stop ?
+						"paused, pipeline released" :
+						"paused, no restart needed",
+						&now);
+				}
+
+				int clients = active_clients(
+					dev_stat.st_rdev, our_pid,
+					child_pid, NULL);
+				if (need_stop || clients <= 0 ||
+				    now.tv_sec - paused_at.tv_sec >=
+				    PAUSE_RELEASE_SEC) {
+					need_stop = 1;
+				} else if (!readers_idle()) {
+					fprintf(stderr,
+						"[monitor] Client"
+						" streaming again"
+						" — resuming\n");
+					kill(child_pid, SIGCONT);
+					paused = 0;
+					flight_record(FL_RESUME, 0, 0);
+					atomic_store(&last_frame_ns, 0);
+					atomic_store(&relay_state, 1);
+					printf("RESUME\n");
+				}
+				if (!need_stop)
+					continue;
+			}
 
 			/*
 			 * Tight blocking read — no poll().
@@ -541,21 +3000,54 @@ int main(int argc, char *argv[])
 			 * time. If the pipeline dies, read_full returns
 			 * short and we handle it below.
 			 */
-			int n = read_full(pipe_fd, frame_buf,
-					  frame_size);
-			if (n == frame_size) {
-				(void)!write(fd, frame_buf,
-					     frame_size);
+			int n = need_stop ? 0 :
+				read_full(pipe_fd, frame_buf, frame_bytes);
+			if (n == frame_bytes) {
+				atomic_store(&last_frame_ns, flight_record(
+					FL_FRAME_IN, 0, n));
+				ssize_t w = write(fd, frame_buf, frame_bytes);
+				flight_record(FL_FRAME_OUT, 0, w > 0 ? w : 0);
 				rapid_fails = 0;
-			} else {
+				atomic_fetch_add(&frames_relayed, 1);
+				/* Copy only, the control thread
+				 * converts it */
+				if (atomic_load(&snap_wanted))
+					offer_snapshot(frame_buf);
+			} else if (!need_stop) {
 				fprintf(stderr,
 					"[monitor] Pipeline"
 					" EOF/error (read=%d"
 					" of %d)\n",
-					n, frame_size);
+					n, frame_bytes);
+				flight_record(FL_PIPELINE_EOF, 0, n);
+				pipeline_ended = 1;
 				need_stop = 1;
 			}
 
+			/* New settings, between this frame and the next */
+			if (!need_stop && reload_wanted) {
+				struct profile want = default_profile;
+				struct timespec start;
+				char result[96];
+
+				clock_gettime(CLOCK_MONOTONIC, &start);
+				reload_settings(config_path, profiles_path);
+				active_clients(dev_stat.st_rdev, our_pid,
+					       child_pid, &want);
+				pipe_fd = reconfigure(fd, pipe_fd, &run,
+						      &want, black_frame,
+						      pipeline_cmd,
+						      &child_pid, result,
+						      sizeof(result));
+				reload_done(result, &start);
+				if (pipe_fd < 0) {
+					fprintf(stderr,
+						"[monitor] Failed to"
+						" restart pipeline\n");
+					need_stop = 1;
+				}
+			}
+
 			/*
 			 * Check client count via /proc every ~1 second.
 			 * At ~30fps, check every 30th frame.
@@ -563,15 +3055,45 @@ int main(int argc, char *argv[])
 			static int check_tick = 0;
 			static int idle_ticks = 0;
 			static int had_clients = 0;
+			static int quiet_ticks = 0;
+			int per_second = run.fps ? run.fps : 30;
 
-			if (!need_stop && ++check_tick % 30 == 0) {
-				int clients = count_other_openers(
+			if (!need_stop && ++check_tick % per_second == 0) {
+				int clients = active_clients(
 					dev_stat.st_rdev, our_pid,
-					child_pid);
+					child_pid, NULL);
 
 				if (clients > 0)
 					had_clients = 1;
 
+				/*
+				 * Pause when the clients have kept the
+				 * device open without streaming for 2
+				 * seconds. Apps restart the stream to
+				 * change format, that shouldn't pause.
+				 */
+				if (event_type)
+					read_events(fd);
+				if (clients > 0 && readers_idle())
+					quiet_ticks++;
+				else
+					quiet_ticks = 0;
+				if (quiet_ticks >= 2) {
+					fprintf(stderr,
+						"[monitor] %d client(s)"
+						" open, none streaming"
+						" — pausing\n", clients);
+					kill(child_pid, SIGSTOP);
+					paused = 1;
+					quiet_ticks = 0;
+					clock_gettime(CLOCK_MONOTONIC,
+						      &paused_at);
+					flight_record(FL_PAUSE, 0, 0);
+					atomic_store(&relay_state, 2);
+					printf("PAUSE\n");
+					continue;
+				}
+
 				if (clients <= 0)
 					idle_ticks++;
 				else
@@ -580,11 +3102,13 @@ int main(int argc, char *argv[])
 				/*
 				 * Stop when:
 				 * - Had clients and they're all gone
-				 *   for 3+ seconds
+				 *   for the profile's linger time
+				 *   (3 seconds by default)
 				 * - Never saw any clients after 10
 				 *   seconds (false start from scan)
 				 */
-				if ((had_clients && idle_ticks >= 3) ||
+				if ((had_clients &&
+				     idle_ticks >= run.linger) ||
 				    (!had_clients && idle_ticks >= 10))
 					need_stop = 1;
 			}
@@ -592,70 +3116,40 @@ int main(int argc, char *argv[])
 			if (need_stop) {
 				int clients = count_other_openers(
 					dev_stat.st_rdev, our_pid,
-					child_pid);
+					child_pid, NULL, 0);
 				fprintf(stderr,
 					"[monitor] Stopping pipeline"
 					" (clients=%d)\n", clients);
 
-				stop_pipeline(child_pid, pipe_fd);
+				if (child_pid)
+					stop_pipeline(child_pid, pipe_fd);
+				if (pipeline_ended)
+					flight_dump(FL_FAILED);
+				pipeline_ended = 0;
 				relay_active = 0;
 				pipe_fd = -1;
 				child_pid = 0;
 				check_tick = 0;
 				idle_ticks = 0;
 				had_clients = 0;
+				quiet_ticks = 0;
+				paused = 0;
 				prev_clients = 0;
 				printf("STOP\n");
 
 				/*
-				 * Re-open device to reset v4l2loopback
-				 * event queue. Without this, events
-				 * break permanently on 0.12.7 after the
-				 * first pipeline cycle.
+				 * Arm the events again for the next
+				 * client and put the device back to the
+				 * default format, see cycle_writer().
 				 */
-				if (use_events) {
-					close(fd);
-					fd = open_writer(device, width,
-						height, frame_size,
-						black_frame);
-					if (fd < 0) {
-						fprintf(stderr,
-							"[monitor] "
-							"Re-open "
-							"failed!\n");
-						running = 0;
-						break;
-					}
-					event_type =
-						try_subscribe_events(fd);
-					if (event_type == 0) {
-						fprintf(stderr,
-							"[monitor] "
-							"Event re-sub"
-							" failed,"
-							" using /proc"
-							" polling\n");
-						use_events = 0;
-					} else {
-						/* Drain initial event
-						 * (non-blocking — may
-						 * not exist on all
-						 * v4l2loopback versions) */
-						struct pollfd pfd = {
-							.fd = fd,
-							.events = POLLPRI
-						};
-						if (poll(&pfd, 1, 200)
-						    > 0) {
-							struct v4l2_event ev;
-							memset(&ev, 0,
-							       sizeof(ev));
-							xioctl(fd,
-							       VIDIOC_DQEVENT,
-							       &ev);
-						}
-					}
-				}
+				if (event_type ||
+				    frame_width != default_profile.width ||
+				    frame_height != default_profile.height ||
+				    frame_format != default_profile.format)
+					fd = cycle_writer(fd, device,
+						&default_profile,
+						black_frame, &event_type, 1);
+				atomic_store(&running_profile, -1);
 
 				/*
 				 * Check if clients remain. The IDLE
@@ -667,18 +3161,21 @@ int main(int argc, char *argv[])
 				 * failing rapidly (e.g. syntax error).
 				 */
 				rapid_fails++;
-				int remaining = count_other_openers(
-					dev_stat.st_rdev, our_pid, 0);
-				if (remaining > 0 && rapid_fails < 3) {
+				int remaining = active_clients(
+					dev_stat.st_rdev, our_pid, 0, &next);
+				if (remaining > 0 && !readers_idle() &&
+				    rapid_fails < 3) {
 					fprintf(stderr,
 						"[monitor] %d client(s)"
 						" still connected"
 						" — restarting\n",
 						remaining);
-					pipe_fd = start_pipeline(
-						pipeline_cmd,
+					pipe_fd = start_profile(&fd, device,
+						&next, black_frame,
+						&event_type, pipeline_cmd,
 						&child_pid);
 					if (pipe_fd >= 0) {
+						run = next;
 						relay_active = 1;
 						printf("START\n");
 					}
@@ -698,8 +3195,12 @@ int main(int argc, char *argv[])
 	fprintf(stderr, "[monitor] Shutting down\n");
 	if (relay_active)
 		stop_pipeline(child_pid, pipe_fd);
+	if (control_path)
+		unlink(control_path);
 	free(frame_buf);
 	free(black_frame);
+	if (spare_fd >= 0)
+		close(spare_fd);
 	if (fd >= 0)
 		close(fd);
 	return 0;
@@ -155,6 +155,8 @@ class CameraRelaySystray:
                 label = "Status: STOPPED"
             elif self.state == "idle":
                 label = "Status: ON-DEMAND (idle)"
+            elif self.state == "paused":
+                label = "Status: ON-DEMAND (paused)"
             elif self.state == "streaming":
                 label = "Status: STREAMING"
             else:
@@ -0,0 +1,468 @@
+#!/usr/bin/env bash
+# relay-bench.sh — End-to-end benchmark of the on-demand camera relay
+#
+# Runs the whole libcamera → camera-relay-monitor → v4l2loopback path on any
+# Linux machine, without the Samsung camera: the kernel's virtual camera
+# driver (vimc) stands in for the sensor. The script loads vimc and a
+# private v4l2loopback device, starts `camera-relay start --on-demand`
+# against them and plays the part of a V4L2 app opening and closing the
+# device. For each open/close cycle it measures:
+#
+#   - time from open() to the first frame and to the first camera frame
+#     (the monitor writes black frames until the pipeline delivers)
+#   - steady frame rate and the 99th percentile / worst frame gap
+#   - CPU time of the relay (monitor + GStreamer) per delivered frame
+#   - time from close() until the pipeline is stopped and the relay idle
+#
+# plus the daemon startup time, idle CPU use, a reopen within the monitor's
+# linger time and `camera-relay stop`.
+#
+# By default the camera-relay script and camera-relay-monitor.c of this
+# tree are used (the monitor is built into a temporary directory), so relay
+# changes can be compared before installing them. vimc goes through the
+# libcamera vimc pipeline handler, not the Simple pipeline handler, so
+# SoftISP changes are measured with softisp-bench instead.
+#
+# Usage: ./relay-bench.sh [options]
+#   -c, --cycles N       open/close cycles (default 5)
+#   -d, --duration SEC   seconds each client streams once frames arrive (default 10)
+#   -n, --clients N      readers opening the device together (default 1)
+#   --camera ID          libcamera camera (default: the first vimc camera)
+#   --device DEV         existing v4l2loopback device (default: create one)
+#   --installed          use /usr/local/bin/camera-relay and its monitor
+#
+# Requires: sudo (modprobe), gcc, python3, gst-launch-1.0 with libcamerasrc
+
+set -euo pipefail
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+CARD_LABEL="Relay Bench"
+VIMC_CAMERA="platform/vimc.0 Sensor B"
+
+CYCLES=5
+DURATION=10
+CLIENTS=1
+CAMERA=""
+DEVICE=""
+INSTALLED=false
+
+die() { echo "ERROR: $*" >&2; exit 1; }
+info() { echo "[relay-bench] $*"; }
+
+usage() {
+    sed -n 's/^# \{0,1\}//;/^Usage:/,/^Requires:/p' "$0"
+}
+
+while [[ $# -gt 0 ]]; do
+    case "$1" in
+        -c|--cycles)    CYCLES="${2:?}"; shift 2 ;;
+        -d|--duration)  DURATION="${2:?}"; shift 2 ;;
+        -n|--clients)   CLIENTS="${2:?}"; shift 2 ;;
+        --camera)       CAMERA="${2:?}"; shift 2 ;;
+        --device)       DEVICE="${2:?}"; shift 2 ;;
+        --installed)    INSTALLED=true; shift ;;
+        -h|--help)      usage; exit 0 ;;
+        *)              usage >&2; exit 1 ;;
+    esac
+done
+
+[[ "$CYCLES" =~ ^[1-9][0-9]*$ ]] || die "--cycles must be a positive number"
+[[ "$DURATION" =~ ^[1-9][0-9]*$ ]] || die "--duration must be a positive number"
+[[ "$CLIENTS" =~ ^[1-9][0-9]*$ ]] || die "--clients must be a positive number"
+
+for tool in python3 gst-launch-1.0 gst-inspect-1.0; do
+    command -v "$tool" &>/dev/null || die "$tool not found"
+done
+
+if $INSTALLED; then
+    RELAY=/usr/local/bin/camera-relay
+    MONITOR=/usr/local/bin/camera-relay-monitor
+    [[ -x "$RELAY" && -x "$MONITOR" ]] || die "camera-relay is not installed"
+else
+    RELAY="$SCRIPT_DIR/camera-relay"
+    command -v gcc &>/dev/null || die "gcc not found (or use --installed)"
+fi
+
+WORK=$(mktemp -d /tmp/relay-bench.XXXXXX)
+LOADED_VIMC=false
+LOADED_LOOPBACK=false
+ADDED_LOOPBACK=""
+
+cleanup() {
+    # The relay reads its PID file from the private runtime directory
+    XDG_RUNTIME_DIR="$WORK" XDG_CACHE_HOME="$WORK" "$RELAY" stop &>/dev/null || true
+    if [[ -n "$ADDED_LOOPBACK" ]]; then
+        sudo v4l2loopback-ctl delete "$ADDED_LOOPBACK" &>/dev/null || true
+    fi
+    if $LOADED_LOOPBACK; then
+        sudo modprobe -r v4l2loopback &>/dev/null || true
+    fi
+    if $LOADED_VIMC; then
+        sudo modprobe -r vimc &>/dev/null || true
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+find_bench_device() {
+    local name
+    for name in /sys/devices/virtual/video4linux/video*/name; do
+        [[ -f "$name" ]] || continue
+        if [[ "$(cat "$name" 2>/dev/null)" == "$CARD_LABEL" ]]; then
+            echo "/dev/$(basename "$(dirname "$name")")"
+            return 0
+        fi
+    done
+    return 1
+}
+
+# ── Camera relay monitor ─────────────────────────────────────────────────────
+
+if $INSTALLED; then
+    info "Using installed $RELAY"
+else
+    MONITOR="$WORK/camera-relay-monitor"
+    gcc -O2 -Wall -pthread -o "$MONITOR" "$SCRIPT_DIR/camera-relay-monitor.c" \
+        || die "Failed to build camera-relay-monitor"
+    info "Built camera-relay-monitor from $SCRIPT_DIR"
+fi
+
+# ── vimc ─────────────────────────────────────────────────────────────────────
+
+if [[ ! -d /sys/module/vimc ]]; then
+    modinfo vimc &>/dev/null || die "vimc kernel module not found (CONFIG_VIDEO_VIMC)"
+    info "Loading vimc..."
+    sudo modprobe vimc || die "Failed to load vimc"
+    LOADED_VIMC=true
+    sleep 1
+fi
+
+gst-inspect-1.0 libcamerasrc &>/dev/null || die "GStreamer 'libcamerasrc' element not found"
+
+if [[ -z "$CAMERA" ]]; then
+    CAMERA="$VIMC_CAMERA"
+    if command -v cam &>/dev/null; then
+        # Output format: "1: 'Sensor B' (platform/vimc.0 Sensor B)"
+        name=$(cam -l 2>/dev/null | grep -oP '\(\Kplatform/vimc[^)]*' | head -1 || true)
+        [[ -n "$name" ]] && CAMERA="$name"
+    fi
+fi
+
+# One frame through libcamera first, so a missing vimc pipeline handler
+# isn't reported as a relay failure.
+if ! timeout 20 gst-launch-1.0 -q libcamerasrc camera-name="$CAMERA" num-buffers=1 \
+        ! fakesink &>"$WORK/probe.log"; then
+    tail -5 "$WORK/probe.log" >&2
+    die "libcamera can't stream from '$CAMERA'. Is libcamera built with the vimc pipeline handler?"
+fi
+
+# ── v4l2loopback ─────────────────────────────────────────────────────────────
+
+if [[ -z "$DEVICE" ]]; then
+    if [[ ! -d /sys/module/v4l2loopback ]]; then
+        modinfo v4l2loopback &>/dev/null || die "v4l2loopback kernel module not found"
+        info "Loading v4l2loopback..."
+        sudo modprobe v4l2loopback devices=1 exclusive_caps=0 card_label="$CARD_LABEL" \
+            || die "Failed to load v4l2loopback"
+        LOADED_LOOPBACK=true
+    elif ! find_bench_device &>/dev/null; then
+        # Leave the installed relay's device alone, add a second one
+        command -v v4l2loopback-ctl &>/dev/null \
+            || die "v4l2loopback is in use and v4l2loopback-ctl is missing. Use --device"
+        ADDED_LOOPBACK=$(sudo v4l2loopback-ctl add -n "$CARD_LABEL" -x 0 2>/dev/null | tail -1) \
+            || die "v4l2loopback-ctl add failed. Use --device"
+    fi
+    sleep 1
+    DEVICE=$(find_bench_device) || die "No '$CARD_LABEL' loopback device appeared"
+fi
+[[ -c "$DEVICE" ]] || die "$DEVICE is not a device"
+
+info "Camera:   $CAMERA"
+info "Loopback: $DEVICE"
+info "$CYCLES cycles of $DURATION s, $CLIENTS client(s)"
+echo ""
+
+# ── Measurement ──────────────────────────────────────────────────────────────
+
+# Private state and probe cache, apart from the user's own relay
+export XDG_RUNTIME_DIR="$WORK"
+export XDG_CACHE_HOME="$WORK"
+export RELAY_CAMERA="$CAMERA"
+export RELAY_DEVICE="$DEVICE"
+export RELAY_MONITOR_BIN="$MONITOR"
+
+python3 - "$RELAY" "$DEVICE" "$WORK" "$CYCLES" "$DURATION" "$CLIENTS" <<'EOF'
+import fcntl
+import os
+import select
+import statistics
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+relay, device, work = sys.argv[1:4]
+cycles, duration, clients = (int(a) for a in sys.argv[4:7])
+
+TICK = os.sysconf('SC_CLK_TCK')
+STATE = os.path.join(work, 'camera-relay-state')
+LOG = os.path.join(work, 'relay.log')
+
+# VIDIOC_G_FMT: _IOWR('V', 4, struct v4l2_format), 208 bytes on 64-bit
+VIDIOC_G_FMT = (3 << 30) | (208 << 16) | (ord('V') << 8) | 4
+V4L2_BUF_TYPE_VIDEO_CAPTURE = 1
+
+
+class BenchError(Exception):
+    pass
+
+
+def now():
+    return time.monotonic()
+
+
+def ms(seconds):
+    return f'{seconds * 1000:.0f} ms' if seconds is not None else '-'
+
+
+def frame_format(fd):
+    buf = bytearray(208)
+    struct.pack_into('I', buf, 0, V4L2_BUF_TYPE_VIDEO_CAPTURE)
+    fcntl.ioctl(fd, VIDIOC_G_FMT, buf)
+    # struct v4l2_pix_format starts at offset 8
+    width, height, _, _, _, size = struct.unpack_from('6I', buf, 8)
+    return width, height, size
+
+
+def black_frame(size):
+    # What camera-relay-monitor writes while idle: YUY2 Y=0x10, U=V=0x80
+    return b'\x10\x80' * (size // 2)
+
+
+def descendants(root):
+    children = {}
+    for entry in os.listdir('/proc'):
+        if not entry.isdigit():
+            continue
+        try:
+            with open(f'/proc/{entry}/stat') as f:
+                stat = f.read()
+        except OSError:
+            continue
+        ppid = int(stat[stat.rindex(')') + 2:].split()[1])
+        children.setdefault(ppid, []).append(int(entry))
+    pids, todo = [], [root]
+    while todo:
+        pid = todo.pop()
+        pids.append(pid)
+        todo.extend(children.get(pid, []))
+    return pids
+
+
+def cpu_ticks(root):
+    """utime + stime of every process of the relay, by PID, with its name."""
+    ticks = {}
+    for pid in descendants(root):
+        try:
+            with open(f'/proc/{pid}/stat') as f:
+                stat = f.read()
+        except OSError:
+            continue
+        comm = stat[stat.index('(') + 1:stat.rindex(')')]
+        fields = stat[stat.rindex(')') + 2:].split()
+        ticks[pid] = (comm, int(fields[11]) + int(fields[12]))
+    return ticks
+
+
+def cpu_seconds(before, after, match=None):
+    total = 0
+    for pid, (comm, ticks) in after.items():
+        if match and not comm.startswith(match):
+            continue
+        total += ticks - before.get(pid, (comm, 0))[1]
+    return total / TICK
+
+
+def pipeline_running(root):
+    return any(comm.startswith('gst-launch') for comm, _ in cpu_ticks(root).values())
+
+
+def state():
+    try:
+        with open(STATE) as f:
+            return f.read().strip()
+    except OSError:
+        return ''
+
+
+def wait_for(condition, timeout):
+    start = now()
+    while now() - start < timeout:
+        if condition():
+            return now() - start
+        time.sleep(0.01)
+    return None
+
+
+class Reader(threading.Thread):
+    """A second app reading along, to check that extra readers don't stall."""
+
+    def __init__(self):
+        super().__init__(daemon=True)
+        self.done = threading.Event()
+        self.frames = 0
+
+    def run(self):
+        fd = os.open(device, os.O_RDONLY)
+        try:
+            size = frame_format(fd)[2]
+            while not self.done.is_set():
+                if select.select([fd], [], [], 0.5)[0] and len(os.read(fd, size)) == size:
+                    self.frames += 1
+        finally:
+            os.close(fd)
+
+
+def client(root, seconds):
+    """Open the device like an app, read until camera frames flowed for seconds."""
+    extra = [Reader() for _ in range(clients - 1)]
+    start = now()
+    fd = os.open(device, os.O_RDONLY)
+    for reader in extra:
+        reader.start()
+
+    result = {'first': None, 'camera': None}
+    try:
+        width, height, size = frame_format(fd)
+        result['format'] = f'{width}x{height}'
+        black = black_frame(size)
+        times = []
+        cpu_start = None
+        while True:
+            if not select.select([fd], [], [], 15)[0]:
+                raise BenchError('no frame for 15 s')
+            frame = os.read(fd, size)
+            t = now()
+            if len(frame) != size:
+                continue
+            if result['first'] is None:
+                result['first'] = t - start
+            if not times:
+                if frame == black:
+                    continue
+                result['camera'] = t - start
+                cpu_start = cpu_ticks(root)
+            times.append(t)
+            if t - times[0] >= seconds:
+                break
+        cpu_end = cpu_ticks(root)
+    finally:
+        os.close(fd)
+        for reader in extra:
+            reader.done.set()
+            reader.join()
+    closed = now()
+
+    frames = len(times) - 1
+    wall = times[-1] - times[0]
+    gaps = sorted(b - a for a, b in zip(times, times[1:]))
+    cpu = cpu_seconds(cpu_start, cpu_end)
+    result.update(
+        fps=frames / wall,
+        p99=gaps[min(len(gaps) - 1, int(len(gaps) * 0.99))],
+        worst=gaps[-1],
+        cpu_frame=cpu / frames,
+        cpu_pct=cpu / wall * 100,
+        monitor_frame=cpu_seconds(cpu_start, cpu_end, 'camera-relay-mo') / frames,
+        extra=min((r.frames for r in extra), default=None),
+        closed=closed,
+    )
+    return result
+
+
+def wait_stopped(root, closed):
+    done = wait_for(lambda: state() == 'idle' and not pipeline_running(root), 30)
+    return None if done is None else now() - closed
+
+
+def main():
+    log = open(LOG, 'w')
+    start = now()
+    proc = subprocess.Popen([relay, 'start', '--on-demand'], stdout=log,
+                            stderr=subprocess.STDOUT, start_new_session=True)
+
+    def ready():
+        with open(LOG) as f:
+            return 'Monitor ready' in f.read()
+
+    try:
+        if wait_for(lambda: ready() or proc.poll() is not None, 30) is None or not ready():
+            raise BenchError('relay did not become ready')
+        startup = now() - start
+        time.sleep(0.5)
+
+        idle_start = cpu_ticks(proc.pid)
+        time.sleep(5)
+        idle_cpu = cpu_seconds(idle_start, cpu_ticks(proc.pid)) / 5 * 100
+
+        print(f'  Daemon ready:  {ms(startup)}')
+        print(f'  Idle CPU:      {idle_cpu:.2f} % of one core (5 s)')
+        print('')
+        print(f'  {"cycle":<6} {"1st frame":>10} {"camera":>9} {"fps":>6} {"p99 gap":>8} '
+              f'{"worst":>7} {"CPU/frame":>10} {"monitor":>8} {"CPU":>6} {"stop":>8}')
+
+        rows = []
+        failed = False
+        for cycle in range(1, cycles + 1):
+            r = client(proc.pid, duration)
+            r['stop'] = wait_stopped(proc.pid, r['closed'])
+            rows.append(r)
+            if cycle == 1:
+                print(f'  {"":<6} ({r["format"]} YUYV, open → first frame / first camera frame, '
+                      f'close → pipeline stopped)')
+            extra = f'  (other readers: {r["extra"]} frames)' if r['extra'] is not None else ''
+            print(f'  {cycle:<6} {ms(r["first"]):>10} {ms(r["camera"]):>9} {r["fps"]:>6.1f} '
+                  f'{ms(r["p99"]):>8} {ms(r["worst"]):>7} {r["cpu_frame"] * 1000:>7.2f} ms '
+                  f'{r["monitor_frame"] * 1000:>5.2f} ms {r["cpu_pct"]:>5.1f}% {ms(r["stop"]):>8}'
+                  f'{extra}')
+            if r['stop'] is None:
+                print('         pipeline still running 30 s after close')
+                failed = True
+            if r['extra'] == 0:
+                print('         other readers got no frames')
+                failed = True
+
+        if cycles > 1:
+            med = {k: statistics.median(r[k] for r in rows[1:])
+                   for k in ('camera', 'fps', 'cpu_frame', 'cpu_pct')}
+            print(f'  restart median: camera after {ms(med["camera"])}, {med["fps"]:.1f} fps, '
+                  f'{med["cpu_frame"] * 1000:.2f} ms CPU/frame ({med["cpu_pct"]:.1f}%)')
+
+        # Reopening while the monitor still lingers must not restart the camera
+        client(proc.pid, 1)
+        time.sleep(0.5)
+        reopen = client(proc.pid, 1)
+        print(f'  Reopen after 0.5 s: camera frames after {ms(reopen["camera"])}')
+        wait_stopped(proc.pid, reopen['closed'])
+
+        start = now()
+        subprocess.run([relay, 'stop'], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        proc.wait(timeout=30)
+        print(f'  camera-relay stop: {ms(now() - start)}')
+        return 1 if failed else 0
+    except BenchError as e:
+        print(f'ERROR: {e}. Relay and monitor logs:', file=sys.stderr)
+        for path in (LOG, os.path.join(work, 'camera-relay.log')):
+            if os.path.exists(path):
+                with open(path) as f:
+                    sys.stderr.write(''.join(f.readlines()[-20:]))
+        return 1
+    finally:
+        if proc.poll() is None:
+            os.killpg(proc.pid, 15)
+            proc.wait()
+
+
+sys.exit(main())
+EOF
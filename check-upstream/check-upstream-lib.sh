@@ -0,0 +1,151 @@
+# check-upstream-lib.sh — Shared helpers for the *-check-upstream.sh boot checks
+#
+# max98390-hda-check-upstream.sh, ipu-bridge-check-upstream.sh and
+# v4l2-relayd-check-upstream.sh run on every boot to find out whether the
+# running kernel has caught up with one of our workarounds. The answer only
+# changes when the kernel (or the files a check looks at) change, so each
+# check records its verdict in /var/cache/check-upstream/NAME, keyed by the
+# kernel release and the identity (device, inode, size, mtime) of every
+# file it looked at. On the next boot with the same key the check returns
+# at once without touching the modules.
+#
+# Modules are found through modules.order, which lists the in-tree modules
+# of a kernel, instead of searching /lib/modules: DKMS copies live under
+# updates/ and never stand in for the kernel's own module. Alias lookups use
+# modinfo, which only reads the .modinfo section. String lookups still need
+# the module decompressed, but only on a cache miss, and stop at the first
+# match.
+#
+# Usage from a check script:
+#   . /usr/local/share/check-upstream/check-upstream-lib.sh
+#   check_begin NAME                 # prefix for log lines and cache name
+#   mod=$(kmod_intree ipu-bridge)    # in-tree module file, if any
+#   check_key "$mod"                 # add files the verdict depends on
+#   check_cached && exit 0           # verdict unchanged since last boot
+#   not_ready "reason"               # one per failed check
+#   check_store                      # record the verdict (skip if transient)
+#
+# Installed to /usr/local/share/check-upstream/check-upstream-lib.sh
+
+CHECK_CACHE_DIR="/var/cache/check-upstream"
+KERNEL_RELEASE="$(uname -r)"
+MODULE_DIR="/lib/modules/$KERNEL_RELEASE"
+
+CHECK_NAME=""
+CHECK_KEY=""
+CHECK_NOTES=()
+UPSTREAM_READY=true
+
+log() { echo "${CHECK_NAME}-check: $*"; }
+
+# check_begin NAME — start a check; the cache key starts with the kernel
+check_begin() {
+    CHECK_NAME="$1"
+    CHECK_KEY="kernel=$KERNEL_RELEASE"
+    CHECK_NOTES=()
+    UPSTREAM_READY=true
+    check_key "$MODULE_DIR/modules.order"
+}
+
+# check_key [FILE]... — make the cached verdict depend on these files. An
+# empty argument (a module that wasn't found) is recorded as such, so the
+# module appearing later is a cache miss too.
+check_key() {
+    local file
+    for file in "$@"; do
+        if [[ -z "$file" ]]; then
+            CHECK_KEY+=" -"
+        elif [[ -e "$file" ]]; then
+            CHECK_KEY+=" $(stat -L -c '%n:%d:%i:%s:%.9Y' "$file")"
+        else
+            CHECK_KEY+=" $file:missing"
+        fi
+    done
+}
+
+# not_ready REASON — a check failed
+not_ready() {
+    UPSTREAM_READY=false
+    CHECK_NOTES+=("$1")
+    log "$1"
+}
+
+# check_cached — true if the last verdict was taken with the same key; it
+# repeats that verdict's reasons and sets UPSTREAM_READY from it
+check_cached() {
+    local cache="$CHECK_CACHE_DIR/$CHECK_NAME" key verdict line
+    [[ -r "$cache" ]] || return 1
+    {
+        IFS= read -r key
+        IFS= read -r verdict
+    } < "$cache"
+    [[ "$key" == "key=$CHECK_KEY" ]] || return 1
+
+    UPSTREAM_READY=false
+    [[ "$verdict" == "verdict=ready" ]] && UPSTREAM_READY=true
+    while IFS= read -r line; do
+        [[ "$line" == note=* ]] && log "${line#note=} (cached)"
+    done < "$cache"
+    return 0
+}
+
+# check_store — record the verdict of this boot for the current key
+check_store() {
+    local cache="$CHECK_CACHE_DIR/$CHECK_NAME" note
+    mkdir -p "$CHECK_CACHE_DIR" || return 0
+    {
+        echo "key=$CHECK_KEY"
+        if $UPSTREAM_READY; then echo "verdict=ready"; else echo "verdict=not-ready"; fi
+        for note in "${CHECK_NOTES[@]}"; do
+            echo "note=$note"
+        done
+    } > "$cache.tmp" && mv -f "$cache.tmp" "$cache"
+}
+
+# check_forget — drop the cached verdict, e.g. when the workaround is removed
+check_forget() {
+    rm -f "$CHECK_CACHE_DIR/$CHECK_NAME"
+    rmdir "$CHECK_CACHE_DIR" 2>/dev/null || true
+}
+
+# kmod_intree NAME — print the running kernel's own NAME.ko[.zst|.xz|.gz]
+kmod_intree() {
+    local name="$1" rel ext
+    if [[ -r "$MODULE_DIR/modules.order" ]]; then
+        rel=$(grep -m1 -E "(^|/)${name}\.ko\$" "$MODULE_DIR/modules.order") || return 1
+        for ext in "" .zst .xz .gz; do
+            if [[ -e "$MODULE_DIR/$rel$ext" ]]; then
+                echo "$MODULE_DIR/$rel$ext"
+                return 0
+            fi
+        done
+        return 1
+    fi
+    # No modules.order (unusual packaging): search the kernel/ tree
+    rel=$(find "$MODULE_DIR/kernel" -name "${name}.ko*" 2>/dev/null | head -1)
+    [[ -n "$rel" ]] && echo "$rel"
+}
+
+# kmod_has_alias MODULE PATTERN — the module declares a matching alias
+kmod_has_alias() {
+    modinfo -F alias "$1" 2>/dev/null | grep -q -- "$2"
+}
+
+# kmod_has_string MODULE STRING — the module contains STRING, e.g. a quirk
+# name or DMI match in its read-only data
+kmod_has_string() {
+    local mod="$1" cat
+    case "$mod" in
+        *.zst) cat="zstdcat" ;;
+        *.xz)  cat="xzcat" ;;
+        *.gz)  cat="zcat" ;;
+        *)     cat="cat" ;;
+    esac
+    "$cat" "$mod" 2>/dev/null | grep -qaF -- "$2"
+}
+
+# check_cleanup_lib — remove this library once no check script uses it
+check_cleanup_lib() {
+    compgen -G "/usr/local/sbin/*-check-upstream.sh" > /dev/null && return 0
+    rm -rf /usr/local/share/check-upstream "$CHECK_CACHE_DIR"
+}
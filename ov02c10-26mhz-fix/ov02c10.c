@@ -1003,6 +1003,12 @@ static struct i2c_driver ov02c10_i2c_driver = {
 		.pm = pm_sleep_ptr(&ov02c10_pm_ops),
 		.acpi_match_table = ACPI_PTR(ov02c10_acpi_ids),
 		.of_match_table = ov02c10_of_match,
+		/*
+		 * Powering the sensor up and identifying it over I2C takes a
+		 * while and needs nothing else from boot; don't hold up the
+		 * driver core (or modprobe) for it.
+		 */
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe = ov02c10_probe,
 	.remove = ov02c10_remove,
@@ -162,6 +162,7 @@ echo "Installing services..."
 SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
 install -m 755 "${SCRIPT_DIR}/max98390-hda-i2c-setup.sh" /usr/local/sbin/
 install -m 755 "${SCRIPT_DIR}/max98390-hda-check-upstream.sh" /usr/local/sbin/
+install -D -m 644 "${SCRIPT_DIR}/../check-upstream/check-upstream-lib.sh" /usr/local/share/check-upstream/check-upstream-lib.sh
 install -m 644 "${SCRIPT_DIR}/max98390-hda-i2c-setup.service" /etc/systemd/system/
 install -m 644 "${SCRIPT_DIR}/max98390-hda-check-upstream.service" /etc/systemd/system/
 systemctl daemon-reload
@@ -7,42 +7,46 @@
 #   - Speakers already work (our modules loaded earlier in boot)
 #   - This script removes DKMS, services, autoload config
 #   - Next reboot uses the native kernel driver instead
+#
+# The verdict is cached per kernel and module files (check-upstream-lib.sh),
+# so later boots of the same kernel skip the module lookups.
 
 DKMS_NAME="max98390-hda"
 DKMS_VER="1.0"
-UPSTREAM_READY=true
 
-log() { echo "max98390-hda-check: $*"; }
+# Shared helpers: module lookup and the per-kernel verdict cache
+CHECK_LIB=/usr/local/share/check-upstream/check-upstream-lib.sh
+[ -r "$CHECK_LIB" ] || CHECK_LIB="$(dirname "$0")/../check-upstream/check-upstream-lib.sh"
+. "$CHECK_LIB" || exit 0
+
+check_begin max98390-hda
 
-# Check 1: Does serial-multi-instantiate know about MAX98390?
-SMI_MODULE=$(find "/lib/modules/$(uname -r)/kernel/drivers/platform/x86" -name "serial-multi-instantiate*" 2>/dev/null | head -1)
-if [ -n "$SMI_MODULE" ]; then
-    if ! modinfo "$SMI_MODULE" 2>/dev/null | grep -q "alias.*MAX98390"; then
-        UPSTREAM_READY=false
-        log "serial-multi-instantiate: missing MAX98390 support"
+SMI_MODULE=$(kmod_intree serial-multi-instantiate)
+ALC_MODULE=$(kmod_intree snd-hda-codec-alc269)
+NATIVE_MODULE=$(kmod_intree snd-hda-scodec-max98390)
+check_key "$SMI_MODULE" "$ALC_MODULE" "$NATIVE_MODULE"
+
+if ! check_cached; then
+    # Check 1: Does serial-multi-instantiate know about MAX98390?
+    if [ -z "$SMI_MODULE" ]; then
+        not_ready "serial-multi-instantiate: module not found"
+    elif ! kmod_has_alias "$SMI_MODULE" "MAX98390"; then
+        not_ready "serial-multi-instantiate: missing MAX98390 support"
     fi
-else
-    UPSTREAM_READY=false
-    log "serial-multi-instantiate: module not found"
-fi
 
-# Check 2: Does snd_hda_codec_alc269 have the max98390 fixup?
-ALC_MODULE=$(find "/lib/modules/$(uname -r)/kernel/sound" -name "snd-hda-codec-alc269*" 2>/dev/null | head -1)
-if [ -n "$ALC_MODULE" ]; then
-    if ! zstdcat "$ALC_MODULE" 2>/dev/null | strings | grep -q "alc298-samsung-max98390"; then
-        UPSTREAM_READY=false
-        log "snd_hda_codec_alc269: missing MAX98390 quirk entries"
+    # Check 2: Does snd_hda_codec_alc269 have the max98390 fixup?
+    if [ -z "$ALC_MODULE" ]; then
+        not_ready "snd_hda_codec_alc269: module not found"
+    elif ! kmod_has_string "$ALC_MODULE" "alc298-samsung-max98390"; then
+        not_ready "snd_hda_codec_alc269: missing MAX98390 quirk entries"
+    fi
+
+    # Check 3: Is there a native snd-hda-scodec-max98390 in the kernel tree?
+    if [ -z "$NATIVE_MODULE" ]; then
+        not_ready "snd-hda-scodec-max98390: not in kernel tree"
     fi
-else
-    UPSTREAM_READY=false
-    log "snd_hda_codec_alc269: module not found"
-fi
 
-# Check 3: Is there a native snd-hda-scodec-max98390 in the kernel tree?
-NATIVE_MODULE=$(find "/lib/modules/$(uname -r)/kernel/sound" -name "snd-hda-scodec-max98390*" 2>/dev/null | head -1)
-if [ -z "$NATIVE_MODULE" ]; then
-    UPSTREAM_READY=false
-    log "snd-hda-scodec-max98390: not in kernel tree"
+    check_store
 fi
 
 if ! $UPSTREAM_READY; then
@@ -75,6 +79,8 @@ rm -f /etc/modules-load.d/max98390-hda.conf
 rm -f /usr/local/sbin/max98390-hda-i2c-setup.sh
 rm -f /usr/local/sbin/max98390-hda-check-upstream.sh
 rm -rf "/usr/src/${DKMS_NAME}-${DKMS_VER}"
+check_forget
+check_cleanup_lib
 
 systemctl daemon-reload
 
@@ -5,16 +5,43 @@
 // Based on PR #5616 from thesofproject/linux by Kevin Cuperus
 //
 
+#include <linux/debugfs.h>
 #include <linux/module.h>
 #include <linux/regmap.h>
 #include <linux/component.h>
+#include <linux/seq_file.h>
 #include <sound/hda_codec.h>
 #include "hda_scodec_component.h"
 #include "hda_generic.h"
 #include "max98390_hda.h"
 #include "max98390_hda_filters.h"
+#include "max98390_hda_gate.h"
 #include "max98390_regs.h"
 
+static struct dentry *max98390_debugfs_root;
+
+/*
+ * With the hooks bound, the first PCM after a system resume waits for the
+ * amp to be restored, if that is still running, and records how long
+ * audio took to come back. Unbound, the resume work records it.
+ */
+static void max98390_hda_wait_resume(struct max98390_hda_priv *priv)
+{
+	ktime_t start;
+
+	if (!priv->resume_audio_pending)
+		return;
+
+	start = ktime_get();
+	if (!completion_done(&priv->resume_done) &&
+	    !wait_for_completion_timeout(&priv->resume_done, msecs_to_jiffies(2000)))
+		dev_warn(priv->dev, "Amp restore still running, playing anyway\n");
+
+	priv->wait_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	priv->audio_ns = ktime_to_ns(ktime_sub(ktime_get(), priv->resume_start));
+	priv->resume_audio_pending = false;
+}
+
 static void max98390_hda_playback_hook(struct device *dev, int action)
 {
 	struct max98390_hda_priv *priv = dev_get_drvdata(dev);
@@ -22,6 +49,8 @@ static void max98390_hda_playback_hook(struct device *dev, int action)
 
 	switch (action) {
 	case HDA_GEN_PCM_ACT_OPEN:
+		max98390_hda_wait_resume(priv);
+		priv->pcm_open = true;
 
 		/* Enable global and speaker amp */
 		ret = regmap_write(priv->regmap, MAX98390_R23FF_GLOBAL_EN, 0x01);
@@ -32,9 +61,19 @@ static void max98390_hda_playback_hook(struct device *dev, int action)
 		if (ret < 0)
 			dev_err(dev, "Failed to write AMP_EN: %d\n", ret);
 
+		/* Watch for silence while the stream stays open */
+		max98390_gate_start(priv);
+		break;
+
+	case HDA_GEN_PCM_ACT_PREPARE:
+		/* A stream open across suspend is prepared again on resume */
+		max98390_hda_wait_resume(priv);
 		break;
 
 	case HDA_GEN_PCM_ACT_CLOSE:
+		max98390_gate_stop(priv);
+		priv->pcm_open = false;
+
 		/* Disable speaker amp and global */
 		regmap_write(priv->regmap, MAX98390_R203A_AMP_EN, 0x80);
 		regmap_write(priv->regmap, MAX98390_R23FF_GLOBAL_EN, 0x00);
@@ -58,6 +97,7 @@ static int max98390_hda_bind(struct device *dev, struct device *master, void *ma
 	comp->dev = dev;
 	strscpy(comp->name, dev_name(dev), sizeof(comp->name));
 	comp->playback_hook = max98390_hda_playback_hook;
+	priv->codec = parent->codec;
 
 	dev_info(dev, "MAX98390 HDA component bound (index %d)\n", priv->index);
 
@@ -76,6 +116,7 @@ static void max98390_hda_unbind(struct device *dev, struct device *master, void
 		memset(comp->name, 0, sizeof(comp->name));
 		comp->playback_hook = NULL;
 	}
+	priv->codec = NULL;
 
 	dev_info(dev, "MAX98390 HDA component unbound\n");
 }
@@ -136,6 +177,70 @@ static int max98390_hda_init(struct max98390_hda_priv *priv)
 	return 0;
 }
 
+/*
+ * Restore the amp after a system resume, off the resume path. The amps
+ * lose power in S3 (not always in s2idle): if DSP_GLOBAL_EN, which init
+ * sets at its end, reads back as set, the registers survived and nothing is
+ * set up again. Otherwise the amp is reset and set up again, DSM
+ * parameters included. Then it is turned on or off for the PCM state.
+ */
+static void max98390_hda_resume_work(struct work_struct *work)
+{
+	struct max98390_hda_priv *priv =
+		container_of(work, struct max98390_hda_priv, resume_work);
+	unsigned int reg = 0;
+	ktime_t start = ktime_get();
+	int ret;
+
+	regmap_read(priv->regmap, MAX98390_R23E1_DSP_GLOBAL_EN, &reg);
+	priv->resume_reinit = !(reg & 0x01);
+	if (priv->resume_reinit) {
+		ret = max98390_hda_init(priv);
+		if (ret)
+			dev_err(priv->dev, "Failed to restore amp after resume: %d\n", ret);
+	}
+
+	/* The amp is on unless bound to the codec with no PCM open; suspend
+	 * may have found it gated */
+	if (!priv->codec || priv->pcm_open) {
+		regmap_write(priv->regmap, MAX98390_R23FF_GLOBAL_EN, 0x01);
+		regmap_write(priv->regmap, MAX98390_R203A_AMP_EN, 0x81);
+		max98390_gate_start(priv);
+	} else {
+		regmap_write(priv->regmap, MAX98390_R203A_AMP_EN, 0x80);
+		regmap_write(priv->regmap, MAX98390_R23FF_GLOBAL_EN, 0x00);
+	}
+
+	priv->restore_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	/* Without the hooks no PCM waits: audio is back once the amp is on */
+	if (!priv->codec && priv->resume_audio_pending) {
+		priv->wait_ns = 0;
+		priv->audio_ns = ktime_to_ns(ktime_sub(ktime_get(), priv->resume_start));
+		priv->resume_audio_pending = false;
+	}
+	complete_all(&priv->resume_done);
+}
+
+static int max98390_hda_resume_show(struct seq_file *s, void *data)
+{
+	struct max98390_hda_priv *priv = s->private;
+
+	seq_printf(s, "resumes:    %u\n", priv->system_resumes);
+	seq_printf(s, "restore:    %s\n", !completion_done(&priv->resume_done) ?
+		   "running" : priv->resume_reinit ? "reinit" : "kept");
+	seq_printf(s, "restore_ms: %llu\n", div_u64(priv->restore_ns, NSEC_PER_MSEC));
+	if (priv->resume_audio_pending) {
+		seq_puts(s, "wait_ms:    -\naudio_ms:   -\n");
+	} else {
+		seq_printf(s, "wait_ms:    %llu\n", div_u64(priv->wait_ns, NSEC_PER_MSEC));
+		seq_printf(s, "audio_ms:   %llu\n", div_u64(priv->audio_ns, NSEC_PER_MSEC));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(max98390_hda_resume);
+
 int max98390_hda_probe(struct device *dev, const char *device_name,
 		       int id, int irq, struct regmap *regmap,
 		       enum max98390_hda_bus_type bus_type, int i2c_addr)
@@ -153,17 +258,37 @@ int max98390_hda_probe(struct device *dev, const char *device_name,
 	priv->irq = irq;
 	priv->index = id;
 	priv->i2c_addr = i2c_addr;
+	priv->debugfs = debugfs_create_dir(dev_name(dev), max98390_debugfs_root);
 	dev_set_drvdata(dev, priv);
+	max98390_gate_init(priv);
+	INIT_WORK(&priv->resume_work, max98390_hda_resume_work);
+	init_completion(&priv->resume_done);
+	complete_all(&priv->resume_done);
+	debugfs_create_file("resume", 0444, priv->debugfs, priv,
+			    &max98390_hda_resume_fops);
 
 	ret = max98390_hda_init(priv);
 	if (ret)
-		return ret;
+		goto err;
+
+	/* Init leaves the amp on; the gate turns it off while nothing plays */
+	max98390_gate_attach(priv);
+	max98390_gate_start(priv);
 
 	ret = component_add(dev, &max98390_hda_comp_ops);
 	if (ret)
-		return ret;
+		goto err_gate;
+
+	/* Resume alongside the rest of the system, see system_resume() */
+	device_enable_async_suspend(dev);
 
 	return 0;
+
+err_gate:
+	max98390_gate_detach(priv);
+err:
+	debugfs_remove_recursive(priv->debugfs);
+	return ret;
 }
 EXPORT_SYMBOL_NS_GPL(max98390_hda_probe, "SND_HDA_SCODEC_MAX98390");
 
@@ -173,6 +298,12 @@ void max98390_hda_remove(struct device *dev)
 
 	component_del(dev, &max98390_hda_comp_ops);
 
+	if (priv) {
+		cancel_work_sync(&priv->resume_work);
+		max98390_gate_detach(priv);
+		debugfs_remove_recursive(priv->debugfs);
+	}
+
 	if (priv && priv->regmap) {
 		/* Disable amp on removal */
 		regmap_write(priv->regmap, MAX98390_R203A_AMP_EN, 0x80);
@@ -201,11 +332,56 @@ static int max98390_hda_runtime_resume(struct device *dev)
 	return 0;
 }
 
+static int max98390_hda_system_suspend(struct device *dev)
+{
+	struct max98390_hda_priv *priv = dev_get_drvdata(dev);
+
+	/* No I2C traffic from the gate or a restore once the bus suspends */
+	flush_work(&priv->resume_work);
+	max98390_gate_stop(priv);
+
+	return 0;
+}
+
+/*
+ * The amp's reset, msleeps and 913-byte DSM upload would hold up the
+ * system resume, four times over. Instead the restore runs in a work item
+ * and the first PCM waits for it only if it is still running; the
+ * device's async suspend flag lets the amps resume in parallel with the
+ * rest of the system.
+ */
+static int max98390_hda_system_resume(struct device *dev)
+{
+	struct max98390_hda_priv *priv = dev_get_drvdata(dev);
+
+	priv->resume_start = ktime_get();
+	priv->resume_audio_pending = true;
+	priv->system_resumes++;
+	reinit_completion(&priv->resume_done);
+	queue_work(system_unbound_wq, &priv->resume_work);
+
+	return 0;
+}
+
 const struct dev_pm_ops max98390_hda_pm_ops = {
+	SYSTEM_SLEEP_PM_OPS(max98390_hda_system_suspend, max98390_hda_system_resume)
 	RUNTIME_PM_OPS(max98390_hda_runtime_suspend, max98390_hda_runtime_resume, NULL)
 };
 EXPORT_SYMBOL_NS_GPL(max98390_hda_pm_ops, "SND_HDA_SCODEC_MAX98390");
 
+static int __init max98390_hda_module_init(void)
+{
+	max98390_debugfs_root = debugfs_create_dir("max98390-hda", NULL);
+	return 0;
+}
+module_init(max98390_hda_module_init);
+
+static void __exit max98390_hda_module_exit(void)
+{
+	debugfs_remove_recursive(max98390_debugfs_root);
+}
+module_exit(max98390_hda_module_exit);
+
 MODULE_DESCRIPTION("HDA MAX98390 side codec library");
 MODULE_AUTHOR("Kevin Cuperus <cuperus.kevin@hotmail.com>");
 MODULE_LICENSE("GPL");
@@ -6,7 +6,12 @@
 #ifndef __MAX98390_HDA_H__
 #define __MAX98390_HDA_H__
 
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/regmap.h>
+#include <linux/workqueue.h>
 #include <sound/hda_codec.h>
 
 enum max98390_hda_bus_type {
@@ -21,6 +26,26 @@ struct max98390_hda_priv {
 	int index;
 	const char *acpi_subsystem_id;
 	int i2c_addr;  /* I2C address for speaker identification */
+	struct hda_codec *codec;  /* set while bound to the HDA codec */
+	struct dentry *debugfs;
+
+	/* Silence gate, see max98390_hda_gate.c */
+	struct list_head gate_node;
+	bool gate_active;  /* the amp is meant to be on */
+	bool gated;
+	ktime_t gated_since;
+	u64 gated_ns;
+	unsigned int gates, resumes, late_resumes;
+
+	/* System resume, see max98390_hda_system_resume() */
+	bool pcm_open;
+	struct work_struct resume_work;
+	struct completion resume_done;
+	ktime_t resume_start;
+	bool resume_audio_pending;  /* no PCM since the last resume */
+	bool resume_reinit;  /* the amp had lost its state */
+	unsigned int system_resumes;
+	u64 restore_ns, wait_ns, audio_ns;
 };
 
 int max98390_hda_probe(struct device *dev, const char *device_name,
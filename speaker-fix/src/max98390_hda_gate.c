@@ -0,0 +1,412 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// Silence gate for the MAX98390 HDA driver
+//
+// Without the alc269 quirk there is no component master, the playback
+// hooks never run and the amps stay on from probe. Sound servers also keep
+// the speaker PCM open and play zeros while nothing makes a sound, so even
+// with the hooks the amps stay on from OPEN to CLOSE. The gate looks at
+// the speaker PCM itself: the samples queued in its buffer that the
+// controller hasn't played yet. After gate_delay_ms of silence, or with no
+// stream set up at all, it clears SPK_EN, which stops the output stage and
+// its boost while the rest of the amp stays configured.
+//
+// The speaker PCM is found through the ALSA minors, not the codec: the
+// first playback PCM named "... Analog" on device gate_device, on card
+// gate_card if that is set. All amps play the same buffer, so one check
+// gates every amp that is supposed to be on. It runs once a period of the
+// stream, or every gate_poll_ms if that is shorter, and every
+// gate_idle_poll_ms while no stream is set up. Sound queued again sets
+// SPK_EN before the controller reaches it only if the sound server writes
+// further ahead than that; otherwise the start of it plays with the amps
+// off and counts as a late resume. A new stream turns the amps on at once.
+//
+// Only the S16_LE and S32_LE formats HDA uses are checked; with any other
+// format the amps stay on.
+//
+
+#include <linux/debugfs.h>
+#include <linux/jiffies.h>
+#include <linux/module.h>
+#include <linux/regmap.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <sound/core.h>
+#include <sound/minors.h>
+#include <sound/pcm.h>
+#include "max98390_hda.h"
+#include "max98390_hda_gate.h"
+#include "max98390_regs.h"
+
+static bool idle_gate = true;
+module_param(idle_gate, bool, 0644);
+MODULE_PARM_DESC(idle_gate, "Turn the speaker amps off while the speaker PCM plays silence or is idle");
+
+static unsigned int gate_delay_ms = 2000;
+module_param(gate_delay_ms, uint, 0644);
+MODULE_PARM_DESC(gate_delay_ms, "Silence before the amps are turned off (ms)");
+
+static unsigned int gate_threshold;
+module_param(gate_threshold, uint, 0644);
+MODULE_PARM_DESC(gate_threshold, "Largest sample that counts as silence, in 16-bit steps (0: digital silence)");
+
+static unsigned int gate_poll_ms = 20;
+module_param(gate_poll_ms, uint, 0644);
+MODULE_PARM_DESC(gate_poll_ms, "Longest interval between checks of the queued samples; a period if that is shorter (ms)");
+
+static unsigned int gate_idle_poll_ms = 100;
+module_param(gate_idle_poll_ms, uint, 0644);
+MODULE_PARM_DESC(gate_idle_poll_ms, "Interval between checks while the speaker PCM has no stream (ms)");
+
+static int gate_card = -1;
+module_param(gate_card, int, 0644);
+MODULE_PARM_DESC(gate_card, "Card of the speaker PCM (-1: the first with an Analog PCM)");
+
+static int gate_device;
+module_param(gate_device, int, 0644);
+MODULE_PARM_DESC(gate_device, "PCM device of the speakers on that card");
+
+enum max98390_gate_check {
+	MAX98390_GATE_BUSY,	/* the PCM was being set up, check again */
+	MAX98390_GATE_SILENT,	/* no stream, or only silence queued */
+	MAX98390_GATE_SOUND,
+	MAX98390_GATE_LATE,	/* sound, some of it already played */
+};
+
+static void max98390_gate_work_fn(struct work_struct *work);
+
+/* Guards the amps list, last_sound and the gate state of every amp */
+static DEFINE_MUTEX(max98390_gate_lock);
+static LIST_HEAD(max98390_gate_amps);  /* max98390_hda_priv.gate_node */
+static DECLARE_DELAYED_WORK(max98390_gate_work, max98390_gate_work_fn);
+static unsigned long max98390_gate_last_sound;  /* jiffies */
+
+/* Only used by the work */
+static int max98390_gate_minor = -1;  /* where the speaker PCM was last found */
+static struct snd_pcm_runtime *max98390_gate_runtime;  /* stream being checked */
+static snd_pcm_uframes_t max98390_gate_pos;  /* appl_ptr checked up to */
+
+static bool max98390_gate_match(struct snd_pcm *pcm)
+{
+	if (gate_card >= 0 && pcm->card->number != gate_card)
+		return false;
+
+	return pcm->device == gate_device && strstr(pcm->id, "Analog");
+}
+
+/*
+ * The speaker PCM, holding a reference to its card, or NULL. The minor it
+ * was found at is tried first; the rest are only looked at when it goes
+ * away or hasn't shown up yet.
+ */
+static struct snd_pcm *max98390_gate_find_pcm(void)
+{
+	struct snd_pcm *pcm;
+	int minor;
+
+	if (max98390_gate_minor >= 0) {
+		pcm = snd_lookup_minor_data(max98390_gate_minor,
+					    SNDRV_DEVICE_TYPE_PCM_PLAYBACK);
+		if (pcm && max98390_gate_match(pcm))
+			return pcm;
+		if (pcm)
+			snd_card_unref(pcm->card);
+	}
+
+	for (minor = 0; minor < SNDRV_OS_MINORS; minor++) {
+		pcm = snd_lookup_minor_data(minor, SNDRV_DEVICE_TYPE_PCM_PLAYBACK);
+		if (!pcm)
+			continue;
+		if (max98390_gate_match(pcm)) {
+			max98390_gate_minor = minor;
+			return pcm;
+		}
+		snd_card_unref(pcm->card);
+	}
+
+	max98390_gate_minor = -1;
+	return NULL;
+}
+
+/* Whether frames [pos, pos + frames) of the buffer are silent */
+static bool max98390_gate_silent(struct snd_pcm_runtime *runtime,
+				 snd_pcm_uframes_t pos, snd_pcm_uframes_t frames)
+{
+	const void *area = runtime->dma_area + frames_to_bytes(runtime, pos);
+	unsigned int samples = frames * runtime->channels;
+	unsigned int i;
+
+	switch (runtime->format) {
+	case SNDRV_PCM_FORMAT_S16_LE: {
+		const __le16 *s = area;
+		int limit = gate_threshold;
+
+		for (i = 0; i < samples; i++)
+			if (abs((s16)le16_to_cpu(s[i])) > limit)
+				return false;
+		return true;
+	}
+	case SNDRV_PCM_FORMAT_S32_LE: {
+		const __le32 *s = area;
+		s64 limit = (s64)gate_threshold << 16;
+
+		for (i = 0; i < samples; i++)
+			if (abs((s64)(s32)le32_to_cpu(s[i])) > limit)
+				return false;
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+static void max98390_gate_close_amp(struct max98390_hda_priv *priv)
+{
+	regmap_write(priv->regmap, MAX98390_R203A_AMP_EN, 0x80);
+	priv->gated = true;
+	priv->gated_since = ktime_get();
+	priv->gates++;
+}
+
+static void max98390_gate_open_amp(struct max98390_hda_priv *priv, bool late)
+{
+	regmap_write(priv->regmap, MAX98390_R203A_AMP_EN, 0x81);
+	priv->gated = false;
+	priv->gated_ns += ktime_to_ns(ktime_sub(ktime_get(), priv->gated_since));
+	priv->resumes++;
+	if (late)
+		priv->late_resumes++;
+}
+
+/* One period of the stream, capped at gate_poll_ms */
+static unsigned long max98390_gate_interval(struct snd_pcm_runtime *runtime)
+{
+	unsigned int ms = max(gate_poll_ms, 1U);
+
+	if (runtime->rate)
+		ms = clamp_t(u64, div_u64((u64)runtime->period_size * MSEC_PER_SEC,
+					  runtime->rate), 1, ms);
+
+	return msecs_to_jiffies(ms);
+}
+
+/* Check what the stream queued since the last time */
+static enum max98390_gate_check max98390_gate_scan(struct snd_pcm_runtime *runtime)
+{
+	snd_pcm_uframes_t appl, hw, queued, pos, chunk;
+	bool sound = false, late = false;
+
+	appl = READ_ONCE(runtime->control->appl_ptr);
+	hw = READ_ONCE(runtime->status->hw_ptr);
+
+	/*
+	 * Sound servers open the PCM when something starts playing, so a new
+	 * stream counts as sound; late if the controller already started.
+	 */
+	if (runtime != max98390_gate_runtime) {
+		max98390_gate_runtime = runtime;
+		max98390_gate_pos = appl;
+		return hw ? MAX98390_GATE_LATE : MAX98390_GATE_SOUND;
+	}
+
+	/*
+	 * If the controller got past the last check, some of what was queued
+	 * since already played: a resume is late. After an xrun or a rewind,
+	 * start again from the controller.
+	 */
+	queued = (appl + runtime->boundary - max98390_gate_pos) % runtime->boundary;
+	pos = (hw + runtime->boundary - max98390_gate_pos) % runtime->boundary;
+	if (queued > runtime->buffer_size) {
+		max98390_gate_pos = hw;
+		queued = (appl + runtime->boundary - hw) % runtime->boundary;
+		if (queued > runtime->buffer_size)
+			queued = 0;
+	} else if (pos && pos <= queued) {
+		late = true;
+	}
+
+	pos = max98390_gate_pos % runtime->buffer_size;
+	while (queued && !sound) {
+		chunk = min(queued, runtime->buffer_size - pos);
+		sound = !max98390_gate_silent(runtime, pos, chunk);
+		queued -= chunk;
+		pos = 0;
+	}
+	max98390_gate_pos = appl;
+
+	if (!sound)
+		return MAX98390_GATE_SILENT;
+	return late ? MAX98390_GATE_LATE : MAX98390_GATE_SOUND;
+}
+
+/*
+ * Check the first playback substream with a buffer set up. The open mutex
+ * keeps its runtime and the buffer mutex keeps hw_params and hw_free away
+ * from the buffer. Both are only tried: the hooks take the gate lock with
+ * them held, and a busy PCM is simply checked again next time.
+ */
+static enum max98390_gate_check max98390_gate_check(struct snd_pcm *pcm,
+						    unsigned long *interval)
+{
+	enum max98390_gate_check ret = MAX98390_GATE_SILENT;
+	struct snd_pcm_substream *substream;
+	struct snd_pcm_runtime *runtime = NULL;
+
+	if (!mutex_trylock(&pcm->open_mutex))
+		return MAX98390_GATE_BUSY;
+
+	substream = pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream;
+	for (; substream; substream = substream->next) {
+		runtime = substream->runtime;
+		if (!runtime)
+			continue;
+		if (!mutex_trylock(&runtime->buffer_mutex)) {
+			ret = MAX98390_GATE_BUSY;
+			break;
+		}
+		if (runtime->dma_area && runtime->buffer_size && runtime->boundary) {
+			ret = max98390_gate_scan(runtime);
+			*interval = max98390_gate_interval(runtime);
+			mutex_unlock(&runtime->buffer_mutex);
+			break;
+		}
+		mutex_unlock(&runtime->buffer_mutex);
+		runtime = NULL;
+	}
+	if (ret == MAX98390_GATE_SILENT && !runtime)
+		max98390_gate_runtime = NULL;
+
+	mutex_unlock(&pcm->open_mutex);
+	return ret;
+}
+
+static void max98390_gate_work_fn(struct work_struct *work)
+{
+	enum max98390_gate_check check = MAX98390_GATE_SILENT;
+	unsigned long interval = msecs_to_jiffies(max(gate_idle_poll_ms, 1U));
+	struct max98390_hda_priv *priv;
+	struct snd_pcm *pcm;
+	bool active = false;
+
+	pcm = max98390_gate_find_pcm();
+	if (pcm) {
+		check = max98390_gate_check(pcm, &interval);
+		snd_card_unref(pcm->card);
+	} else {
+		max98390_gate_runtime = NULL;
+	}
+
+	mutex_lock(&max98390_gate_lock);
+	if (check == MAX98390_GATE_SOUND || check == MAX98390_GATE_LATE)
+		max98390_gate_last_sound = jiffies;
+
+	if (check != MAX98390_GATE_BUSY && (check != MAX98390_GATE_SILENT || !idle_gate)) {
+		list_for_each_entry(priv, &max98390_gate_amps, gate_node)
+			if (priv->gated)
+				max98390_gate_open_amp(priv, check == MAX98390_GATE_LATE);
+	} else if (check == MAX98390_GATE_SILENT &&
+		   time_after(jiffies, max98390_gate_last_sound +
+					msecs_to_jiffies(gate_delay_ms))) {
+		list_for_each_entry(priv, &max98390_gate_amps, gate_node)
+			if (priv->gate_active && !priv->gated)
+				max98390_gate_close_amp(priv);
+	}
+
+	/* Nothing to gate once every amp is off for good */
+	list_for_each_entry(priv, &max98390_gate_amps, gate_node)
+		active |= priv->gate_active;
+	if (active)
+		queue_delayed_work(system_highpri_wq, &max98390_gate_work, interval);
+	mutex_unlock(&max98390_gate_lock);
+}
+
+/* The caller set SPK_EN or is about to lose it; stop counting the amp as gated */
+static void max98390_gate_ungate(struct max98390_hda_priv *priv)
+{
+	if (priv->gated) {
+		priv->gated = false;
+		priv->gated_ns += ktime_to_ns(ktime_sub(ktime_get(), priv->gated_since));
+	}
+}
+
+/*
+ * Called after the amp was turned on: at probe, on OPEN when the hooks
+ * are bound, and after a system resume. The gate counts silence from here.
+ */
+void max98390_gate_start(struct max98390_hda_priv *priv)
+{
+	mutex_lock(&max98390_gate_lock);
+	max98390_gate_ungate(priv);
+	if (!priv->gate_active) {
+		priv->gate_active = true;
+		max98390_gate_last_sound = jiffies;
+	}
+	mod_delayed_work(system_highpri_wq, &max98390_gate_work, 0);
+	mutex_unlock(&max98390_gate_lock);
+}
+
+/*
+ * Called before the amp is turned off, or its registers may go away: on
+ * CLOSE and system suspend. The gate leaves it alone from here; the
+ * caller decides what SPK_EN is left at.
+ */
+void max98390_gate_stop(struct max98390_hda_priv *priv)
+{
+	mutex_lock(&max98390_gate_lock);
+	priv->gate_active = false;
+	max98390_gate_ungate(priv);
+	mutex_unlock(&max98390_gate_lock);
+}
+
+/* Called on probe, once the amp is set up */
+void max98390_gate_attach(struct max98390_hda_priv *priv)
+{
+	mutex_lock(&max98390_gate_lock);
+	list_add_tail(&priv->gate_node, &max98390_gate_amps);
+	mutex_unlock(&max98390_gate_lock);
+}
+
+/* Called on remove; the last amp to leave stops the work */
+void max98390_gate_detach(struct max98390_hda_priv *priv)
+{
+	bool last;
+
+	max98390_gate_stop(priv);
+
+	mutex_lock(&max98390_gate_lock);
+	list_del_init(&priv->gate_node);
+	last = list_empty(&max98390_gate_amps);
+	mutex_unlock(&max98390_gate_lock);
+
+	if (last)
+		cancel_delayed_work_sync(&max98390_gate_work);
+}
+
+static int max98390_gate_show(struct seq_file *s, void *data)
+{
+	struct max98390_hda_priv *priv = s->private;
+	u64 gated_ns;
+
+	mutex_lock(&max98390_gate_lock);
+	gated_ns = priv->gated_ns;
+	if (priv->gated)
+		gated_ns += ktime_to_ns(ktime_sub(ktime_get(), priv->gated_since));
+
+	seq_printf(s, "state:        %s\n", priv->gated ? "gated" :
+		   priv->gate_active ? "on" : "off");
+	seq_printf(s, "gated_ms:     %llu\n", div_u64(gated_ns, NSEC_PER_MSEC));
+	seq_printf(s, "gates:        %u\n", priv->gates);
+	seq_printf(s, "resumes:      %u\n", priv->resumes);
+	seq_printf(s, "late_resumes: %u\n", priv->late_resumes);
+	mutex_unlock(&max98390_gate_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(max98390_gate);
+
+void max98390_gate_init(struct max98390_hda_priv *priv)
+{
+	INIT_LIST_HEAD(&priv->gate_node);
+	debugfs_create_file("silence_gate", 0444, priv->debugfs, priv,
+			    &max98390_gate_fops);
+}
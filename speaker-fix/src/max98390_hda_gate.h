@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+//
+// MAX98390 HDA silence gate header
+//
+
+#ifndef __MAX98390_HDA_GATE_H
+#define __MAX98390_HDA_GATE_H
+
+struct max98390_hda_priv;
+
+void max98390_gate_init(struct max98390_hda_priv *priv);
+void max98390_gate_attach(struct max98390_hda_priv *priv);
+void max98390_gate_detach(struct max98390_hda_priv *priv);
+void max98390_gate_start(struct max98390_hda_priv *priv);
+void max98390_gate_stop(struct max98390_hda_priv *priv);
+
+#endif /* __MAX98390_HDA_GATE_H */
@@ -38,6 +38,9 @@ rm -f /etc/systemd/system/max98390-hda-check-upstream.service
 rm -f /etc/modules-load.d/max98390-hda.conf
 rm -f /usr/local/sbin/max98390-hda-i2c-setup.sh
 rm -f /usr/local/sbin/max98390-hda-check-upstream.sh
+# The shared helpers go once no check script is left
+rm -f /var/cache/check-upstream/max98390-hda
+compgen -G "/usr/local/sbin/*-check-upstream.sh" > /dev/null || rm -rf /usr/local/share/check-upstream /var/cache/check-upstream
 rm -rf "${SRC_DIR}"
 
 systemctl daemon-reload
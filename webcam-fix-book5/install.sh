@@ -457,6 +457,7 @@ SIGNEOF
     # Install upstream check script and service
     sudo cp "$SCRIPT_DIR/ipu-bridge-check-upstream.sh" /usr/local/sbin/ipu-bridge-check-upstream.sh
     sudo chmod 755 /usr/local/sbin/ipu-bridge-check-upstream.sh
+    sudo install -D -m 644 "$SCRIPT_DIR/../check-upstream/check-upstream-lib.sh" /usr/local/share/check-upstream/check-upstream-lib.sh
     sudo cp "$SCRIPT_DIR/ipu-bridge-check-upstream.service" /etc/systemd/system/ipu-bridge-check-upstream.service
     sudo systemctl daemon-reload
     sudo systemctl enable ipu-bridge-check-upstream.service
@@ -778,7 +779,7 @@ if [[ -d "$RELAY_DIR" ]]; then
     # Build and install on-demand monitor (C binary)
     if [[ -f "$RELAY_DIR/camera-relay-monitor.c" ]]; then
         echo "  Building on-demand monitor..."
-        if gcc -O2 -Wall -o /tmp/camera-relay-monitor "$RELAY_DIR/camera-relay-monitor.c"; then
+        if gcc -O2 -Wall -pthread -o /tmp/camera-relay-monitor "$RELAY_DIR/camera-relay-monitor.c"; then
             sudo cp /tmp/camera-relay-monitor /usr/local/bin/camera-relay-monitor
             sudo chmod 755 /usr/local/bin/camera-relay-monitor
             rm -f /tmp/camera-relay-monitor
@@ -797,6 +798,8 @@ if [[ -d "$RELAY_DIR" ]]; then
     sudo mkdir -p /usr/local/share/camera-relay
     sudo cp "$RELAY_DIR/camera-relay-systray.py" /usr/local/share/camera-relay/
     sudo chmod 755 /usr/local/share/camera-relay/camera-relay-systray.py
+    sudo cp "$RELAY_DIR/camera-relay-flight.py" /usr/local/share/camera-relay/
+    sudo chmod 755 /usr/local/share/camera-relay/camera-relay-flight.py
     echo "  ✓ Installed systray GUI (/usr/local/share/camera-relay/)"
 
     # Install desktop file
@@ -972,6 +975,7 @@ echo "    ${SRC_DIR}/ (DKMS source)"
 if [[ -d "$IPU_BRIDGE_FIX_SRC" ]]; then
 echo "    ${IPU_BRIDGE_FIX_SRC}/ (ipu-bridge rotation fix DKMS source)"
 echo "    /usr/local/sbin/ipu-bridge-check-upstream.sh"
+echo "    /usr/local/share/check-upstream/check-upstream-lib.sh"
 echo "    /etc/systemd/system/ipu-bridge-check-upstream.service"
 fi
 if [[ -d "/var/lib/libcamera-bayer-fix-backup" ]]; then
@@ -7,36 +7,35 @@
 #   - Camera already works (our DKMS module loaded earlier in boot)
 #   - This script removes DKMS package, services, check script
 #   - Next reboot uses the native kernel module instead
+#
+# The verdict is cached per kernel and module file (check-upstream-lib.sh),
+# so later boots of the same kernel don't decompress the module again.
 
 DKMS_NAME="ipu-bridge-fix"
 DKMS_VER="1.0"
 
-log() { echo "ipu-bridge-check: $*"; }
-
-# Find the kernel's own ipu-bridge module (in kernel/ tree, NOT updates/)
-NATIVE_MODULE=$(find "/lib/modules/$(uname -r)/kernel" -name "ipu-bridge*" 2>/dev/null | head -1)
+# Shared helpers: module lookup and the per-kernel verdict cache
+CHECK_LIB=/usr/local/share/check-upstream/check-upstream-lib.sh
+[ -r "$CHECK_LIB" ] || CHECK_LIB="$(dirname "$0")/../check-upstream/check-upstream-lib.sh"
+. "$CHECK_LIB" || exit 0
 
-if [ -z "$NATIVE_MODULE" ]; then
-    log "No in-tree ipu-bridge module found in $(uname -r) — DKMS still needed"
-    exit 0
-fi
+check_begin ipu-bridge
 
-# Decompress and check for Samsung DMI string
-decompress_module() {
-    local mod="$1"
-    case "$mod" in
-        *.zst)  zstdcat "$mod" 2>/dev/null ;;
-        *.xz)   xzcat "$mod" 2>/dev/null ;;
-        *.gz)   zcat "$mod" 2>/dev/null ;;
-        *)      cat "$mod" 2>/dev/null ;;
-    esac
-}
+# The kernel's own ipu-bridge module (in kernel/ tree, NOT updates/)
+NATIVE_MODULE=$(kmod_intree ipu-bridge)
+check_key "$NATIVE_MODULE"
 
-if ! decompress_module "$NATIVE_MODULE" | strings | grep -q "940XHA"; then
-    log "In-tree ipu-bridge in $(uname -r) does not have Samsung rotation fix — DKMS still needed"
-    exit 0
+if ! check_cached; then
+    if [ -z "$NATIVE_MODULE" ]; then
+        not_ready "No in-tree ipu-bridge module found in $(uname -r) — DKMS still needed"
+    elif ! kmod_has_string "$NATIVE_MODULE" "940XHA"; then
+        not_ready "In-tree ipu-bridge in $(uname -r) does not have Samsung rotation fix — DKMS still needed"
+    fi
+    check_store
 fi
 
+$UPSTREAM_READY || exit 0
+
 # --- Upstream has the fix: auto-remove DKMS workaround ---
 log "=== SAMSUNG ROTATION FIX DETECTED in native ipu-bridge ($(uname -r)) ==="
 log "Auto-removing DKMS workaround..."
@@ -61,6 +60,8 @@ rm -rf "/usr/src/ov02e10-fix-1.0"
 rm -f /etc/systemd/system/ipu-bridge-check-upstream.service
 rm -f /usr/local/sbin/ipu-bridge-check-upstream.sh
 rm -rf "/usr/src/${DKMS_NAME}-${DKMS_VER}"
+check_forget
+check_cleanup_lib
 
 # Rebuild module dependency map so kernel's original modules are used
 depmod -a
@@ -694,6 +694,34 @@ static int ipu_bridge_instantiate_ivsc(struct ipu_sensor *sensor)
 	return 0;
 }
 
+/*
+ * Make the sensor a consumer of the IPU. The sensor can't probe before the
+ * bridge has built its fwnode graph, which happens while the IPU probes, so
+ * without a link it probes, defers on the missing endpoint and waits for the
+ * next deferred probe pass. With the link the driver core holds the sensor
+ * back until the IPU has bound and then queues its probe right away; sensor
+ * drivers that prefer asynchronous probing bring the sensor up off the boot
+ * path. The IPU is not a runtime PM supplier, so no DL_FLAG_PM_RUNTIME.
+ */
+static void ipu_bridge_link_sensor(struct ipu_bridge *bridge,
+				   struct acpi_device *adev)
+{
+	struct i2c_client *client;
+
+	client = i2c_find_device_by_fwnode(acpi_fwnode_handle(adev));
+	if (!client)
+		return;
+
+	/* Already bound, e.g. when the IPU driver is reloaded */
+	if (!client->dev.driver &&
+	    !device_link_add(&client->dev, bridge->dev,
+			     DL_FLAG_AUTOPROBE_CONSUMER))
+		dev_warn(bridge->dev, "Failed to link sensor %s\n",
+			 acpi_dev_name(adev));
+
+	put_device(&client->dev);
+}
+
 static void ipu_bridge_unregister_sensors(struct ipu_bridge *bridge)
 {
 	struct ipu_sensor *sensor;
@@ -765,6 +793,8 @@ static int ipu_bridge_connect_sensor(const struct ipu_sensor_config *cfg,
 		dev_info(bridge->dev, "Found supported sensor %s\n",
 			 acpi_dev_name(adev));
 
+		ipu_bridge_link_sensor(bridge, adev);
+
 		bridge->n_sensors++;
 	}
 
@@ -7,15 +7,23 @@
 #   2. Installs build dependencies for your distro
 #   3. Clones matching libcamera source from git
 #   4. Applies the bayer order fix patch
-#   5. Builds libcamera
-#   6. Installs the patched library (with backup of originals)
+#   5. Applies the SoftISP performance patches from softisp/
+#   6. Builds libcamera (and the softisp-bench tool, if patched in)
+#   7. Installs the patched library (with backup of originals)
 #
 # The fix makes the Simple pipeline handler ALWAYS recalculate the bayer
 # pattern order when sensor transforms (hflip/vflip) are applied, instead
 # of only doing so when the sensor reports a changed media bus format code.
 # This fixes OV02E10 (and any sensor with the same MODIFY_LAYOUT bug).
 #
-# Usage: sudo ./build-patched-libcamera.sh
+# The SoftISP patches make the CPU debayer multi-threaded. Each patch checks
+# that the libcamera source looks as expected and skips itself otherwise;
+# if the patched tree fails to build, they are reverted and the build is
+# retried with only the bayer fix.
+#
+# Usage: sudo ./build-patched-libcamera.sh [--bayer-only]
+#
+#   --bayer-only   Only apply the bayer order fix, no SoftISP patches
 #
 # To uninstall: sudo ./build-patched-libcamera.sh --uninstall
 
@@ -24,6 +32,8 @@ set -euo pipefail
 SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
 BUILD_DIR="/tmp/libcamera-bayer-fix-build"
 BACKUP_DIR="/var/lib/libcamera-bayer-fix-backup"
+SOFTISP_FEATURES_DIR="/usr/local/share/libcamera-softisp"
+SOFTISP_BENCH_BIN="/usr/local/bin/softisp-bench"
 
 # Colors
 RED='\033[0;31m'
@@ -45,6 +55,13 @@ fi
 
 REAL_USER="${SUDO_USER:-$USER}"
 
+BAYER_ONLY=false
+for arg in "$@"; do
+    case "$arg" in
+        --bayer-only) BAYER_ONLY=true ;;
+    esac
+done
+
 # ─── Uninstall mode ──────────────────────────────────────────────────
 if [[ "${1:-}" == "--uninstall" ]]; then
     echo ""
@@ -69,6 +86,8 @@ if [[ "${1:-}" == "--uninstall" ]]; then
     rm -rf "$BACKUP_DIR"
     # Clean up IPA path env file
     rm -f /etc/profile.d/libcamera-ipa-path.sh
+    rm -rf "$SOFTISP_FEATURES_DIR"
+    rm -f "$SOFTISP_BENCH_BIN"
     ok "Original libcamera restored."
     echo ""
     exit 0
@@ -523,6 +542,85 @@ PYEOF
     ok "Patch applied successfully."
 }
 
+# ─── Apply SoftISP performance patches ───────────────────────────────
+# Optional patches that speed up the CPU debayer. A patch that does not
+# fit this libcamera version skips itself without touching the tree.
+apply_softisp_patches() {
+    SOFTISP_APPLIED=false
+
+    if [[ "$BAYER_ONLY" == "true" ]]; then
+        info "Skipping SoftISP performance patches (--bayer-only)."
+        return
+    fi
+
+    info "Applying SoftISP performance patches..."
+
+    local patch rc
+    for patch in "$SCRIPT_DIR"/softisp/[0-9][0-9]-*.py; do
+        [[ -f "$patch" ]] || continue
+        rc=0
+        python3 "$patch" "$BUILD_DIR/libcamera" || rc=$?
+        case $rc in
+            0) SOFTISP_APPLIED=true ;;
+            3) warn "  $(basename "$patch"): not applicable to libcamera $LIBCAMERA_VERSION" ;;
+            *) warn "  $(basename "$patch") failed — continuing without it" ;;
+        esac
+    done
+
+    if [[ "$SOFTISP_APPLIED" == "true" ]]; then
+        ok "SoftISP patches applied."
+    else
+        warn "No SoftISP patches applied — building with the bayer fix only."
+    fi
+}
+
+# ─── Record installed SoftISP features ───────────────────────────────
+# camera-relay reads this to know e.g. that libcamera can output YUY2
+# directly. The library mtime is recorded too, so a distro update that
+# replaces libcamera invalidates the file.
+write_softisp_features() {
+    rm -rf "$SOFTISP_FEATURES_DIR"
+    [[ "$SOFTISP_APPLIED" == "true" ]] || return 0
+
+    local applied="$BUILD_DIR/libcamera/.softisp-orig/APPLIED"
+    local library
+    library=$(find "$LIBCAMERA_LIB_DIR" -maxdepth 1 -name 'libcamera.so.*' -type f -print -quit 2>/dev/null || true)
+    [[ -f "$applied" && -n "$library" ]] || return 0
+
+    mkdir -p "$SOFTISP_FEATURES_DIR"
+    {
+        echo "# Written by build-patched-libcamera.sh"
+        echo "LIBRARY=$library"
+        echo "LIBRARY_MTIME=$(stat -c %Y "$library")"
+        echo "FEATURES=\"$(sed 's/^SOFTISP-//' "$applied" | tr 'A-Z\n' 'a-z ' | sed 's/ $//')\""
+    } > "$SOFTISP_FEATURES_DIR/features"
+    chmod 644 "$SOFTISP_FEATURES_DIR/features"
+}
+
+# ─── Build the SoftISP benchmark ─────────────────────────────────────
+# softisp-bench links against libcamera internals, so it is not part of
+# the default build and only installed together with the library it was
+# built with. A failure here never affects the libcamera install.
+build_softisp_bench() {
+    SOFTISP_BENCH=""
+    [[ "$SOFTISP_APPLIED" == "true" && -d src/apps/softisp-bench ]] || return 0
+
+    info "Building softisp-bench..."
+    if ninja -C builddir src/apps/softisp-bench/softisp-bench 2>&1 | tail -3; then
+        SOFTISP_BENCH="builddir/src/apps/softisp-bench/softisp-bench"
+    else
+        warn "softisp-bench failed to build — skipping it."
+    fi
+}
+
+install_softisp_bench() {
+    rm -f "$SOFTISP_BENCH_BIN"
+    [[ -n "$SOFTISP_BENCH" ]] || return 0
+
+    install -m 755 "$SOFTISP_BENCH" "$SOFTISP_BENCH_BIN"
+    ok "Installed $SOFTISP_BENCH_BIN"
+}
+
 # ─── Detect meson build options from installed libcamera ─────────────
 detect_build_options() {
     MESON_OPTIONS=(
@@ -680,6 +778,9 @@ echo ""
 apply_patch_sed
 echo ""
 
+apply_softisp_patches
+echo ""
+
 # Step 5: Verify patch
 info "Verifying patch..."
 if grep -q 'inputBayer.order' "$BUILD_DIR/libcamera/src/libcamera/pipeline/simple/simple.cpp"; then
@@ -697,9 +798,17 @@ cd "$BUILD_DIR/libcamera"
 meson setup builddir "${MESON_OPTIONS[@]}" 2>&1 | tail -20
 
 info "Building (this may take 5-10 minutes)..."
-ninja -C builddir 2>&1 | tail -5
+if ! ninja -C builddir 2>&1 | tail -5; then
+    [[ "$SOFTISP_APPLIED" == "true" ]] || die "Build failed."
+
+    warn "Build failed with the SoftISP patches — retrying with the bayer fix only..."
+    python3 "$SCRIPT_DIR/softisp/patchlib.py" --revert "$BUILD_DIR/libcamera"
+    SOFTISP_APPLIED=false
+    ninja -C builddir 2>&1 | tail -5
+fi
 
 ok "Build completed."
+build_softisp_bench
 echo ""
 
 # Step 7: Backup originals
@@ -830,6 +939,9 @@ else
     warn "Could not verify installation timestamp. Library may need ldconfig."
 fi
 
+write_softisp_features
+install_softisp_bench
+
 # Cleanup build directory
 rm -rf "$BUILD_DIR"
 
@@ -850,6 +962,15 @@ echo ""
 echo "  To test: Open a camera app (Firefox, Chrome, qcam)"
 echo "           Colors should now be correct (no purple tint)."
 echo ""
+if [[ "$SOFTISP_APPLIED" == "true" ]]; then
+    echo "  SoftISP: the debayer runs on up to 4 threads. Override with"
+    echo "           LIBCAMERA_SOFTISP_THREADS=N (1 = original single thread)."
+    echo "           Features: $(sed -n 's/^FEATURES="\(.*\)"/\1/p' "$SOFTISP_FEATURES_DIR/features" 2>/dev/null)"
+    if [[ -x "$SOFTISP_BENCH_BIN" ]]; then
+        echo "           Benchmark: softisp-bench <tuning.yaml> [frames.raw ...]"
+    fi
+    echo ""
+fi
 echo "  To uninstall and restore original:"
 echo "    sudo $0 --uninstall"
 echo ""
@@ -0,0 +1,445 @@
+#!/usr/bin/env python3
+# 10-stripe-threads.py — Stripe-parallel multi-threaded CPU debayer.
+#
+# The stock DebayerCpu processes a frame on one thread, which caps the
+# SoftISP at roughly one core's worth of throughput (~25-30 fps at 1080p on
+# Lunar Lake). This patch splits the output window into horizontal stripes
+# and runs them on a persistent worker pool:
+#
+#   - Each stripe reads one line (two for 4-line patterns) above and below
+#     its own rows, so the interpolation at stripe borders is identical to
+#     the single-threaded result. The frame edges keep the original mirror
+#     and clamp handling.
+#   - Every stripe has its own line buffers for the input memcpy.
+#   - Statistics are accumulated into per-stripe partials and merged after
+#     the frame, so AWB/AGC see exactly the same sums and histogram.
+#
+# Thread count: LIBCAMERA_SOFTISP_THREADS (default: min(4, online CPUs)).
+# LIBCAMERA_SOFTISP_THREADS=1 runs the original single-threaded code.
+
+import re
+import sys
+
+from patchlib import NotApplicable, PatchError, run
+
+MARKER = 'SOFTISP-STRIPES'
+SWISP = 'src/libcamera/software_isp'
+
+DEBAYER_H_TYPES = '''
+	/* Horizontal band of the output window processed by one thread */
+	struct DebayerStripe {
+		unsigned int yStart;
+		unsigned int yEnd;
+		std::vector<uint8_t> lineBuffers[kMaxLineBuffers];
+		unsigned int lineBufferIndex;
+	};
+
+	/* Stripes shorter than this cost more in overlap than they gain */
+	static constexpr unsigned int kMinStripeHeight = 64;
+	static constexpr unsigned int kDefaultMaxThreads = 4;
+
+@METHODS@'''
+
+DEBAYER_H_METHODS = '''	void setupStripes();
+	void processStripes(@FRAME_PARAM@const uint8_t *src, uint8_t *dst);
+	void process2Stripe(DebayerStripe &stripe, @FRAME_PARAM@const uint8_t *src, uint8_t *dst);
+	void process4Stripe(DebayerStripe &stripe, @FRAME_PARAM@const uint8_t *src, uint8_t *dst);
+	void setupInputMemcpy(DebayerStripe &stripe, const uint8_t *linePointers[]);
+	void memcpyNextLine(DebayerStripe &stripe, const uint8_t *linePointers[]);
+'''
+
+DEBAYER_H_MEMBERS = '''	unsigned int threadCount_;
+	std::vector<DebayerStripe> stripes_;
+	std::unique_ptr<DebayerWorkerPool> workers_;
+'''
+
+CTOR_THREADS = '''
+	/*
+	 * Split the debayer work over several threads. The default keeps a
+	 * core free for the rest of the pipeline on 4-8 core laptops.
+	 */
+	threadCount_ = std::min(std::max(std::thread::hardware_concurrency(), 1u),
+				kDefaultMaxThreads);
+	const char *threads = utils::secure_getenv("LIBCAMERA_SOFTISP_THREADS");
+	if (threads) {
+		char *end;
+		unsigned long value = strtoul(threads, &end, 10);
+		if (*end == '\\0' && value >= 1 && value <= 64)
+			threadCount_ = value;
+		else
+			LOG(Debayer, Warning)
+				<< "Ignoring invalid LIBCAMERA_SOFTISP_THREADS=" << threads;
+	}
+'''
+
+CONFIGURE_STRIPES = '''	setupStripes();
+
+'''
+
+DISPATCH = '''	if (!stripes_.empty()) {
+		processStripes(@FRAME_ARG@src, dst);
+		return;
+	}
+
+'''
+
+STRIPE_CODE = '''void DebayerCpu::setupStripes()
+{
+	const unsigned int patternHeight = inputConfig_.patternSize.height;
+	unsigned int count = std::min(threadCount_, window_.height / kMinStripeHeight);
+
+	stripes_.clear();
+	if (count < 2)
+		return;
+
+	/* Stripe borders must not split a bayer pattern */
+	const unsigned int step = (window_.height / count) & ~(patternHeight - 1);
+	unsigned int y = window_.y;
+
+	stripes_.resize(count);
+	for (unsigned int i = 0; i < count; i++) {
+		DebayerStripe &stripe = stripes_[i];
+
+		stripe.yStart = y;
+		y = i == count - 1 ? window_.y + window_.height : y + step;
+		stripe.yEnd = y;
+
+		for (unsigned int j = 0;
+		     j < (patternHeight + 1) && enableInputMemcpy_; j++)
+			stripe.lineBuffers[j].resize(lineBufferLength_);
+	}
+
+	/* The thread calling process() takes a stripe as well */
+	if (!workers_ || workers_->size() != count - 1)
+		workers_ = std::make_unique<DebayerWorkerPool>(count - 1);
+
+	LOG(Debayer, Debug)
+		<< "Debayering in " << count << " stripes of " << step << " lines";
+}
+
+void DebayerCpu::setupInputMemcpy(DebayerStripe &stripe, const uint8_t *linePointers[])
+{
+	const unsigned int patternHeight = inputConfig_.patternSize.height;
+
+	if (!enableInputMemcpy_)
+		return;
+
+	for (unsigned int i = 0; i < patternHeight; i++) {
+		memcpy(stripe.lineBuffers[i].data(),
+		       linePointers[i + 1] - lineBufferPadding_,
+		       lineBufferLength_);
+		linePointers[i + 1] = stripe.lineBuffers[i].data() + lineBufferPadding_;
+	}
+
+	stripe.lineBufferIndex = patternHeight;
+}
+
+void DebayerCpu::memcpyNextLine(DebayerStripe &stripe, const uint8_t *linePointers[])
+{
+	const unsigned int patternHeight = inputConfig_.patternSize.height;
+
+	if (!enableInputMemcpy_)
+		return;
+
+	memcpy(stripe.lineBuffers[stripe.lineBufferIndex].data(),
+	       linePointers[patternHeight] - lineBufferPadding_,
+	       lineBufferLength_);
+	linePointers[patternHeight] = stripe.lineBuffers[stripe.lineBufferIndex].data() + lineBufferPadding_;
+
+	stripe.lineBufferIndex = (stripe.lineBufferIndex + 1) % (patternHeight + 1);
+}
+
+/*
+ * Same as process2() for the rows [stripe.yStart, stripe.yEnd). The line
+ * above the stripe is read from the neighbouring stripe's input rows; only
+ * the first and last stripe of a full-height window need edge handling.
+ */
+void DebayerCpu::process2Stripe(DebayerStripe &stripe, @FRAME_PARAM@const uint8_t *src, uint8_t *dst)
+{
+	const bool clampBottom = window_.y == 0 &&
+				 stripe.yEnd == window_.y + window_.height;
+	unsigned int yEnd = stripe.yEnd;
+	/* Holds [0] previous- [1] current- [2] next-line */
+	const uint8_t *linePointers[3];
+
+	/* Adjust src and dst to the top left corner of the stripe */
+	src += stripe.yStart * inputConfig_.stride + window_.x * inputConfig_.bpp / 8;
+	dst += (stripe.yStart - window_.y) * outputConfig_.stride;
+
+	/* [x] becomes [x - 1] after initial shiftLinePointers() call */
+	if (stripe.yStart) {
+		linePointers[1] = src - inputConfig_.stride; /* previous-line */
+		linePointers[2] = src;
+	} else {
+		/* yStart == 0, use the next line as prev line */
+		linePointers[1] = src + inputConfig_.stride;
+		linePointers[2] = src;
+	}
+
+	/* Last 2 lines of the frame also need special handling */
+	if (clampBottom)
+		yEnd -= 2;
+
+	setupInputMemcpy(stripe, linePointers);
+
+	for (unsigned int y = stripe.yStart; y < yEnd; y += 2) {
+		shiftLinePointers(linePointers, src);
+		memcpyNextLine(stripe, linePointers);
+		stats_->processLine0(@FRAME_ARG@y, linePointers);
+		(this->*debayer0_)(dst, linePointers);
+		src += inputConfig_.stride;
+		dst += outputConfig_.stride;
+
+		shiftLinePointers(linePointers, src);
+		memcpyNextLine(stripe, linePointers);
+		(this->*debayer1_)(dst, linePointers);
+		src += inputConfig_.stride;
+		dst += outputConfig_.stride;
+	}
+
+	if (clampBottom) {
+		shiftLinePointers(linePointers, src);
+		memcpyNextLine(stripe, linePointers);
+		stats_->processLine0(@FRAME_ARG@yEnd, linePointers);
+		(this->*debayer0_)(dst, linePointers);
+		src += inputConfig_.stride;
+		dst += outputConfig_.stride;
+
+		shiftLinePointers(linePointers, src);
+		/* next line may point outside of src, use prev. */
+		linePointers[2] = linePointers[0];
+		(this->*debayer1_)(dst, linePointers);
+	}
+}
+
+void DebayerCpu::process4Stripe(DebayerStripe &stripe, @FRAME_PARAM@const uint8_t *src, uint8_t *dst)
+{
+	/*
+	 * This holds pointers to [0] 2-lines-up [1] 1-line-up [2] current-line
+	 * [3] 1-line-down [4] 2-lines-down.
+	 */
+	const uint8_t *linePointers[5];
+
+	/* Adjust src and dst to the top left corner of the stripe */
+	src += stripe.yStart * inputConfig_.stride + window_.x * inputConfig_.bpp / 8;
+	dst += (stripe.yStart - window_.y) * outputConfig_.stride;
+
+	/* [x] becomes [x - 1] after initial shiftLinePointers() call */
+	linePointers[1] = src - 2 * inputConfig_.stride;
+	linePointers[2] = src - inputConfig_.stride;
+	linePointers[3] = src;
+	linePointers[4] = src + inputConfig_.stride;
+
+	setupInputMemcpy(stripe, linePointers);
+
+	for (unsigned int y = stripe.yStart; y < stripe.yEnd; y += 4) {
+		shiftLinePointers(linePointers, src);
+		memcpyNextLine(stripe, linePointers);
+		stats_->processLine0(@FRAME_ARG@y, linePointers);
+		(this->*debayer0_)(dst, linePointers);
+		src += inputConfig_.stride;
+		dst += outputConfig_.stride;
+
+		shiftLinePointers(linePointers, src);
+		memcpyNextLine(stripe, linePointers);
+		(this->*debayer1_)(dst, linePointers);
+		src += inputConfig_.stride;
+		dst += outputConfig_.stride;
+
+		shiftLinePointers(linePointers, src);
+		memcpyNextLine(stripe, linePointers);
+		stats_->processLine2(@FRAME_ARG@y, linePointers);
+		(this->*debayer2_)(dst, linePointers);
+		src += inputConfig_.stride;
+		dst += outputConfig_.stride;
+
+		shiftLinePointers(linePointers, src);
+		memcpyNextLine(stripe, linePointers);
+		(this->*debayer3_)(dst, linePointers);
+		src += inputConfig_.stride;
+		dst += outputConfig_.stride;
+	}
+}
+
+/*
+ * process2() and process4() get the frame base pointers and adjust them to
+ * the window themselves, so do the stripes.
+ */
+void DebayerCpu::processStripes(@FRAME_PARAM@const uint8_t *src, uint8_t *dst)
+{
+	const bool pattern2 = inputConfig_.patternSize.height == 2;
+
+	stats_->beginStripes(stripes_.size());
+
+	workers_->run(stripes_.size(), [&](unsigned int index) {
+		DebayerStripe &stripe = stripes_[index];
+
+		stats_->bindStripe(index);
+		if (pattern2)
+			process2Stripe(stripe, @FRAME_ARG@src, dst);
+		else
+			process4Stripe(stripe, @FRAME_ARG@src, dst);
+		stats_->unbindStripe();
+	});
+
+	stats_->endStripes();
+}
+'''
+
+SWSTATS_H_METHODS = '''
+	/*
+	 * Stripe-parallel debayering: each stripe thread accumulates into its
+	 * own partial statistics, endStripes() merges them into the frame.
+	 */
+	void beginStripes(unsigned int count);
+	void bindStripe(unsigned int index) { boundStats_ = &stripeStats_[index]; }
+	void unbindStripe() { boundStats_ = nullptr; }
+	void endStripes();
+'''
+
+SWSTATS_H_MEMBERS = '''
+	SwIspStats &activeStats() { return boundStats_ ? *boundStats_ : stats_; }
+
+	std::vector<SwIspStats> stripeStats_;
+	static thread_local SwIspStats *boundStats_;
+'''
+
+SWSTATS_CPP = '''thread_local SwIspStats *SwStatsCpu::boundStats_ = nullptr;
+
+void SwStatsCpu::beginStripes(unsigned int count)
+{
+	stripeStats_.resize(count);
+	for (SwIspStats &partial : stripeStats_)
+		partial = stats_;
+}
+
+void SwStatsCpu::endStripes()
+{
+	for (const SwIspStats &partial : stripeStats_) {
+@MERGE@	}
+}
+'''
+
+
+def stats_merge(swisp_stats):
+    """Generate the partial-merge code from the SwIspStats members."""
+    m = swisp_stats.require(r'^struct SwIspStats \{\n(.*?)^\};', 'struct SwIspStats',
+                            re.MULTILINE | re.DOTALL)
+    lines = []
+    for member in re.finditer(r'^\t([\w:<>, ]+?)\s+(\w+);', m.group(1), re.MULTILINE):
+        type_, name = member.group(1), member.group(2)
+        if type_.startswith('static') or type_.startswith('using'):
+            continue
+        if type_ == 'bool':
+            continue
+        if type_ in ('uint64_t', 'uint32_t', 'unsigned int'):
+            lines.append(f'\t\tstats_.{name} += partial.{name};\n')
+        elif type_ == 'Histogram' or type_.startswith('std::array'):
+            lines.append(f'\t\tfor (unsigned int i = 0; i < stats_.{name}.size(); i++)\n'
+                         f'\t\t\tstats_.{name}[i] += partial.{name}[i];\n')
+        else:
+            raise NotApplicable(f'unknown SwIspStats member type {type_} {name}')
+    if not lines:
+        raise PatchError('no accumulators in SwIspStats')
+    return ''.join(lines)
+
+
+def patch_swstats(tree):
+    header = tree.file(f'{SWISP}/swstats_cpu.h',
+                       'include/libcamera/internal/software_isp/swstats_cpu.h')
+    source = tree.file(f'{SWISP}/swstats_cpu.cpp')
+    swisp_stats = tree.file('include/libcamera/internal/software_isp/swisp_stats.h')
+
+    header.add_include('vector')
+    header.insert_after(r'^\tvoid finishFrame\(', SWSTATS_H_METHODS, 'finishFrame() declaration')
+    header.insert_after(r'^\tSwIspStats stats_;', SWSTATS_H_MEMBERS, 'stats_ member')
+
+    # Partials start as a copy of the cleared frame stats, so they have
+    # to be taken after startFrame(). Swap the accumulator in the line
+    # macros: one thread_local lookup per line, not per pixel.
+    source.sub(r'(#define SWSTATS_START_LINE_STATS\(pixel_t\)\s*\\\n)',
+               r'\1\tSwIspStats &lineStats = activeStats(); \\\n',
+               'SWSTATS_START_LINE_STATS macro')
+    m = source.require(r'^#define SWSTATS_ACCUMULATE_LINE_STATS.*?^#define SWSTATS_FINISH_LINE_STATS.*?[^\\]\n',
+                       'SWSTATS accumulate/finish macros', re.MULTILINE | re.DOTALL)
+    macros = re.sub(r'\bstats_\.', 'lineStats.', m.group(0))
+    source.text = source.text[:m.start()] + macros + source.text[m.end():]
+
+    # Anything else touching stats_ from a line function would race
+    for fn in re.finditer(r'^void SwStatsCpu::stats\w*Line\d\(.*?^\}', source.text,
+                          re.MULTILINE | re.DOTALL):
+        if 'stats_.' in fn.group(0):
+            raise NotApplicable('line statistics functions access stats_ directly')
+
+    merge = stats_merge(swisp_stats)
+    source.insert_before(r'^void SwStatsCpu::finishFrame\(',
+                         SWSTATS_CPP.replace('@MERGE@', merge) + '\n',
+                         'finishFrame() definition')
+
+
+def patch_debayer(tree):
+    header = tree.file(f'{SWISP}/debayer_cpu.h')
+    source = tree.file(f'{SWISP}/debayer_cpu.cpp')
+    meson = tree.file(f'{SWISP}/meson.build')
+
+    sig = source.require(r'^void DebayerCpu::process2\((uint32_t frame, )?const uint8_t \*src, uint8_t \*dst\)',
+                         'process2() definition')
+    frame_param = sig.group(1) or ''
+    frame_arg = 'frame, ' if frame_param else ''
+
+    # The stripe bodies are written against this line processing scheme;
+    # refuse to patch if upstream restructured it.
+    body = source.function_text(r'DebayerCpu::process4\(')
+    for call in ('setupInputMemcpy(linePointers)', 'memcpyNextLine(linePointers)',
+                 'shiftLinePointers(linePointers, src)', '(this->*debayer3_)(dst, linePointers)',
+                 f'stats_->processLine2({frame_arg}y, linePointers)'):
+        if call not in body:
+            raise NotApplicable(f'process4() no longer calls {call}')
+
+    def fill(text):
+        return text.replace('@FRAME_PARAM@', frame_param).replace('@FRAME_ARG@', frame_arg)
+
+    # Header: types, methods and members
+    header.add_include('memory')
+    header.insert_after(r'^#include "debayer\.h"', '#include "debayer_worker_pool.h"\n',
+                        'debayer.h include')
+    header.insert_after(r'^\tstatic constexpr unsigned int kMaxLineBuffers = \d+;',
+                        DEBAYER_H_TYPES.replace('@METHODS@', fill(DEBAYER_H_METHODS)),
+                        'kMaxLineBuffers')
+    header.insert_after(r'^\tstd::unique_ptr<SwStatsCpu> stats_;', DEBAYER_H_MEMBERS,
+                        'stats_ member')
+
+    # Source: thread count, stripe setup, dispatch and the stripe code
+    source.add_include('algorithm')
+    source.add_include('stdlib.h')
+    source.add_include('thread')
+    if 'libcamera/base/utils.h' not in source:
+        source.insert_before(r'^#include <libcamera/formats\.h>',
+                             '#include <libcamera/base/utils.h>\n\n', 'formats.h include')
+    source.insert_after(r'^\tenableInputMemcpy_ = true;', CTOR_THREADS,
+                        'enableInputMemcpy_ initialisation')
+
+    start, _, end = source.function(r'DebayerCpu::configure\(')
+    configure = source.text[start:end]
+    last_return = configure.rfind('\n\treturn 0;\n}')
+    if last_return < 0:
+        raise PatchError('configure() does not end with return 0')
+    pos = start + last_return + 1
+    source.text = source.text[:pos] + CONFIGURE_STRIPES + source.text[pos:]
+
+    source.prepend_to_function(r'DebayerCpu::process2\(', fill(DISPATCH))
+    source.prepend_to_function(r'DebayerCpu::process4\(', fill(DISPATCH))
+    source.insert_after_function(r'DebayerCpu::process4\(', fill(STRIPE_CODE))
+
+    meson.sub(r"^([ \t]*)'debayer_cpu\.cpp',\n", r"\g<0>\1'debayer_worker_pool.cpp',\n",
+              "'debayer_cpu.cpp' in meson.build")
+    tree.add_file('debayer_worker_pool.h', SWISP)
+    tree.add_file('debayer_worker_pool.cpp', SWISP)
+
+
+def apply(tree):
+    patch_debayer(tree)
+    patch_swstats(tree)
+
+
+run(apply, MARKER)
@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+# 20-yuv-output.py — YUYV and NV12 output straight from the CPU debayer.
+#
+# The SoftISP only produces RGB formats, so the camera relay (and every
+# GStreamer app asking for YUV) runs a videoconvert that reads and writes
+# the whole frame a second time. This patch adds YUYV and NV12 to the
+# debayer's output formats. Each line is debayered into a small per-thread
+# BGR line buffer and converted to YUV right away, while it is still in the
+# L1 cache, instead of in a separate full-frame pass.
+#
+# Conversion: BT.601 limited range (what UVC webcams send), 8-bit fixed
+# point. Chroma is averaged over 2x1 pixels for YUYV and 2x2 for NV12.
+#
+# NV12 is laid out as a single plane: Y followed by the interleaved CbCr
+# rows at half height, the same layout as V4L2_PIX_FMT_NV12.
+
+import re
+
+from patchlib import PatchError, run
+
+MARKER = 'SOFTISP-YUV'
+SWISP = 'src/libcamera/software_isp'
+
+H_METHODS = '''	template<unsigned int Line>
+	void debayerYuv(uint8_t *dst, const uint8_t *src[]);
+	void yuyvLine(const uint8_t *bgr, uint8_t *dst);
+	void nv12Line(const uint8_t *bgr, uint8_t *dst);
+'''
+
+H_MEMBERS = '''	/* YUV output: debayer to BGR888 per line, then convert */
+	PixelFormat yuvFormat_;
+	debayerFn rgbDebayer_[4];
+	uint8_t *outputBase_;
+'''
+
+OUTPUT_CONFIG = '''	if (outputFormat == formats::YUYV) {
+		config.bpp = 16;
+		return 0;
+	}
+
+	/* NV12 bpp describes the Y plane, strideAndFrameSize() adds CbCr */
+	if (outputFormat == formats::NV12) {
+		config.bpp = 8;
+		return 0;
+	}
+
+'''
+
+FRAME_SIZE = '''	/* NV12: the CbCr plane follows the Y plane at half height */
+	if (outputFormat == formats::NV12)
+		return std::make_tuple(stride, stride * size.height * 3 / 2);
+
+'''
+
+WRAPPER = '''int DebayerCpu::setDebayerFunctions(@PARAMS@)
+{
+	const bool yuv = @OUT@ == formats::YUYV || @OUT@ == formats::NV12;
+	int ret;
+
+	yuvFormat_ = yuv ? @OUT@ : PixelFormat();
+
+	ret = setRgbDebayerFunctions(@ARGS@);
+	if (ret || !yuv)
+		return ret;
+
+	rgbDebayer_[0] = debayer0_;
+	rgbDebayer_[1] = debayer1_;
+	rgbDebayer_[2] = debayer2_;
+	rgbDebayer_[3] = debayer3_;
+
+	debayer0_ = &DebayerCpu::debayerYuv<0>;
+	debayer1_ = &DebayerCpu::debayerYuv<1>;
+	debayer2_ = &DebayerCpu::debayerYuv<2>;
+	debayer3_ = &DebayerCpu::debayerYuv<3>;
+
+	return 0;
+}
+'''
+
+CONVERT = '''/*
+ * BT.601 limited range coefficients scaled by 256. The chroma helpers take
+ * the sum of 2 (shift 9) or 4 (shift 10) pixels.
+ */
+static inline uint8_t yuvY(int r, int g, int b)
+{
+	return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+template<unsigned int Shift>
+static inline uint8_t yuvU(int r, int g, int b)
+{
+	return ((-38 * r - 74 * g + 112 * b + (1 << (Shift - 1))) >> Shift) + 128;
+}
+
+template<unsigned int Shift>
+static inline uint8_t yuvV(int r, int g, int b)
+{
+	return ((112 * r - 94 * g - 18 * b + (1 << (Shift - 1))) >> Shift) + 128;
+}
+
+/*
+ * Debayer one line into a BGR888 line buffer and convert it to YUV. The line
+ * buffer is thread local so the stripe threads each use their own.
+ */
+template<unsigned int Line>
+void DebayerCpu::debayerYuv(uint8_t *dst, const uint8_t *src[])
+{
+	thread_local std::vector<uint8_t> bgr;
+
+	bgr.resize(window_.width * 3);
+	(this->*rgbDebayer_[Line])(bgr.data(), src);
+
+	if (yuvFormat_ == formats::YUYV)
+		yuyvLine(bgr.data(), dst);
+	else
+		nv12Line(bgr.data(), dst);
+}
+
+void DebayerCpu::yuyvLine(const uint8_t *bgr, uint8_t *dst)
+{
+	for (unsigned int x = 0; x < window_.width; x += 2) {
+		const int b0 = bgr[0], g0 = bgr[1], r0 = bgr[2];
+		const int b1 = bgr[3], g1 = bgr[4], r1 = bgr[5];
+
+		dst[0] = yuvY(r0, g0, b0);
+		dst[1] = yuvU<9>(r0 + r1, g0 + g1, b0 + b1);
+		dst[2] = yuvY(r1, g1, b1);
+		dst[3] = yuvV<9>(r0 + r1, g0 + g1, b0 + b1);
+
+		bgr += 6;
+		dst += 4;
+	}
+}
+
+/*
+ * Even lines keep their horizontal chroma sums, the following odd line adds
+ * its own and writes the CbCr row. Both lines of a pair are always handled
+ * by the same thread, stripes start on even lines.
+ */
+void DebayerCpu::nv12Line(const uint8_t *bgr, uint8_t *dst)
+{
+	thread_local std::vector<uint16_t> sums;
+	const unsigned int stride = outputConfig_.stride;
+	const unsigned int line = (dst - outputBase_) / stride;
+	uint8_t *cbcr = outputBase_ + stride * window_.height + (line / 2) * stride;
+
+	sums.resize(window_.width / 2 * 3);
+	uint16_t *sum = sums.data();
+
+	for (unsigned int x = 0; x < window_.width; x += 2) {
+		const int b0 = bgr[0], g0 = bgr[1], r0 = bgr[2];
+		const int b1 = bgr[3], g1 = bgr[4], r1 = bgr[5];
+
+		dst[x] = yuvY(r0, g0, b0);
+		dst[x + 1] = yuvY(r1, g1, b1);
+
+		if (!(line & 1)) {
+			sum[0] = r0 + r1;
+			sum[1] = g0 + g1;
+			sum[2] = b0 + b1;
+		} else {
+			const int r = sum[0] + r0 + r1;
+			const int g = sum[1] + g0 + g1;
+			const int b = sum[2] + b0 + b1;
+
+			cbcr[x] = yuvU<10>(r, g, b);
+			cbcr[x + 1] = yuvV<10>(r, g, b);
+		}
+
+		bgr += 6;
+		sum += 3;
+	}
+}
+'''
+
+
+def apply(tree):
+    header = tree.file(f'{SWISP}/debayer_cpu.h')
+    source = tree.file(f'{SWISP}/debayer_cpu.cpp')
+
+    # Advertise the formats for every supported input
+    lists = list(re.finditer(r'config\.outputFormats = std::vector<PixelFormat>\(\{[^}]*?'
+                             r'\n([ \t]*)(formats::\w+)( \}\);)', source.text))
+    if not lists:
+        raise PatchError('no outputFormats lists in getInputConfig()')
+    for m in reversed(lists):
+        indent = m.group(1)
+        extra = f'{m.group(2)},\n{indent}formats::YUYV,\n{indent}formats::NV12'
+        source.text = source.text[:m.start(2)] + extra + source.text[m.end(2):]
+
+    source.insert_before(r'^\tLOG\(Debayer, Info\)\n\t\t<< "Unsupported output format "',
+                         OUTPUT_CONFIG, 'getOutputConfig() error path')
+    fn = source.function_text(r'DebayerCpu::strideAndFrameSize\(')
+    if '\treturn std::make_tuple(stride, stride * size.height);\n' not in fn:
+        raise PatchError('strideAndFrameSize() has an unexpected frame size')
+    source.insert_before(r'^\treturn std::make_tuple\(stride, stride \* size\.height\);',
+                         FRAME_SIZE, 'strideAndFrameSize() return')
+
+    # Wrap setDebayerFunctions(): let the original set up the BGR888
+    # debayer, then interpose the YUV converters.
+    m = source.require(r'^int DebayerCpu::setDebayerFunctions\(([^)]*)\)\n\{',
+                       'setDebayerFunctions() definition')
+    params = m.group(1)
+    names = [re.split(r'[\s&*]+', p.strip())[-1] for p in params.split(',')]
+    if len(names) < 2:
+        raise PatchError('setDebayerFunctions() has no output format parameter')
+    out = names[1]
+    args = ', '.join([f'yuv ? formats::RGB888 : {out}' if n == out else n for n in names])
+    source.text = source.text[:m.start()] + source.text[m.start():].replace(
+        'DebayerCpu::setDebayerFunctions(', 'DebayerCpu::setRgbDebayerFunctions(', 1)
+    wrapper = (WRAPPER.replace('@PARAMS@', params).replace('@OUT@', out)
+               .replace('@ARGS@', args))
+    source.insert_after_function(r'DebayerCpu::setRgbDebayerFunctions\(', wrapper)
+    source.insert_before(r'^int DebayerCpu::setRgbDebayerFunctions\(', CONVERT + '\n',
+                         'setRgbDebayerFunctions()')
+
+    # The NV12 converter locates the CbCr plane from the frame base
+    source.prepend_to_function(r'DebayerCpu::process2\(', '\toutputBase_ = dst;\n\n')
+    source.prepend_to_function(r'DebayerCpu::process4\(', '\toutputBase_ = dst;\n\n')
+
+    decl = header.require(r'^\tint setDebayerFunctions\(([^)]*)\);\n', 'setDebayerFunctions() declaration')
+    header.text = (header.text[:decl.end()] +
+                   decl.group(0).replace('setDebayerFunctions', 'setRgbDebayerFunctions').replace(
+                       '\n\t\t\t\t', '\n\t\t\t\t   ') +
+                   H_METHODS + header.text[decl.end():])
+    header.insert_after(r'^\tdebayerFn debayer3_;', H_MEMBERS, 'debayer3_ member')
+
+
+run(apply, MARKER)
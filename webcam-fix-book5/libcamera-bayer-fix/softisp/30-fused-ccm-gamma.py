@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+# 30-fused-ccm-gamma.py — Fuse the post-CCM clamp and gamma into one table.
+#
+# The simple IPA already turns the tuning file's Ccm (with the AWB gains)
+# into per-input-value lookup columns, and Lut/Adjust into a gamma table,
+# whenever the parameters change. The debayer still does, per pixel and
+# per colour: sum the three CCM columns, clamp to [0, 255] and look up the
+# gamma table.
+#
+# This patch builds, once per parameter change, one table per colour that
+# maps the raw CCM sum straight to the gamma-corrected output. A per-colour
+# bias is folded into the red column so the sum is always a valid index.
+# Per pixel that leaves three integer adds and three loads per colour, with
+# no clamps or branches. The tuning file format is unchanged.
+#
+# Column values are limited to +/-4096 (16x the output range) to bound the
+# table size. Only CCMs with a single coefficient above ~16 would notice.
+
+import re
+
+from patchlib import NotApplicable, run
+
+MARKER = 'SOFTISP-FUSED-CCM'
+SWISP = 'src/libcamera/software_isp'
+
+H_METHODS = '''	void fuseCcmGamma();
+'''
+
+H_MEMBERS = '''
+	/*
+	 * Clamp and gamma fused per colour (b, g, r), indexed by the CCM sum.
+	 * The red columns carry the bias that makes the index non-negative.
+	 */
+	static constexpr int kFusedColumnLimit = 4096;
+	std::vector<uint8_t> fusedLut_[3];
+	struct {
+		DebayerParams::CcmLookupTable redCcm;
+		DebayerParams::CcmLookupTable greenCcm;
+		DebayerParams::CcmLookupTable blueCcm;
+		DebayerParams::LookupTable gammaLut;
+	} fusedFrom_;
+	DebayerParams::CcmLookupTable fusedRedCcm_;
+	DebayerParams::CcmLookupTable fusedGreenCcm_;
+	DebayerParams::CcmLookupTable fusedBlueCcm_;
+	bool fusedValid_ = false;
+'''
+
+FUSE = '''/*
+ * Rebuild the fused clamp + gamma tables when the IPA sends new CCM or gamma
+ * tables, and install the biased CCM columns used by STORE_PIXEL().
+ */
+void DebayerCpu::fuseCcmGamma()
+{
+	static constexpr int16_t DebayerParams::CcmColumn::*components[3] = {
+		&DebayerParams::CcmColumn::b,
+		&DebayerParams::CcmColumn::g,
+		&DebayerParams::CcmColumn::r,
+	};
+
+	if (fusedValid_ &&
+	    !memcmp(&fusedFrom_.redCcm, &redCcm_, sizeof(redCcm_)) &&
+	    !memcmp(&fusedFrom_.greenCcm, &greenCcm_, sizeof(greenCcm_)) &&
+	    !memcmp(&fusedFrom_.blueCcm, &blueCcm_, sizeof(blueCcm_)) &&
+	    !memcmp(&fusedFrom_.gammaLut, &gammaLut_, sizeof(gammaLut_))) {
+		redCcm_ = fusedRedCcm_;
+		greenCcm_ = fusedGreenCcm_;
+		blueCcm_ = fusedBlueCcm_;
+		return;
+	}
+
+	fusedFrom_.redCcm = redCcm_;
+	fusedFrom_.greenCcm = greenCcm_;
+	fusedFrom_.blueCcm = blueCcm_;
+	fusedFrom_.gammaLut = gammaLut_;
+
+	for (unsigned int c = 0; c < 3; c++) {
+		int16_t DebayerParams::CcmColumn::*component = components[c];
+		int minSum = 0;
+		int maxSum = 0;
+
+		for (DebayerParams::CcmLookupTable *table : { &redCcm_, &greenCcm_, &blueCcm_ }) {
+			int lo = kFusedColumnLimit;
+			int hi = -kFusedColumnLimit;
+
+			for (DebayerParams::CcmColumn &column : *table) {
+				int16_t &value = column.*component;
+
+				value = std::clamp<int>(value, -kFusedColumnLimit, kFusedColumnLimit);
+				lo = std::min<int>(lo, value);
+				hi = std::max<int>(hi, value);
+			}
+
+			minSum += lo;
+			maxSum += hi;
+		}
+
+		for (DebayerParams::CcmColumn &column : redCcm_)
+			column.*component -= minSum;
+
+		std::vector<uint8_t> &lut = fusedLut_[c];
+		lut.resize(maxSum - minSum + 1);
+		for (int sum = minSum; sum <= maxSum; sum++)
+			lut[sum - minSum] = gammaLut_[std::clamp(sum, 0, @MAX@)];
+	}
+
+	fusedRedCcm_ = redCcm_;
+	fusedGreenCcm_ = greenCcm_;
+	fusedBlueCcm_ = blueCcm_;
+	fusedValid_ = true;
+}
+'''
+
+
+def apply(tree):
+    header = tree.file(f'{SWISP}/debayer_cpu.h')
+    source = tree.file(f'{SWISP}/debayer_cpu.cpp')
+
+    # The CCM branch of STORE_PIXEL(): sums, clamps and gamma lookups
+    m = source.search(
+        r'^(\t\t)int b = blue\.b \+ green\.b \+ red\.b;[ \t]*\\\n'
+        r'\t\tint g = blue\.g \+ green\.g \+ red\.g;[ \t]*\\\n'
+        r'\t\tint r = blue\.r \+ green\.r \+ red\.r;[ \t]*\\\n'
+        r'\t\tr = std::clamp\(r, 0, (\w+)\);[ \t]*\\\n'
+        r'\t\tg = std::clamp\(g, 0, \2\);[ \t]*\\\n'
+        r'\t\tb = std::clamp\(b, 0, \2\);[ \t]*\\\n'
+        r'\t\t\*dst\+\+ = gammaLut_\[b\];[ \t]*\\\n'
+        r'\t\t\*dst\+\+ = gammaLut_\[g\];[ \t]*\\\n'
+        r'\t\t\*dst\+\+ = gammaLut_\[r\];[ \t]*\\\n')
+    if not m:
+        raise NotApplicable('STORE_PIXEL() CCM path has an unexpected structure')
+    clamp_max = m.group(2)
+
+    def line(text):
+        return '\t\t' + text.ljust(55) + '\\\n'
+
+    fused = (line('*dst++ = fusedLut_[0][blue.b + green.b + red.b];') +
+             line('*dst++ = fusedLut_[1][blue.g + green.g + red.g];') +
+             line('*dst++ = fusedLut_[2][blue.r + green.r + red.r];'))
+    source.text = source.text[:m.start()] + fused + source.text[m.end():]
+
+    source.add_include('algorithm')
+    source.add_include('string.h')
+    source.insert_after(r'^\tgammaLut_ = params\.gammaLut;', '\tfuseCcmGamma();\n',
+                        'gammaLut_ update in process()')
+    source.insert_before(r'^namespace \{\n\ninline int64_t timeDiff', FUSE.replace('@MAX@', clamp_max) + '\n',
+                         'timeDiff() helper')
+
+    header.insert_after(r'^\tvoid process4\(', H_METHODS, 'process4() declaration')
+    header.insert_after(r'^\tDebayerParams::LookupTable gammaLut_;', H_MEMBERS,
+                        'gammaLut_ member')
+
+
+run(apply, MARKER)
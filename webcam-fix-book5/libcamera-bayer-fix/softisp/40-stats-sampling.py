@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+# 40-stats-sampling.py — Configurable AWB/AGC statistics sampling.
+#
+# The SoftISP gathers its statistics (RGB sums and a luminance histogram)
+# from one in every four 2x2 blocks of the frame. Depending on the
+# libcamera version that is either done for every frame or for every 4th
+# frame, although the IPA only acts on every 4th. With a stable scene most
+# of that work produces nothing new.
+#
+# This patch reads an optional "statistics" section from the sensor tuning
+# file (the same file the IPA loads):
+#
+#   statistics:
+#     stride: 4               # one 2x2 block per N x N blocks (2, 4, 8 or 16)
+#     window: [ 0.125, 0.125, 0.75, 0.75 ]   # x, y, width, height (0..1)
+#     interval: 4             # collect every Nth frame once settled
+#     fast-frames: 8          # collect every frame after stream start and
+#                             # after a scene change, for N frames
+#     scene-change: 0.2       # relative brightness change that counts as
+#                             # a scene change (0 = never)
+#
+# Without the section the statistics are collected exactly as upstream
+# samples them, on the frames the IPA uses (every 4th). Only the frames
+# that are collected are marked valid, so the AGC keeps acting on fresh
+# statistics only.
+
+import re
+
+from patchlib import NotApplicable, PatchError, run
+
+MARKER = 'SOFTISP-STATS-SAMPLING'
+SWISP = 'src/libcamera/software_isp'
+
+H_METHODS = '''	void configureSampling(const std::string &tuningFile);
+	void selectFrame(uint32_t frame);
+'''
+
+H_PRIVATE = '''	void detectSceneChange();
+'''
+
+H_MEMBERS = '''
+	/* Sampling, from the statistics section of the tuning file */
+	unsigned int stride_ = 2;
+	std::array<double, 4> roi_ = { 0.0, 0.0, 1.0, 1.0 };
+	unsigned int interval_ = kStatPerNumFrames;
+	unsigned int fastFrames_ = 0;
+	double sceneChange_ = 0.0;
+
+	/* Set by selectFrame() for each frame */
+	bool collect_ = true;
+	unsigned int blockStep_ = 1;
+	uint32_t lastFrame_ = UINT32_MAX;
+	uint32_t nextFrame_ = 0;
+	unsigned int fastLeft_ = 0;
+	double lastMean_ = -1.0;
+'''
+
+CPP_FUNCTIONS = '''/**
+ * \\brief Load the statistics sampling settings from a tuning file
+ * \\param[in] tuningFile Path of the IPA tuning file
+ *
+ * Reads the optional top level "statistics" section. The IPA ignores it, so
+ * the same file works with an unpatched libcamera.
+ */
+void SwStatsCpu::configureSampling(const std::string &tuningFile)
+{
+	File file(tuningFile);
+	if (!file.open(File::OpenModeFlag::ReadOnly))
+		return;
+
+	std::unique_ptr<YamlObject> data = YamlParser::parse(file);
+	if (!data || !data->contains("statistics"))
+		return;
+
+	const YamlObject &params = (*data)["statistics"];
+
+	unsigned int stride = params["stride"].get<uint32_t>(2);
+	if (stride < 2 || stride > 16 || (stride & (stride - 1))) {
+		LOG(SwStatsCpu, Warning)
+			<< "Statistics stride must be 2, 4, 8 or 16, not " << stride;
+		stride = 2;
+	}
+	stride_ = stride;
+
+	if (params.contains("window")) {
+		std::vector<double> roi =
+			params["window"].getList<double>().value_or(std::vector<double>{});
+		if (roi.size() == 4 && roi[0] >= 0.0 && roi[1] >= 0.0 &&
+		    roi[2] > 0.0 && roi[3] > 0.0 &&
+		    roi[0] + roi[2] <= 1.0 && roi[1] + roi[3] <= 1.0)
+			std::copy(roi.begin(), roi.end(), roi_.begin());
+		else
+			LOG(SwStatsCpu, Warning)
+				<< "Ignoring invalid statistics window";
+	}
+
+	unsigned int interval = params["interval"].get<uint32_t>(kStatPerNumFrames);
+	interval_ = std::clamp(interval, 1U, 64U);
+	fastFrames_ = params["fast-frames"].get<uint32_t>(0);
+	sceneChange_ = std::max(params["scene-change"].get<double>(0.0), 0.0);
+
+	LOG(SwStatsCpu, Info)
+		<< "Statistics sampling: stride " << stride_
+		<< ", window " << roi_[0] << "," << roi_[1] << " "
+		<< roi_[2] << "x" << roi_[3]
+		<< ", every " << interval_ << " frames, " << fastFrames_
+		<< " fast frames, scene change " << sceneChange_;
+}
+
+/**
+ * \\brief Decide whether statistics are collected for a frame
+ * \\param[in] frame The frame number
+ *
+ * Every frame is collected for the first fastFrames_ frames after a stream
+ * (re)start or a scene change, every interval_ frames otherwise.
+ */
+void SwStatsCpu::selectFrame(uint32_t frame)
+{
+	/* Frame numbers start over when streaming restarts */
+	if (lastFrame_ == UINT32_MAX || frame <= lastFrame_) {
+		fastLeft_ = fastFrames_;
+		nextFrame_ = frame;
+		lastMean_ = -1.0;
+	}
+	lastFrame_ = frame;
+
+	collect_ = fastLeft_ > 0 || frame >= nextFrame_;
+	if (!collect_)
+		return;
+
+	if (fastLeft_)
+		fastLeft_--;
+	nextFrame_ = frame + interval_;
+}
+
+/*
+ * Compare the mean of the luminance histogram with the previous collected
+ * frame. The sampling doesn't change between frames, so neither does the
+ * meaning of the histogram.
+ */
+void SwStatsCpu::detectSceneChange()
+{
+	uint64_t count = 0;
+	uint64_t weighted = 0;
+
+	for (unsigned int i = 0; i < stats_.yHistogram.size(); i++) {
+		count += stats_.yHistogram[i];
+		weighted += static_cast<uint64_t>(i) * stats_.yHistogram[i];
+	}
+	if (!count)
+		return;
+
+	double mean = static_cast<double>(weighted) / count;
+	if (lastMean_ >= 0.0 &&
+	    std::abs(mean - lastMean_) > sceneChange_ * std::max(lastMean_, 1.0))
+		fastLeft_ = fastFrames_;
+	lastMean_ = mean;
+}
+'''
+
+SET_WINDOW = '''
+	/* Restrict to the configured window, within the debayer's window */
+	window_.x += window.width * roi_[0];
+	window_.y += window.height * roi_[1];
+	window_.width = window.width * roi_[2];
+	window_.height = window.height * roi_[3];
+
+	/* Lines are processed in pairs, sample one pair every stride_ */
+	ySkipMask_ = (stride_ - 1) << 1;
+	blockStep_ = stride_ / 2;
+'''
+
+
+def patch_swstats(tree):
+    header = tree.file(f'{SWISP}/swstats_cpu.h',
+                       'include/libcamera/internal/software_isp/swstats_cpu.h')
+    source = tree.file(f'{SWISP}/swstats_cpu.cpp')
+
+    if 'kStatPerNumFrames' not in header:
+        raise NotApplicable('no kStatPerNumFrames in SwStatsCpu')
+
+    # The stride scales the upstream sampling of one 2x2 block in four
+    if not source.search(r'^\tySkipMask_ = 0x02;'):
+        raise NotApplicable('unexpected vertical statistics sampling')
+    loops = list(re.finditer(r'(for \(int x = 0; x < [^;]+; x \+= )([45])\)', source.text))
+    if not loops:
+        raise NotApplicable('unexpected horizontal statistics sampling')
+    for m in reversed(loops):
+        source.text = (source.text[:m.start()] + f'{m.group(1)}{m.group(2)} * blockStep_)' +
+                       source.text[m.end():])
+
+    # Frame selection replaces the fixed 1-in-kStatPerNumFrames check
+    for src in (header, source):
+        src.text = re.sub(r'frame % kStatPerNumFrames == 0', 'collect_', src.text)
+        src.text = re.sub(r'frame % kStatPerNumFrames', '!collect_', src.text)
+    if 'stats_.valid = collect_;' not in source:
+        raise PatchError('finishFrame() does not set stats_.valid')
+    for fn in ('processLine0', 'processLine2'):
+        m = header.require(r'^\tvoid ' + fn + r'\(.*?^\t\}\n', f'{fn}()', re.MULTILINE | re.DOTALL)
+        if '!collect_' not in m.group(0):
+            body = m.group(0).replace('if ((y & ySkipMask_) || ',
+                                      'if (!collect_ || (y & ySkipMask_) ||\n\t\t    ', 1)
+            if body == m.group(0):
+                raise PatchError(f'{fn}() has an unexpected line check')
+            header.text = header.text[:m.start()] + body + header.text[m.end():]
+    if '!collect_' not in source.function_text(r'SwStatsCpu::startFrame\('):
+        source.prepend_to_function(r'SwStatsCpu::startFrame\(', '\tif (!collect_)\n\t\treturn;\n\n')
+    # The stripe partials start as copies of stats_, which skipped frames
+    # don't clear: merging them would add up the previous totals.
+    for fn in ('beginStripes', 'endStripes'):
+        if f'void SwStatsCpu::{fn}(' in source:
+            source.prepend_to_function(rf'SwStatsCpu::{fn}\(', '\tif (!collect_)\n\t\treturn;\n\n')
+
+    source.prepend_to_function(r'SwStatsCpu::finishFrame\(',
+                               '\tif (collect_ && sceneChange_ > 0.0)\n'
+                               '\t\tdetectSceneChange();\n\n')
+    source.insert_after(r'^void SwStatsCpu::setWindow\(const Rectangle &window\)\n\{\n\twindow_ = window;',
+                        SET_WINDOW, 'setWindow() window_ assignment')
+    source.insert_before(r'^void SwStatsCpu::startFrame\(', CPP_FUNCTIONS + '\n',
+                         'startFrame() definition')
+
+    source.add_include('algorithm')
+    source.add_include('cmath')
+    source.add_include('memory')
+    source.add_include('vector')
+    source.insert_before(r'^#include <libcamera/base/log\.h>', '#include <libcamera/base/file.h>\n',
+                         'log.h include')
+    source.insert_after(r'^#include "libcamera/internal/bayer_format\.h"',
+                        '#include "libcamera/internal/yaml_parser.h"\n', 'bayer_format.h include')
+
+    header.add_include('array')
+    header.add_include('string')
+    header.insert_after(r'^\tvoid finishFrame\(', H_METHODS, 'finishFrame() declaration')
+    header.insert_after(r'^\tint setupStandardBayerOrder\(', H_PRIVATE,
+                        'setupStandardBayerOrder() declaration')
+    header.insert_after(r'^\tunsigned int xShift_;', H_MEMBERS, 'xShift_ member')
+
+
+def patch_callers(tree):
+    debayer = tree.file(f'{SWISP}/debayer_cpu.cpp')
+    isp = tree.file(f'{SWISP}/software_isp.cpp')
+
+    debayer.require(r'^void DebayerCpu::process\(uint32_t frame,', 'process() definition')
+    debayer.insert_before(r'^\tstats_->startFrame\(', '\tstats_->selectFrame(frame);\n',
+                          'startFrame() call in process()')
+
+    # The pipeline handler side knows the tuning file before the IPA loads it
+    isp.insert_after(r'^\tauto stats = std::make_unique<SwStatsCpu>\([^;]*\);',
+                     '\tSwStatsCpu *swStats = stats.get();\n', 'SwStatsCpu creation')
+    isp.insert_after(r'^\tstd::string ipaTuningFile =[^;]*;',
+                     '\tswStats->configureSampling(ipaTuningFile);\n', 'tuning file lookup')
+
+
+def apply(tree):
+    patch_swstats(tree)
+    patch_callers(tree)
+
+
+run(apply, MARKER)
@@ -0,0 +1,255 @@
+#!/usr/bin/env python3
+# 50-binned-output.py — 1/2 and 1/4 output sizes binned during the debayer.
+#
+# The SoftISP accepts any output size up to the sensor size, but a smaller
+# size is a centre crop: for 960x540 it debayers the middle 960x540 of the
+# 1928x1092 frame (a 2x digital zoom), and apps that want the full field of
+# view ask for 1920x1080 and scale it down themselves.
+#
+# With this patch, an output size that fits the sensor area 2 or 4 times in
+# both directions is produced by binning instead: each output pixel averages
+# the Bayer quads it covers (1 quad at 1/2, 2x2 quads at 1/4), with no
+# interpolation. 960x540 and 480x270 then show the same field of view as
+# 1920x1080, and the debayer does a fraction of the arithmetic and writes a
+# quarter (or a sixteenth) of the memory. These sizes are already inside the
+# SoftISP's advertised size range, so apps can select them as before.
+#
+# Binning is used for unpacked 8/10/12-bit Bayer input and the RGB output
+# formats. Other formats keep the upstream centre crop.
+
+from patchlib import NotApplicable, PatchError, run
+
+MARKER = 'SOFTISP-BINNING'
+SWISP = 'src/libcamera/software_isp'
+
+H_METHODS = '''	template<unsigned int Bits, unsigned int Factor, bool addAlphaByte, bool ccmEnabled>
+	void binLine(uint8_t *dst, const uint8_t *src[]);
+	void setupBinning(const StreamConfiguration &inputCfg,
+			  const StreamConfiguration &outputCfg, bool ccmEnabled);
+	void processBinned(@FRAME_PARAM@const uint8_t *src, uint8_t *dst);
+'''
+
+H_MEMBERS = '''	/* Binned output: factor 2 or 4, 1 when debayering a centre crop */
+	unsigned int binning_ = 1;
+	debayerFn binLine_;
+	unsigned int binBlueColumn_;
+	bool binSwapRows_;
+	std::vector<uint8_t> binLines_;
+'''
+
+BIN_LINE = '''/*
+ * Average the Bayer quads covered by each output pixel. src[] holds Factor
+ * input lines, ordered by processBinned() so that blue is on the even lines:
+ * every quad reads as B G / G R or as G B / R G.
+ */
+template<unsigned int Bits, unsigned int Factor, bool addAlphaByte, bool ccmEnabled>
+void DebayerCpu::binLine(uint8_t *dst, const uint8_t *src[])
+{
+	using pixel_t = std::conditional_t<Bits == 8, uint8_t, uint16_t>;
+	/* Scale the sums to 8 bits: Factor / 2 squared quads, 2 greens each */
+	constexpr unsigned int shift = Bits - 8 + (Factor == 4 ? 2 : 0);
+	const int width = window_.width / Factor;
+	const unsigned int bc = binBlueColumn_;
+
+	for (int x = 0; x < width;) {
+		unsigned int b = 0, g = 0, r = 0;
+
+		for (unsigned int y = 0; y < Factor; y += 2) {
+			const pixel_t *even = reinterpret_cast<const pixel_t *>(src[y]) + x * Factor;
+			const pixel_t *odd = reinterpret_cast<const pixel_t *>(src[y + 1]) + x * Factor;
+
+			for (unsigned int i = 0; i < Factor; i += 2) {
+				b += even[i + bc];
+				g += even[i + 1 - bc] + odd[i + bc];
+				r += odd[i + 1 - bc];
+			}
+		}
+
+		STORE_PIXEL(b >> shift, g >> (shift + 1), r >> shift)
+	}
+}
+
+#define BIN_METHOD(bits, factor)                                                                      \\
+	(addAlphaByte                                                                                 \\
+		 ? (ccmEnabled ? &DebayerCpu::binLine<bits, factor, true, true>                        \\
+			       : &DebayerCpu::binLine<bits, factor, true, false>)                      \\
+		 : (ccmEnabled ? &DebayerCpu::binLine<bits, factor, false, true>                       \\
+			       : &DebayerCpu::binLine<bits, factor, false, false>))
+
+/*
+ * Use binning when the output fits the usable sensor area 4 or 2 times in
+ * both directions, and the formats are supported. This replaces the centre
+ * crop set up by configure() with a window Factor times the output size.
+ */
+void DebayerCpu::setupBinning(const StreamConfiguration &inputCfg,
+			      const StreamConfiguration &outputCfg, bool ccmEnabled)
+{
+	BayerFormat bayerFormat = BayerFormat::fromPixelFormat(inputCfg.pixelFormat);
+	const PixelFormat &format = outputCfg.pixelFormat;
+	const Size maxSize = sizes(inputCfg.pixelFormat, inputCfg.size).max;
+	bool addAlphaByte;
+
+	binning_ = 1;
+
+	if (format == formats::RGB888 || format == formats::BGR888)
+		addAlphaByte = false;
+	else if (format == formats::XRGB8888 || format == formats::ARGB8888 ||
+		 format == formats::XBGR8888 || format == formats::ABGR8888)
+		addAlphaByte = true;
+	else
+		return;
+
+	if (bayerFormat.packing != BayerFormat::Packing::None ||
+	    !isStandardBayerOrder(bayerFormat.order) ||
+	    inputConfig_.patternSize.height != 2)
+		return;
+
+	for (unsigned int factor : { 4U, 2U }) {
+		if (outputCfg.size.width * factor <= maxSize.width &&
+		    outputCfg.size.height * factor <= maxSize.height) {
+			binning_ = factor;
+			break;
+		}
+	}
+
+	switch (bayerFormat.bitDepth) {
+	case 8:
+		binLine_ = binning_ == 4 ? BIN_METHOD(8, 4) : BIN_METHOD(8, 2);
+		break;
+	case 10:
+		binLine_ = binning_ == 4 ? BIN_METHOD(10, 4) : BIN_METHOD(10, 2);
+		break;
+	case 12:
+		binLine_ = binning_ == 4 ? BIN_METHOD(12, 4) : BIN_METHOD(12, 2);
+		break;
+	default:
+		binning_ = 1;
+	}
+
+	if (binning_ == 1)
+		return;
+
+	/* Same R/B swap for the BGR formats as setDebayerFunctions() */
+	BayerFormat::Order order = bayerFormat.order;
+	if (swapRedBlueGains_) {
+		switch (order) {
+		case BayerFormat::BGGR:
+			order = BayerFormat::RGGB;
+			break;
+		case BayerFormat::GBRG:
+			order = BayerFormat::GRBG;
+			break;
+		case BayerFormat::GRBG:
+			order = BayerFormat::GBRG;
+			break;
+		default:
+			order = BayerFormat::BGGR;
+			break;
+		}
+	}
+	binBlueColumn_ = order == BayerFormat::GBRG || order == BayerFormat::RGGB;
+	binSwapRows_ = order == BayerFormat::GRBG || order == BayerFormat::RGGB;
+
+	window_.width = outputCfg.size.width * binning_;
+	window_.height = outputCfg.size.height * binning_;
+	window_.x = ((inputCfg.size.width - window_.width) / 2) &
+		    ~(inputConfig_.patternSize.width - 1);
+	window_.y = ((inputCfg.size.height - window_.height) / 2) &
+		    ~(inputConfig_.patternSize.height - 1);
+
+	if (enableInputMemcpy_)
+		binLines_.resize(binning_ * window_.width * inputConfig_.bpp / 8);
+
+	LOG(Debayer, Info)
+		<< "Binning " << window_.size() << " by " << binning_
+		<< " to " << outputCfg.size;
+}
+'''
+
+PROCESS_BINNED = '''
+/*
+ * Binned output: every input line of the window is read once, in groups of
+ * binning_ lines per output line.
+ */
+void DebayerCpu::processBinned(@FRAME_PARAM@const uint8_t *src, uint8_t *dst)
+{
+	const unsigned int bytesPerPixel = inputConfig_.bpp / 8;
+	const unsigned int lineLength = window_.width * bytesPerPixel;
+	const uint8_t *lines[4];
+	const uint8_t *binned[4];
+
+	src += window_.y * inputConfig_.stride + window_.x * bytesPerPixel;
+
+	for (unsigned int y = 0; y < window_.height; y += binning_) {
+		for (unsigned int i = 0; i < binning_; i++) {
+			lines[i] = src + i * inputConfig_.stride;
+			if (enableInputMemcpy_) {
+				uint8_t *copy = binLines_.data() + i * lineLength;
+
+				memcpy(copy, lines[i], lineLength);
+				lines[i] = copy;
+			}
+		}
+
+		/* Same line numbering and pointers [1], [2] as process2() */
+		for (unsigned int i = 0; i < binning_; i += 2) {
+			const uint8_t *statsLines[3] = { nullptr, lines[i], lines[i + 1] };
+
+			stats_->processLine0(@FRAME_ARG@window_.y + y + i, statsLines);
+		}
+
+		for (unsigned int i = 0; i < binning_; i++)
+			binned[i] = lines[i ^ binSwapRows_];
+		(this->*binLine_)(dst, binned);
+
+		src += binning_ * inputConfig_.stride;
+		dst += outputConfig_.stride;
+	}
+}
+'''
+
+DISPATCH = '''	if (binning_ > 1) {
+		processBinned(@FRAME_ARG@src, dst);
+		return;
+	}
+
+'''
+
+
+def apply(tree):
+    header = tree.file(f'{SWISP}/debayer_cpu.h')
+    source = tree.file(f'{SWISP}/debayer_cpu.cpp')
+
+    sig = source.require(r'^void DebayerCpu::process2\((uint32_t frame, )?const uint8_t \*src, uint8_t \*dst\)',
+                         'process2() definition')
+    frame_param = sig.group(1) or ''
+    frame_arg = 'frame, ' if frame_param else ''
+
+    def fill(text):
+        return text.replace('@FRAME_PARAM@', frame_param).replace('@FRAME_ARG@', frame_arg)
+
+    if f'stats_->processLine0({frame_arg}y, linePointers)' not in source.function_text(r'DebayerCpu::process2\('):
+        raise NotApplicable('process2() statistics call has changed')
+    if not source.search(r'^#define STORE_PIXEL\(b_, g_, r_\)'):
+        raise NotApplicable('no STORE_PIXEL() macro')
+    if 'static bool isStandardBayerOrder(' not in source:
+        raise PatchError('no isStandardBayerOrder() helper')
+
+    # Set up after configure() picked the centre crop, before the
+    # statistics window and line buffers are sized from it.
+    source.insert_before(r'^\t/\* Don\'t pass x,y since process\(\) already adjusts src',
+                         '\tsetupBinning(inputCfg, outputCfg, ccmEnabled);\n\n',
+                         'statistics window setup in configure()')
+    source.insert_before(r'^int DebayerCpu::getInputConfig\(', BIN_LINE + '\n',
+                         'getInputConfig() definition')
+    source.prepend_to_function(r'DebayerCpu::process2\(', fill(DISPATCH))
+    source.insert_after_function(r'DebayerCpu::process4\(', fill(PROCESS_BINNED).lstrip('\n'))
+    source.add_include('string.h')
+    source.add_include('type_traits')
+
+    header.add_include('vector')
+    header.insert_after(r'^\tvoid process4\(', fill(H_METHODS), 'process4() declaration')
+    header.insert_after(r'^\tbool swapRedBlueGains_;', H_MEMBERS, 'swapRedBlueGains_ member')
+
+
+run(apply, MARKER)
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+# 55-fixed-size-kernels.py — YUV converters compiled for the relay's sizes.
+#
+# The YUYV/NV12 converters from 20-yuv-output.py loop over window_.width,
+# which the compiler only knows at run time. In practice the camera relay
+# asks for one of a handful of sizes: 1920x1080 (the default), 1280x720
+# (the common call profile) and the sensor's full 1928x1092.
+#
+# This patch turns the converters into templates on the line width and
+# instantiates them for those widths, plus the generic width 0 that reads
+# window_.width as before. With a constant trip count GCC unrolls and
+# vectorises the loops, and the stores are marked aligned: the output
+# buffers are page aligned and each instance assumes only the alignment
+# its own row length gives (64 bytes for 1920 and 1280, less for 1928).
+#
+# The kernels are chosen once in configure(), from the final output window
+# and stride; the per-line YUYV/NV12 branch is gone as well. Other sizes
+# use the generic kernels. LIBCAMERA_SOFTISP_GENERIC=1 forces the generic
+# kernels, which softisp-bench uses to time and checksum both.
+#
+# Only the line width matters to the converters, so any height works.
+
+from patchlib import PatchError, run
+
+MARKER = 'SOFTISP-FIXED-KERNELS'
+SWISP = 'src/libcamera/software_isp'
+
+H_TYPES = '''	using yuvLineFn = void (DebayerCpu::*)(const uint8_t *bgr, uint8_t *dst);
+'''
+
+H_METHODS = '''	template<unsigned int Width>
+	void yuyvLine(const uint8_t *bgr, uint8_t *dst);
+	template<unsigned int Width>
+	void nv12Line(const uint8_t *bgr, uint8_t *dst);
+	void setupKernels(const StreamConfiguration &outputCfg);
+'''
+
+H_MEMBERS = '''	yuvLineFn yuvLine_;
+'''
+
+ALIGN = '''/*
+ * Rows of a fixed-size kernel start at a multiple of their length from a
+ * page aligned buffer. setupKernels() checks that the stride keeps this
+ * alignment before picking a fixed-size kernel.
+ */
+static constexpr unsigned int rowAlignment(unsigned int bytes)
+{
+	return bytes ? std::min(bytes & -bytes, 64U) : 1;
+}
+
+template<unsigned int Bytes>
+static inline uint8_t *alignedRow(uint8_t *row)
+{
+	return static_cast<uint8_t *>(__builtin_assume_aligned(row, rowAlignment(Bytes)));
+}
+
+'''
+
+YUYV_HEAD = '''template<unsigned int Width>
+void DebayerCpu::yuyvLine(const uint8_t *bgr, uint8_t *dst)
+{
+	const unsigned int width = Width ? Width : window_.width;
+
+	dst = alignedRow<Width * 2>(dst);
+
+#pragma GCC unroll 4
+	for (unsigned int x = 0; x < width; x += 2) {'''
+
+NV12_HEAD = '''template<unsigned int Width>
+void DebayerCpu::nv12Line(const uint8_t *bgr, uint8_t *dst)
+{
+	thread_local std::vector<uint16_t> sums;
+	const unsigned int width = Width ? Width : window_.width;
+	const unsigned int stride = outputConfig_.stride;
+	const unsigned int line = (dst - outputBase_) / stride;
+	uint8_t *cbcr = alignedRow<Width>(outputBase_ + stride * window_.height + (line / 2) * stride);
+
+	dst = alignedRow<Width>(dst);
+	sums.resize(width / 2 * 3);
+	uint16_t *sum = sums.data();
+
+#pragma GCC unroll 4
+	for (unsigned int x = 0; x < width; x += 2) {'''
+
+SETUP = '''
+/*
+ * Pick the YUV converter for this configuration: a fixed-size instance if
+ * the output width has one and the stride keeps its rows aligned, the
+ * generic one otherwise.
+ */
+void DebayerCpu::setupKernels(const StreamConfiguration &outputCfg)
+{
+	static const struct {
+		unsigned int width;
+		yuvLineFn yuyv;
+		yuvLineFn nv12;
+	} kernels[] = {
+		{ 1928, &DebayerCpu::yuyvLine<1928>, &DebayerCpu::nv12Line<1928> },
+		{ 1920, &DebayerCpu::yuyvLine<1920>, &DebayerCpu::nv12Line<1920> },
+		{ 1280, &DebayerCpu::yuyvLine<1280>, &DebayerCpu::nv12Line<1280> },
+	};
+	const bool nv12 = yuvFormat_ == formats::NV12;
+	const char *generic = utils::secure_getenv("LIBCAMERA_SOFTISP_GENERIC");
+
+	yuvLine_ = nv12 ? &DebayerCpu::nv12Line<0> : &DebayerCpu::yuyvLine<0>;
+	if (!yuvFormat_.isValid() || (generic && !strcmp(generic, "1")))
+		return;
+
+	for (const auto &kernel : kernels) {
+		const unsigned int bytes = nv12 ? kernel.width : kernel.width * 2;
+
+		if (kernel.width != window_.width)
+			continue;
+		if (outputCfg.stride % rowAlignment(bytes))
+			break;
+
+		yuvLine_ = nv12 ? kernel.nv12 : kernel.yuyv;
+		LOG(Debayer, Debug) << "Using the " << kernel.width << " pixel YUV kernels";
+		break;
+	}
+}
+'''
+
+CONFIGURE = '''	setupKernels(outputCfg);
+
+'''
+
+
+def apply(tree):
+    tree.require_applied('SOFTISP-YUV')
+
+    header = tree.file(f'{SWISP}/debayer_cpu.h')
+    source = tree.file(f'{SWISP}/debayer_cpu.cpp')
+
+    # The converters as 20-yuv-output.py added them
+    for old, new, what in (
+            ('void DebayerCpu::yuyvLine(const uint8_t *bgr, uint8_t *dst)\n{\n'
+             '\tfor (unsigned int x = 0; x < window_.width; x += 2) {',
+             YUYV_HEAD, 'yuyvLine()'),
+            ('void DebayerCpu::nv12Line(const uint8_t *bgr, uint8_t *dst)\n{\n'
+             '\tthread_local std::vector<uint16_t> sums;\n'
+             '\tconst unsigned int stride = outputConfig_.stride;\n'
+             '\tconst unsigned int line = (dst - outputBase_) / stride;\n'
+             '\tuint8_t *cbcr = outputBase_ + stride * window_.height + (line / 2) * stride;\n\n'
+             '\tsums.resize(window_.width / 2 * 3);\n'
+             '\tuint16_t *sum = sums.data();\n\n'
+             '\tfor (unsigned int x = 0; x < window_.width; x += 2) {',
+             NV12_HEAD, 'nv12Line()'),
+            ('\tif (yuvFormat_ == formats::YUYV)\n'
+             '\t\tyuyvLine(bgr.data(), dst);\n'
+             '\telse\n'
+             '\t\tnv12Line(bgr.data(), dst);\n',
+             '\t(this->*yuvLine_)(bgr.data(), dst);\n', 'converter call in debayerYuv()')):
+        if source.text.count(old) != 1:
+            raise PatchError(f'{what} is not the one from 20-yuv-output.py')
+        source.text = source.text.replace(old, new)
+
+    source.insert_before(r'^static inline uint8_t yuvY\(', ALIGN, 'yuvY()')
+    source.insert_after_function(r'DebayerCpu::nv12Line\(', SETUP.lstrip('\n'))
+
+    # Once the window is final, like setupStripes()
+    start, _, end = source.function(r'DebayerCpu::configure\(')
+    configure = source.text[start:end]
+    last_return = configure.rfind('\n\treturn 0;\n}')
+    if last_return < 0:
+        raise PatchError('configure() does not end with return 0')
+    pos = start + last_return + 1
+    source.text = source.text[:pos] + CONFIGURE + source.text[pos:]
+
+    source.add_include('algorithm')
+    source.add_include('string.h')
+    if 'libcamera/base/utils.h' not in source:
+        source.insert_before(r'^#include <libcamera/formats\.h>',
+                             '#include <libcamera/base/utils.h>\n\n', 'formats.h include')
+
+    for old in ('\tvoid yuyvLine(const uint8_t *bgr, uint8_t *dst);\n',
+                '\tvoid nv12Line(const uint8_t *bgr, uint8_t *dst);\n'):
+        if old not in header:
+            raise PatchError('no YUV converter declarations from 20-yuv-output.py')
+        header.text = header.text.replace(old, '')
+    header.insert_after(r'^\tvoid debayerYuv\(uint8_t \*dst, const uint8_t \*src\[\]\);',
+                        H_METHODS, 'debayerYuv() declaration')
+    header.insert_after(r'^\tusing debayerFn = ', H_TYPES, 'debayerFn type')
+    header.insert_after(r'^\tdebayerFn rgbDebayer_\[4\];', H_MEMBERS, 'rgbDebayer_ member')
+
+
+run(apply, MARKER)
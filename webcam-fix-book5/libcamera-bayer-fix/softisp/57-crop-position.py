@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+# 57-crop-position.py — Configurable position of the debayer's crop window.
+#
+# The OV02C10 and OV02E10 send 1928x1092 and the relay asks for 1920x1080.
+# The SoftISP does not scale: it debayers a 1920x1080 window of the sensor
+# frame, starting the source pointer at the window's corner and stepping
+# by the sensor stride, in the same pass that writes the output. Upstream
+# always centres that window.
+#
+# This patch reads an optional "crop" section from the sensor tuning file
+# (the same file the IPA loads) to place the window elsewhere, e.g. to
+# line up the optical centre of a particular module:
+#
+#   crop:
+#     position: [ 0.5, 0.5 ]   # x, y within the spare border (0..1),
+#                              # 0 = left/top, 1 = right/bottom
+#
+# The window still leaves one Bayer pattern of border on each side, which
+# the debayer reads for its neighbour pixels, and stays on the pattern
+# grid. For 1920x1080 from 1928x1092 the window can move 2 pixels left or
+# right and 4 lines up or down from the centre. It also applies to the
+# binned sizes. Without the section the window is centred as upstream.
+
+from patchlib import PatchError, run
+
+MARKER = 'SOFTISP-CROP'
+SWISP = 'src/libcamera/software_isp'
+
+H_PUBLIC = '''	void configureCrop(const std::string &tuningFile);
+'''
+
+H_METHODS = '''	void placeWindow(const Size &inputSize);
+'''
+
+H_MEMBERS = '''	/* Crop window position in the spare border, from the tuning file */
+	bool cropConfigured_ = false;
+	std::array<double, 2> cropPosition_ = { 0.5, 0.5 };
+'''
+
+CPP_FUNCTIONS = '''/**
+ * \\brief Load the crop window position from a tuning file
+ * \\param[in] tuningFile Path of the IPA tuning file
+ *
+ * Reads the optional top level "crop" section. The IPA ignores it, so the
+ * same file works with an unpatched libcamera.
+ */
+void DebayerCpu::configureCrop(const std::string &tuningFile)
+{
+	File file(tuningFile);
+	if (!file.open(File::OpenModeFlag::ReadOnly))
+		return;
+
+	std::unique_ptr<YamlObject> data = YamlParser::parse(file);
+	if (!data || !data->contains("crop"))
+		return;
+
+	std::vector<double> position =
+		(*data)["crop"]["position"].getList<double>().value_or(std::vector<double>{});
+	if (position.size() != 2 || position[0] < 0.0 || position[0] > 1.0 ||
+	    position[1] < 0.0 || position[1] > 1.0) {
+		LOG(Debayer, Warning) << "Ignoring invalid crop position";
+		return;
+	}
+
+	cropPosition_ = { position[0], position[1] };
+	cropConfigured_ = true;
+}
+
+/*
+ * Move the window configure() centred to the configured position, keeping
+ * a pattern of border on each side for the debayer's neighbour reads. A
+ * window without that border (the full frame) stays where it is.
+ */
+void DebayerCpu::placeWindow(const Size &inputSize)
+{
+	const Size &pattern = inputConfig_.patternSize;
+
+	if (!cropConfigured_)
+		return;
+
+	if (inputSize.width >= window_.width + 2 * pattern.width) {
+		const unsigned int spare = inputSize.width - window_.width - 2 * pattern.width;
+
+		window_.x = (pattern.width + static_cast<unsigned int>(spare * cropPosition_[0])) &
+			    ~(pattern.width - 1);
+	}
+	if (inputSize.height >= window_.height + 2 * pattern.height) {
+		const unsigned int spare = inputSize.height - window_.height - 2 * pattern.height;
+
+		window_.y = (pattern.height + static_cast<unsigned int>(spare * cropPosition_[1])) &
+			    ~(pattern.height - 1);
+	}
+
+	LOG(Debayer, Info) << "Crop window " << window_ << " of " << inputSize;
+}
+'''
+
+PLACE = '''	placeWindow(inputCfg.size);
+
+'''
+
+
+def apply(tree):
+    header = tree.file(f'{SWISP}/debayer_cpu.h')
+    source = tree.file(f'{SWISP}/debayer_cpu.cpp')
+    isp = tree.file(f'{SWISP}/software_isp.cpp')
+
+    if 'window_.x = ((inputCfg.size.width - outputCfg.size.width) / 2)' not in source:
+        raise PatchError('configure() no longer centres the window')
+
+    # After configure() (and 50-binned-output.py) sized the window, before
+    # the statistics, line buffers and stripes are set up from it
+    source.insert_before(r'^\t/\* Don\'t pass x,y since process\(\) already adjusts src',
+                         PLACE, 'statistics window setup in configure()')
+    source.insert_before(r'^int DebayerCpu::getInputConfig\(', CPP_FUNCTIONS + '\n',
+                         'getInputConfig() definition')
+
+    source.add_include('memory')
+    source.add_include('vector')
+    if 'libcamera/base/file.h' not in source:
+        if 'libcamera/base/utils.h' in source:
+            source.insert_before(r'^#include <libcamera/base/utils\.h>',
+                                 '#include <libcamera/base/file.h>\n', 'utils.h include')
+        else:
+            source.insert_before(r'^#include <libcamera/formats\.h>',
+                                 '#include <libcamera/base/file.h>\n\n', 'formats.h include')
+    if 'libcamera/internal/yaml_parser.h' not in source:
+        source.insert_after(r'^#include "libcamera/internal/mapped_framebuffer\.h"',
+                            '#include "libcamera/internal/yaml_parser.h"\n',
+                            'mapped_framebuffer.h include')
+
+    header.add_include('array')
+    header.add_include('string')
+    header.insert_after(r'^\tvoid process\(uint32_t frame, ', H_PUBLIC, 'process() declaration')
+    header.insert_after(r'^\tvoid process4\(', H_METHODS, 'process4() declaration')
+    header.insert_after(r'^\tbool swapRedBlueGains_;', H_MEMBERS, 'swapRedBlueGains_ member')
+
+    # The pipeline handler side knows the tuning file before the IPA loads it
+    m = isp.require(r'^\tdebayer_ = std::make_unique<DebayerCpu>\(([^;]*)\);\n',
+                    'DebayerCpu creation')
+    isp.text = (isp.text[:m.start()] +
+                f'\tauto cpuDebayer = std::make_unique<DebayerCpu>({m.group(1)});\n'
+                '\tDebayerCpu *debayerCpu = cpuDebayer.get();\n'
+                '\tdebayer_ = std::move(cpuDebayer);\n' +
+                isp.text[m.end():])
+    isp.insert_after(r'^\tstd::string ipaTuningFile =[^;]*;',
+                     '\tdebayerCpu->configureCrop(ipaTuningFile);\n', 'tuning file lookup')
+
+
+run(apply, MARKER)
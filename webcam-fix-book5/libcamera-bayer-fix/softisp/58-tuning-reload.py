@@ -0,0 +1,268 @@
+#!/usr/bin/env python3
+# 58-tuning-reload.py — Apply tuning file changes without restarting the camera.
+#
+# The simple IPA reads the sensor tuning file (ov02c10.yaml, ov02e10.yaml)
+# once, when the camera is acquired. Trying a different CCM therefore means
+# writing the file and restarting the relay or qcam, a few seconds each.
+#
+# This patch has the IPA watch its tuning file with inotify. When the file
+# is rewritten (cp, tee, or an editor renaming a new file over it) a
+# watcher thread parses and checks it, and the next computeParams() hands
+# each algorithm its new section through its init(), before the
+# algorithms prepare that frame's parameters. Parsing stays off the IPA
+# thread, which only swaps in the parsed file, so the change shows up on
+# the next frame. The Ccm recomputes its matrix right away instead of
+# waiting for a colour temperature change.
+#
+# Only the parameters of the algorithms that are running can change:
+# adding or removing an algorithm (e.g. the Ccm, which also changes the
+# debayer's mode) still needs a camera restart, and the file is ignored
+# with a warning until the list matches again. A file that fails to parse
+# or has an invalid CCM is ignored too, keeping the current parameters.
+# The statistics and crop sections are read by the pipeline handler when
+# the camera starts and are not reloaded.
+
+from patchlib import PatchError, run
+
+MARKER = 'SOFTISP-TUNING-RELOAD'
+IPA = 'src/ipa/simple'
+
+H_METHODS = '''	std::unique_ptr<YamlObject> parseTuningFile();
+	void watchTuningFile(int inotifyFd);
+	void applyTuning();
+'''
+
+H_MEMBERS = '''
+	/* Tuning file reload, see watchTuningFile() */
+	std::string tuningFile_;
+	std::vector<std::string> algorithmNames_;
+	std::thread tuningThread_;
+	int tuningStopFd_ = -1;
+	Mutex tuningMutex_;
+	std::unique_ptr<YamlObject> pendingTuning_ LIBCAMERA_TSA_GUARDED_BY(tuningMutex_);
+	std::atomic<bool> tuningPending_ = false;
+'''
+
+HELPERS = '''/*
+ * The algorithm names of a tuning file, in order. createAlgorithms() creates
+ * them in that order, so the names index algorithms().
+ */
+static std::vector<std::string> algorithmNames(const YamlObject &algorithms)
+{
+	std::vector<std::string> names;
+
+	for (const auto &algo : algorithms.asList())
+		for (const auto &entry : algo.asDict())
+			names.push_back(entry.first);
+
+	return names;
+}
+
+'''
+
+DESTRUCTOR = '''	if (tuningThread_.joinable()) {
+		uint64_t stop = 1;
+		if (write(tuningStopFd_, &stop, sizeof(stop)) < 0)
+			LOG(IPASoft, Error) << "Failed to stop the tuning file watcher";
+		tuningThread_.join();
+	}
+	if (tuningStopFd_ >= 0)
+		close(tuningStopFd_);
+
+'''
+
+INIT = '''
+	tuningFile_ = settings.configurationFile;
+	algorithmNames_ = algorithmNames((*data)["algorithms"]);
+
+	int inotifyFd = inotify_init1(IN_CLOEXEC);
+	tuningStopFd_ = eventfd(0, EFD_CLOEXEC);
+	if (inotifyFd < 0 || tuningStopFd_ < 0 ||
+	    inotify_add_watch(inotifyFd, utils::dirname(tuningFile_).c_str(),
+			      IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		LOG(IPASoft, Warning)
+			<< "Cannot watch " << tuningFile_ << ": " << strerror(errno)
+			<< ", tuning changes need a camera restart";
+		if (inotifyFd >= 0)
+			close(inotifyFd);
+	} else {
+		tuningThread_ = std::thread(&IPASoftSimple::watchTuningFile, this, inotifyFd);
+	}
+'''
+
+COMPUTE = '''	if (tuningPending_.load(std::memory_order_acquire))
+		applyTuning();
+
+'''
+
+FUNCTIONS = '''/*
+ * Parse and check the tuning file after it changed. Runs on the watcher
+ * thread; a file that can't be applied as a whole is rejected here, so that
+ * applyTuning() never leaves an algorithm half configured.
+ */
+std::unique_ptr<YamlObject> IPASoftSimple::parseTuningFile()
+{
+	File file(tuningFile_);
+	if (!file.open(File::OpenModeFlag::ReadOnly))
+		return nullptr;
+
+	std::unique_ptr<YamlObject> data = YamlParser::parse(file);
+	if (!data || !data->contains("algorithms")) {
+		LOG(IPASoft, Warning) << "Ignoring invalid tuning file " << tuningFile_;
+		return nullptr;
+	}
+
+	const YamlObject &algorithms = (*data)["algorithms"];
+	if (algorithmNames(algorithms) != algorithmNames_) {
+		LOG(IPASoft, Warning)
+			<< "The algorithms in " << tuningFile_
+			<< " changed, restart the camera to apply them";
+		return nullptr;
+	}
+
+	for (const auto &algo : algorithms.asList()) {
+		if (!algo.contains("Ccm"))
+			continue;
+
+		Interpolator<Matrix<float, 3, 3>> ccm;
+		if (ccm.readYaml(algo["Ccm"]["ccms"], "ct", "ccm") < 0) {
+			LOG(IPASoft, Warning) << "Ignoring invalid CCM in " << tuningFile_;
+			return nullptr;
+		}
+	}
+
+	return data;
+}
+
+/*
+ * Watch the directory of the tuning file rather than the file itself, so a
+ * file replaced by a rename is seen as well as one rewritten in place.
+ */
+void IPASoftSimple::watchTuningFile(int inotifyFd)
+{
+	const std::string name = utils::basename(tuningFile_.c_str());
+	alignas(struct inotify_event) char buf[4096];
+	struct pollfd fds[2] = {
+		{ inotifyFd, POLLIN, 0 },
+		{ tuningStopFd_, POLLIN, 0 },
+	};
+
+	while (true) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents)
+			break;
+
+		ssize_t len = read(inotifyFd, buf, sizeof(buf));
+		bool changed = false;
+		for (ssize_t pos = 0; pos < len;) {
+			const auto *event = reinterpret_cast<const struct inotify_event *>(buf + pos);
+
+			if (event->len && name == event->name)
+				changed = true;
+			pos += sizeof(*event) + event->len;
+		}
+		if (!changed)
+			continue;
+
+		std::unique_ptr<YamlObject> data = parseTuningFile();
+		if (!data)
+			continue;
+
+		MutexLocker locker(tuningMutex_);
+		pendingTuning_ = std::move(data);
+		tuningPending_.store(true, std::memory_order_release);
+	}
+
+	close(inotifyFd);
+}
+
+/*
+ * Hand the algorithms their sections of the reloaded tuning file. Called at
+ * the start of computeParams(), so a frame is prepared entirely with the old
+ * or entirely with the new parameters.
+ */
+void IPASoftSimple::applyTuning()
+{
+	std::unique_ptr<YamlObject> data;
+	{
+		MutexLocker locker(tuningMutex_);
+		data = std::move(pendingTuning_);
+		tuningPending_.store(false, std::memory_order_relaxed);
+	}
+	if (!data)
+		return;
+
+	const auto &entries = (*data)["algorithms"].asList();
+	auto entry = entries.begin();
+	for (auto const &algo : algorithms()) {
+		for (const auto &[name, params] : (*entry).asDict()) {
+			int ret = algo->init(context_, params);
+			if (ret)
+				LOG(IPASoft, Error)
+					<< "Failed to reload " << name << ": " << ret;
+		}
+		++entry;
+	}
+
+	LOG(IPASoft, Info) << "Reloaded " << tuningFile_;
+}
+
+'''
+
+CCM_RESET = '''	/* Recompute the matrix on the next frame, the tuning may have changed */
+	lastCt_ = 0;
+
+'''
+
+
+def apply(tree):
+    source = tree.file(f'{IPA}/soft_simple.cpp')
+
+    if 'createAlgorithms(context_, (*data)["algorithms"])' not in source:
+        raise PatchError('init() does not create the algorithms from the tuning file')
+
+    source.insert_after(r'^\tvoid updateExposure\(', H_METHODS, 'updateExposure() declaration')
+    source.insert_after(r'^\tstruct IPAContext context_;', H_MEMBERS, 'context_ member')
+    source.insert_before(r'^IPASoftSimple::~IPASoftSimple\(\)', HELPERS, 'destructor')
+    source.prepend_to_function(r'IPASoftSimple::~IPASoftSimple\(\)', DESTRUCTOR)
+
+    # Once the algorithms exist, the watcher can't race their creation
+    source.insert_after(r'^\tint ret = createAlgorithms\(context_, \(\*data\)\["algorithms"\]\);\n'
+                        r'\tif \(ret\)\n\t\treturn ret;', INIT, 'createAlgorithms() call')
+    source.prepend_to_function(r'IPASoftSimple::computeParams\(', COMPUTE)
+    source.insert_before(r'^void IPASoftSimple::computeParams\(', FUNCTIONS,
+                         'computeParams() definition')
+
+    for header in ('atomic', 'errno.h', 'poll.h', 'string', 'string.h', 'sys/eventfd.h',
+                   'sys/inotify.h', 'thread', 'unistd.h', 'vector'):
+        source.add_include(header)
+    source.insert_after(r'^#include <libcamera/base/log\.h>',
+                        '#include <libcamera/base/mutex.h>\n', 'log.h include')
+    if 'libcamera/base/utils.h' not in source:
+        source.insert_after(r'^#include <libcamera/base/shared_fd\.h>',
+                            '#include <libcamera/base/utils.h>\n', 'shared_fd.h include')
+    if 'libcamera/internal/matrix.h' not in source:
+        source.insert_before(r'^#include "libcamera/internal/software_isp/debayer_params\.h"',
+                             '#include "libcamera/internal/matrix.h"\n',
+                             'debayer_params.h include')
+    source.insert_after(r'^#include "libipa/camera_sensor_helper\.h"',
+                        '#include "libipa/interpolator.h"\n', 'camera_sensor_helper.h include')
+
+    # The Ccm keeps its matrix until the colour temperature moves; make a
+    # reload count as a change. Versions without that shortcut need nothing.
+    ccm_h = tree.file(f'{IPA}/algorithms/ccm.h')
+    if 'lastCt_' in ccm_h:
+        ccm = tree.file(f'{IPA}/algorithms/ccm.cpp')
+        start, _, end = ccm.function(r'Ccm::init\(')
+        last_return = ccm.text.rfind('\n\treturn 0;\n}', start, end)
+        if last_return < 0:
+            raise PatchError('Ccm::init() does not end with return 0')
+        pos = last_return + 1
+        ccm.text = ccm.text[:pos] + CCM_RESET + ccm.text[pos:]
+
+
+run(apply, MARKER)
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+# 60-softisp-bench.py — softisp-bench, a microbenchmark for the CPU debayer.
+#
+# Changes to the debayer, CCM or statistics code are hard to judge from the
+# camera: end-to-end fps is capped by the sensor and noisy, and it needs the
+# hardware. This patch adds a small tool to the libcamera tree that runs the
+# SoftISP statistics and debayer on raw frames recorded to disk:
+#
+#   softisp-bench [options] ov02c10.yaml frames.raw ...
+#
+# The colour parameters come from the tuning file like in the simple IPA
+# (Ccm at a given colour temperature, black level, gamma, grey-world AWB on
+# the first frame). It prints ns/frame, fps and Mpix/s for the statistics
+# alone, the full debayer and the debayer with new parameters on every
+# frame, for each thread count, and an FNV-1a checksum of the output frames
+# and statistics. The checksum must match across thread counts, and --expect
+# compares it with a known good value. For YUYV/NV12 output the bench also
+# times the generic converters against the fixed-size ones from
+# 55-fixed-size-kernels.py, which must give the same checksum.
+#
+# The tool links against the internal libcamera classes of the tree it is
+# built in, so it is not built by default: build-patched-libcamera.sh builds
+# it after the library and installs it as /usr/local/bin/softisp-bench.
+
+from patchlib import NotApplicable, run
+
+MARKER = 'SOFTISP-BENCH'
+SWISP = 'src/libcamera/software_isp'
+BENCH = 'src/apps/softisp-bench'
+
+MESON = '''# SPDX-License-Identifier: CC0-1.0
+
+softisp_bench_sources = files([
+    'softisp_bench.cpp',
+])
+
+softisp_bench = executable('softisp-bench', softisp_bench_sources,
+                           cpp_args : [@ARGS@],
+                           include_directories : include_directories('../../libcamera/software_isp'),
+                           dependencies : [libcamera_private],
+                           build_by_default : false,
+                           install : false)
+'''
+
+
+def apply(tree):
+    debayer = tree.file(f'{SWISP}/debayer_cpu.h')
+    stats = tree.file(f'{SWISP}/swstats_cpu.h',
+                      'include/libcamera/internal/software_isp/swstats_cpu.h')
+    apps = tree.file('src/apps/meson.build')
+
+    # The bench drives these directly, check them like the compiler would
+    for needle, what in (
+            ('DebayerCpu(std::unique_ptr<SwStatsCpu> stats);', 'DebayerCpu constructor'),
+            ('bool ccmEnabled);', 'configure() with CCM'),
+            ('void process(uint32_t frame, FrameBuffer *input, FrameBuffer *output, DebayerParams params);',
+             'process() signature'),
+            ('DebayerParams::CcmLookupTable', 'CCM lookup tables')):
+        if needle not in debayer:
+            raise NotApplicable(f'unexpected {what}')
+    if not tree.exists('include/libcamera/internal/dma_buf_allocator.h'):
+        raise NotApplicable('no DmaBufAllocator')
+    if 'bool valid;' not in tree.file('include/libcamera/internal/software_isp/swisp_stats.h'):
+        raise NotApplicable('no valid flag in SwIspStats')
+    if not stats.search(r'^\tvoid processLine0\((uint32_t frame, )?unsigned int y, const uint8_t \*src\[\]\)'):
+        raise NotApplicable('unexpected processLine0() signature')
+
+    args = []
+    if stats.search(r'^\tvoid startFrame\(uint32_t frame\);'):
+        args.append('-DSOFTISP_BENCH_STATS_FRAME')
+    applied = tree.applied()
+    if 'SOFTISP-STRIPES' in applied:
+        args.append('-DSOFTISP_BENCH_THREADS')
+    if 'SOFTISP-STATS-SAMPLING' in applied:
+        args.append('-DSOFTISP_BENCH_SAMPLING')
+    if 'SOFTISP-FIXED-KERNELS' in applied:
+        args.append('-DSOFTISP_BENCH_KERNELS')
+    if 'SOFTISP-CROP' in applied:
+        args.append('-DSOFTISP_BENCH_CROP')
+
+    apps.text = apps.text.rstrip('\n') + "\n\nsubdir('softisp-bench')\n"
+    tree.add_file('softisp_bench.cpp', BENCH)
+    tree.add_text(f'{BENCH}/meson.build',
+                  MESON.replace('@ARGS@', ', '.join(f"'{a}'" for a in args)))
+
+
+run(apply, MARKER)
@@ -0,0 +1,268 @@
+#!/usr/bin/env python3
+# patchlib.py — Shared helpers for the SoftISP performance patches.
+#
+# Each NN-*.py script in this directory patches one feature into a libcamera
+# source tree. Like apply_patch_sed() in build-patched-libcamera.sh, the
+# patches anchor on code structure with regexes instead of using .patch files,
+# so they survive small upstream changes between libcamera releases.
+#
+# All edits are staged in memory and only written once a script has finished
+# without errors, so a patch that fails half-way leaves the tree untouched.
+# The original of every touched file is saved under .softisp-orig/ in the
+# source tree, which lets the build script revert all SoftISP patches and
+# retry with just the bayer fix if the patched tree does not compile.
+#
+# Exit codes:
+#   0  patch applied (or already present)
+#   3  patch not applicable to this libcamera version (skipped)
+#   1  unexpected source structure (nothing written)
+#
+# Usage from a patch script:
+#   from patchlib import Tree, NotApplicable, PatchError, run
+#   def apply(tree): ...
+#   run(apply, marker='SOFTISP-XYZ')
+#
+# Revert everything: python3 patchlib.py --revert <libcamera-src>
+
+import os
+import re
+import shutil
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ORIG_DIR = '.softisp-orig'
+APPLIED_FILE = os.path.join(ORIG_DIR, 'APPLIED')
+NEW_FILES = os.path.join(ORIG_DIR, 'NEW')
+
+
+class PatchError(Exception):
+    """The source does not look like we expected — refuse to patch."""
+
+
+class NotApplicable(Exception):
+    """The feature cannot be added to this libcamera version."""
+
+
+class Source:
+    def __init__(self, tree, rel):
+        self.tree = tree
+        self.rel = rel
+        path = os.path.join(tree.root, rel)
+        with open(path, 'r') as f:
+            self.text = f.read()
+        self.orig = self.text
+
+    def __contains__(self, needle):
+        return needle in self.text
+
+    def search(self, pattern, flags=re.MULTILINE):
+        return re.search(pattern, self.text, flags)
+
+    def require(self, pattern, what, flags=re.MULTILINE):
+        m = self.search(pattern, flags)
+        if not m:
+            raise PatchError(f'{self.rel}: could not find {what}')
+        return m
+
+    def sub(self, pattern, repl, what, count=1, flags=re.MULTILINE):
+        """Regex replace; fail if the anchor is missing."""
+        new, n = re.subn(pattern, repl, self.text, count=count, flags=flags)
+        if n == 0:
+            raise PatchError(f'{self.rel}: could not find {what}')
+        self.text = new
+        return n
+
+    def insert_after(self, pattern, text, what, flags=re.MULTILINE):
+        """Insert text after the line containing the first match."""
+        m = self.require(pattern, what, flags)
+        pos = self.text.find('\n', m.end())
+        pos = len(self.text) if pos < 0 else pos + 1
+        self.text = self.text[:pos] + text + self.text[pos:]
+
+    def insert_before(self, pattern, text, what, flags=re.MULTILINE):
+        """Insert text before the line containing the first match."""
+        m = self.require(pattern, what, flags)
+        pos = self.text.rfind('\n', 0, m.start()) + 1
+        self.text = self.text[:pos] + text + self.text[pos:]
+
+    def add_include(self, header):
+        """Add #include <header> to the standard library include block."""
+        line = f'#include <{header}>\n'
+        if line in self.text:
+            return
+        block = None
+        for m in re.finditer(r'^#include <([^>]+)>\n', self.text, re.MULTILINE):
+            if m.group(1).startswith(('libcamera/', 'linux/')):
+                if block:
+                    break
+                continue
+            if block and m.start() != block[-1].end():
+                break
+            block = (block or []) + [m]
+        if not block:
+            # Start a new block ahead of the libcamera includes
+            m = re.search(r'^#include <libcamera/', self.text, re.MULTILINE)
+            if not m:
+                raise PatchError(f'{self.rel}: no #include block for <{header}>')
+            self.text = self.text[:m.start()] + line + '\n' + self.text[m.start():]
+            return
+        pos = block[-1].end()
+        for m in block:
+            if m.group(1) > header:
+                pos = m.start()
+                break
+        self.text = self.text[:pos] + line + self.text[pos:]
+
+    def function(self, signature):
+        """Locate a column-0 function definition.
+
+        Returns (start, body_start, end): start of the signature line, the
+        position just after the opening brace, and the position after the
+        closing column-0 brace.
+        """
+        m = self.require(r'^[^\n]*' + signature, f'function {signature}')
+        open_brace = self.text.find('\n{\n', m.start())
+        if open_brace < 0:
+            raise PatchError(f'{self.rel}: no body for {signature}')
+        close = self.text.find('\n}\n', open_brace)
+        if close < 0:
+            raise PatchError(f'{self.rel}: unterminated {signature}')
+        return m.start(), open_brace + 3, close + 3
+
+    def function_text(self, signature):
+        start, _, end = self.function(signature)
+        return self.text[start:end]
+
+    def prepend_to_function(self, signature, text):
+        _, body, _ = self.function(signature)
+        self.text = self.text[:body] + text + self.text[body:]
+
+    def insert_after_function(self, signature, text):
+        _, _, end = self.function(signature)
+        self.text = self.text[:end] + '\n' + text + self.text[end:]
+
+
+class Tree:
+    def __init__(self, root):
+        self.root = os.path.abspath(root)
+        self.files = {}
+        self.new_files = []
+
+    def exists(self, rel):
+        return os.path.exists(os.path.join(self.root, rel))
+
+    def file(self, *candidates):
+        """Open the first existing path from candidates."""
+        for rel in candidates:
+            if rel in self.files:
+                return self.files[rel]
+            if self.exists(rel):
+                self.files[rel] = Source(self, rel)
+                return self.files[rel]
+        raise NotApplicable('missing ' + ' or '.join(candidates))
+
+    def add_file(self, name, rel_dir):
+        """Copy softisp/src/<name> into the tree."""
+        with open(os.path.join(HERE, 'src', name)) as f:
+            self.add_text(os.path.join(rel_dir, name), f.read())
+
+    def add_text(self, rel, text):
+        """Create a new file in the tree, e.g. a generated meson.build."""
+        self.new_files.append((rel, text))
+
+    def applied(self):
+        path = os.path.join(self.root, APPLIED_FILE)
+        if not os.path.exists(path):
+            return set()
+        with open(path) as f:
+            return set(line.strip() for line in f if line.strip())
+
+    def require_applied(self, marker):
+        if marker not in self.applied():
+            raise NotApplicable(f'needs the {marker} patch')
+
+    def commit(self, marker):
+        orig_root = os.path.join(self.root, ORIG_DIR)
+        os.makedirs(orig_root, exist_ok=True)
+
+        for rel, src in self.files.items():
+            if src.text == src.orig:
+                continue
+            backup = os.path.join(orig_root, rel)
+            if not os.path.exists(backup):
+                os.makedirs(os.path.dirname(backup), exist_ok=True)
+                with open(backup, 'w') as f:
+                    f.write(src.orig)
+            with open(os.path.join(self.root, rel), 'w') as f:
+                f.write(src.text)
+
+        with open(os.path.join(self.root, NEW_FILES), 'a') as new:
+            for rel, text in self.new_files:
+                path = os.path.join(self.root, rel)
+                os.makedirs(os.path.dirname(path), exist_ok=True)
+                with open(path, 'w') as f:
+                    f.write(text)
+                new.write(rel + '\n')
+
+        with open(os.path.join(self.root, APPLIED_FILE), 'a') as f:
+            f.write(marker + '\n')
+
+
+def revert(root):
+    orig_root = os.path.join(root, ORIG_DIR)
+    if not os.path.isdir(orig_root):
+        return
+    new_list = os.path.join(root, NEW_FILES)
+    if os.path.exists(new_list):
+        with open(new_list) as f:
+            for rel in f:
+                path = os.path.join(root, rel.strip())
+                if rel.strip() and os.path.exists(path):
+                    os.remove(path)
+                    try:
+                        os.removedirs(os.path.dirname(path))
+                    except OSError:
+                        pass
+    for dirpath, _, names in os.walk(orig_root):
+        for name in names:
+            backup = os.path.join(dirpath, name)
+            rel = os.path.relpath(backup, orig_root)
+            if rel in ('APPLIED', 'NEW'):
+                continue
+            shutil.copyfile(backup, os.path.join(root, rel))
+    shutil.rmtree(orig_root)
+
+
+def run(apply, marker):
+    if len(sys.argv) != 2:
+        print(f'usage: {sys.argv[0]} <libcamera-src>', file=sys.stderr)
+        sys.exit(1)
+
+    tree = Tree(sys.argv[1])
+    if marker in tree.applied():
+        print(f'{marker}: already applied')
+        sys.exit(0)
+
+    try:
+        apply(tree)
+    except NotApplicable as e:
+        print(f'{marker}: skipped ({e})')
+        sys.exit(3)
+    except PatchError as e:
+        print(f'ERROR: {marker}: {e}', file=sys.stderr)
+        sys.exit(1)
+
+    tree.commit(marker)
+    for rel, src in tree.files.items():
+        if src.text != src.orig:
+            print(f'{marker}: patched {rel}')
+    for rel, _ in tree.new_files:
+        print(f'{marker}: added {rel}')
+
+
+if __name__ == '__main__':
+    if len(sys.argv) == 3 and sys.argv[1] == '--revert':
+        revert(os.path.abspath(sys.argv[2]))
+        sys.exit(0)
+    print(f'usage: {sys.argv[0]} --revert <libcamera-src>', file=sys.stderr)
+    sys.exit(1)
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Persistent worker threads for the stripe-parallel CPU debayer
+ */
+
+#include "debayer_worker_pool.h"
+
+namespace libcamera {
+
+/**
+ * \class DebayerWorkerPool
+ * \brief Fixed set of threads that run the stripes of one frame
+ *
+ * The threads are created once and sleep between frames, so a frame costs
+ * one wake-up per worker instead of a thread creation. The calling thread
+ * takes stripes as well, a pool of N workers therefore gives N + 1 way
+ * parallelism.
+ */
+
+DebayerWorkerPool::DebayerWorkerPool(unsigned int workers)
+	: job_(nullptr), count_(0), generation_(0), busy_(0), stop_(false),
+	  next_(0)
+{
+	for (unsigned int i = 0; i < workers; i++)
+		threads_.emplace_back(&DebayerWorkerPool::worker, this);
+}
+
+DebayerWorkerPool::~DebayerWorkerPool()
+{
+	{
+		MutexLocker locker(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_all();
+
+	for (std::thread &thread : threads_)
+		thread.join();
+}
+
+/**
+ * \brief Run \a job for indices 0 to \a count - 1 and wait for completion
+ */
+void DebayerWorkerPool::run(unsigned int count, const Job &job)
+{
+	{
+		MutexLocker locker(mutex_);
+		job_ = &job;
+		count_ = count;
+		next_.store(0, std::memory_order_relaxed);
+		generation_++;
+	}
+	wake_.notify_all();
+
+	drain(job, count);
+
+	/*
+	 * All indices have been claimed once drain() returns. Wait for the
+	 * workers still running theirs and retire the job before they can
+	 * pick it up again.
+	 */
+	MutexLocker locker(mutex_);
+	idle_.wait(locker, [&]() LIBCAMERA_TSA_REQUIRES(mutex_) {
+		return busy_ == 0;
+	});
+	job_ = nullptr;
+}
+
+void DebayerWorkerPool::drain(const Job &job, unsigned int count)
+{
+	unsigned int index;
+
+	while ((index = next_.fetch_add(1, std::memory_order_relaxed)) < count)
+		job(index);
+}
+
+void DebayerWorkerPool::worker()
+{
+	uint64_t seen = 0;
+
+	while (true) {
+		const Job *job;
+		unsigned int count;
+
+		{
+			MutexLocker locker(mutex_);
+			wake_.wait(locker, [&]() LIBCAMERA_TSA_REQUIRES(mutex_) {
+				return stop_ || (job_ && generation_ != seen);
+			});
+			if (stop_)
+				return;
+
+			seen = generation_;
+			job = job_;
+			count = count_;
+			busy_++;
+		}
+
+		drain(*job, count);
+
+		{
+			MutexLocker locker(mutex_);
+			busy_--;
+		}
+		idle_.notify_one();
+	}
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Persistent worker threads for the stripe-parallel CPU debayer
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/mutex.h>
+
+namespace libcamera {
+
+class DebayerWorkerPool
+{
+public:
+	using Job = std::function<void(unsigned int index)>;
+
+	DebayerWorkerPool(unsigned int workers);
+	~DebayerWorkerPool();
+
+	unsigned int size() const { return threads_.size(); }
+
+	void run(unsigned int count, const Job &job);
+
+private:
+	void worker();
+	void drain(const Job &job, unsigned int count);
+
+	std::vector<std::thread> threads_;
+
+	Mutex mutex_;
+	ConditionVariable wake_;
+	ConditionVariable idle_;
+
+	const Job *job_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	unsigned int count_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	uint64_t generation_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	unsigned int busy_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+	bool stop_ LIBCAMERA_TSA_GUARDED_BY(mutex_);
+
+	std::atomic<unsigned int> next_;
+};
+
+} /* namespace libcamera */
@@ -0,0 +1,1011 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * SoftISP microbenchmark over recorded raw Bayer frames
+ *
+ * Runs the statistics and the CPU debayer of the (patched) SoftISP on raw
+ * frames loaded from disk, with the colour parameters the simple IPA derives
+ * from a tuning file, and reports the time per frame of each stage for a
+ * range of debayer thread counts. A checksum of the output frames catches
+ * changes that are not supposed to alter the image. For YUV output, the
+ * fixed-size converters are also timed against the generic ones.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <errno.h>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/shared_fd.h>
+#include <libcamera/base/unique_fd.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/logging.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/bayer_format.h"
+#include "libcamera/internal/dma_buf_allocator.h"
+#include "libcamera/internal/software_isp/swisp_stats.h"
+#include "libcamera/internal/yaml_parser.h"
+
+#include "debayer_cpu.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Same sizes as the simple IPA's gamma table and default gamma (v0.5 Lut) */
+constexpr unsigned int kGammaTableSize = 1024;
+constexpr double kDefaultGamma = 0.5;
+
+/* Frames processed before timing starts, to fault in buffers and tables */
+constexpr unsigned int kWarmupFrames = 4;
+
+/* Frames generated when no recordings are given */
+constexpr unsigned int kSyntheticFrames = 8;
+
+struct BenchOptions {
+	std::string tuningFile;
+	std::vector<std::string> frameFiles;
+
+	PixelFormat inputFormat = formats::SGRBG10;
+	Size inputSize{ 1928, 1092 };
+	unsigned int inputStride = 0;
+	PixelFormat outputFormat = formats::RGB888;
+	Size outputSize;
+
+	unsigned int iterations = 100;
+	std::vector<unsigned int> threads;
+	unsigned int colourTemperature = 5000;
+	std::optional<unsigned int> blackLevel;
+	std::optional<std::array<double, 2>> gains;
+	std::optional<uint64_t> expect;
+};
+
+struct Tuning {
+	bool ccmEnabled = false;
+	std::array<double, 9> ccm = { 1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 };
+	unsigned int blackLevel = 0;
+	double gamma = kDefaultGamma;
+};
+
+struct Measurement {
+	std::string stage;
+	unsigned int threads;
+	uint64_t mean;
+	uint64_t median;
+	uint64_t min;
+	uint64_t cpu;
+};
+
+uint64_t clockNs(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/* FNV-1a, 64 bit */
+class Checksum
+{
+public:
+	void add(const void *data, size_t size)
+	{
+		const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+		for (size_t i = 0; i < size; i++) {
+			hash_ ^= bytes[i];
+			hash_ *= 0x100000001b3ULL;
+		}
+	}
+
+	uint64_t value() const { return hash_; }
+
+private:
+	uint64_t hash_ = 0xcbf29ce484222325ULL;
+};
+
+std::string hex(uint64_t value)
+{
+	std::ostringstream ss;
+
+	ss << std::hex << std::setw(16) << std::setfill('0') << value;
+	return ss.str();
+}
+
+/*
+ * A FrameBuffer backed by a DMA-BUF when a heap or udmabuf is accessible, as
+ * the SoftISP allocates them, or by a memfd otherwise.
+ */
+class BenchBuffer
+{
+public:
+	~BenchBuffer()
+	{
+		if (data_)
+			munmap(data_, size_);
+	}
+
+	int allocate(DmaBufAllocator &allocator, size_t size)
+	{
+		const size_t pageSize = sysconf(_SC_PAGESIZE);
+		UniqueFD fd;
+
+		size_ = (size + pageSize - 1) / pageSize * pageSize;
+
+		if (allocator.isValid()) {
+			fd = allocator.alloc("softisp-bench", size_);
+		} else {
+			fd = UniqueFD(memfd_create("softisp-bench", MFD_CLOEXEC));
+			if (fd.isValid() && ftruncate(fd.get(), size_) < 0)
+				fd.reset();
+		}
+		if (!fd.isValid())
+			return -ENOMEM;
+
+		void *data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+		if (data == MAP_FAILED)
+			return -errno;
+		data_ = static_cast<uint8_t *>(data);
+
+		FrameBuffer::Plane plane;
+		plane.fd = SharedFD(std::move(fd));
+		plane.offset = 0;
+		plane.length = size;
+		buffer_ = std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane });
+
+		return 0;
+	}
+
+	FrameBuffer *get() { return buffer_.get(); }
+	uint8_t *data() { return data_; }
+
+private:
+	std::unique_ptr<FrameBuffer> buffer_;
+	uint8_t *data_ = nullptr;
+	size_t size_ = 0;
+};
+
+/* The statistics API gained frame numbers after v0.5 */
+void statsStartFrame([[maybe_unused]] SwStatsCpu &stats, [[maybe_unused]] uint32_t frame)
+{
+#ifdef SOFTISP_BENCH_SAMPLING
+	stats.selectFrame(frame);
+#endif
+#ifdef SOFTISP_BENCH_STATS_FRAME
+	stats.startFrame(frame);
+#else
+	stats.startFrame();
+#endif
+}
+
+void statsLine([[maybe_unused]] SwStatsCpu &stats, [[maybe_unused]] uint32_t frame,
+	       unsigned int y, const uint8_t *lines[])
+{
+#ifdef SOFTISP_BENCH_STATS_FRAME
+	stats.processLine0(frame, y, lines);
+#else
+	stats.processLine0(y, lines);
+#endif
+}
+
+std::unique_ptr<SwStatsCpu> createStats([[maybe_unused]] const std::string &tuningFile)
+{
+	auto stats = std::make_unique<SwStatsCpu>();
+
+#ifdef SOFTISP_BENCH_SAMPLING
+	stats->configureSampling(tuningFile);
+#endif
+	return stats;
+}
+
+/*
+ * Take the Ccm (interpolated to the colour temperature), black level and
+ * gamma from the tuning file the way the simple IPA does on its first frame.
+ */
+int loadTuning(const BenchOptions &options, Tuning &tuning)
+{
+	File file(options.tuningFile);
+	if (!file.open(File::OpenModeFlag::ReadOnly)) {
+		std::cerr << "Failed to open " << options.tuningFile << ": "
+			  << strerror(-file.error()) << std::endl;
+		return -ENOENT;
+	}
+
+	std::unique_ptr<YamlObject> data = YamlParser::parse(file);
+	if (!data || !data->contains("algorithms")) {
+		std::cerr << "Failed to parse " << options.tuningFile << std::endl;
+		return -EINVAL;
+	}
+
+	for (const YamlObject &algorithm : (*data)["algorithms"].asList()) {
+		for (const auto &[name, params] : algorithm.asDict()) {
+			if (name == "BlackLevel") {
+				/* 16-bit value, like the sensor helpers */
+				std::optional<uint32_t> level = params["blackLevel"].get<uint32_t>();
+				if (level)
+					tuning.blackLevel = *level >> 8;
+			} else if (name == "Ccm") {
+				std::vector<std::pair<unsigned int, std::vector<double>>> ccms;
+
+				for (const YamlObject &entry : params["ccms"].asList()) {
+					std::optional<uint32_t> ct = entry["ct"].get<uint32_t>();
+					std::optional<std::vector<double>> ccm =
+						entry["ccm"].getList<double>();
+					if (!ct || !ccm || ccm->size() != 9) {
+						std::cerr << "Invalid Ccm entry in "
+							  << options.tuningFile << std::endl;
+						return -EINVAL;
+					}
+					ccms.emplace_back(*ct, *ccm);
+				}
+				if (ccms.empty())
+					continue;
+
+				std::sort(ccms.begin(), ccms.end());
+
+				const unsigned int ct = std::clamp(options.colourTemperature,
+								   ccms.front().first, ccms.back().first);
+				auto hi = std::lower_bound(ccms.begin(), ccms.end(), ct,
+							   [](const auto &entry, unsigned int value) {
+								   return entry.first < value;
+							   });
+				auto lo = hi == ccms.begin() ? hi : hi - 1;
+				const double f = hi->first == lo->first
+							 ? 1.0
+							 : static_cast<double>(ct - lo->first) /
+								   (hi->first - lo->first);
+
+				for (unsigned int i = 0; i < 9; i++)
+					tuning.ccm[i] = lo->second[i] * (1.0 - f) + hi->second[i] * f;
+				tuning.ccmEnabled = true;
+			}
+		}
+	}
+
+	if (options.blackLevel)
+		tuning.blackLevel = *options.blackLevel;
+
+	return 0;
+}
+
+/*
+ * Build the debayer parameters like the simple IPA's Lut algorithm: a gamma
+ * table over the range above the black level, and either per-colour gain
+ * tables or the CCM columns scaled by the AWB gains.
+ */
+DebayerParams makeParams(const Tuning &tuning, const std::array<double, 3> &gains)
+{
+	std::array<uint8_t, kGammaTableSize> gammaTable;
+	const unsigned int blackIndex = tuning.blackLevel * kGammaTableSize / 256;
+	const double divisor = kGammaTableSize - blackIndex - 1.0;
+	const unsigned int div = kGammaTableSize / DebayerParams::kRGBLookupSize;
+	DebayerParams params;
+
+	std::fill(gammaTable.begin(), gammaTable.begin() + blackIndex, 0);
+	for (unsigned int i = blackIndex; i < kGammaTableSize; i++)
+		gammaTable[i] = UINT8_MAX * std::pow((i - blackIndex) / divisor, tuning.gamma);
+
+	for (unsigned int i = 0; i < DebayerParams::kRGBLookupSize; i++) {
+		if (!tuning.ccmEnabled) {
+			auto lookup = [&](double gain) {
+				return gammaTable[std::min<unsigned int>(gain * i * div,
+									 kGammaTableSize - 1)];
+			};
+
+			params.red[i] = lookup(gains[0]);
+			params.green[i] = lookup(gains[1]);
+			params.blue[i] = lookup(gains[2]);
+			continue;
+		}
+
+		/* Row r of the CCM is scaled by gain r, column c feeds input colour c */
+		const std::array<double, 9> &m = tuning.ccm;
+		auto column = [&](unsigned int c) {
+			DebayerParams::CcmColumn column;
+
+			column.r = std::round(i * gains[0] * m[c]);
+			column.g = std::round(i * gains[1] * m[3 + c]);
+			column.b = std::round(i * gains[2] * m[6 + c]);
+			return column;
+		};
+
+		params.redCcm[i] = column(0);
+		params.greenCcm[i] = column(1);
+		params.blueCcm[i] = column(2);
+		params.gammaLut[i] = gammaTable[i * div];
+	}
+
+	return params;
+}
+
+/* Grey world on the statistics, as the simple IPA's Awb */
+std::array<double, 3> greyWorldGains(const SwIspStats &stats)
+{
+	auto gain = [&](uint64_t sum) {
+		if (!sum)
+			return 1.0;
+		return std::clamp(static_cast<double>(stats.sumG_) / sum, 0.25, 4.0);
+	};
+
+	return { gain(stats.sumR_), 1.0, gain(stats.sumB_) };
+}
+
+/* The statistics the IPA would use, i.e. of the collected frames */
+void addStats(Checksum &checksum, const SwIspStats &stats)
+{
+	checksum.add(&stats.sumR_, sizeof(stats.sumR_));
+	checksum.add(&stats.sumG_, sizeof(stats.sumG_));
+	checksum.add(&stats.sumB_, sizeof(stats.sumB_));
+	checksum.add(stats.yHistogram.data(),
+		     stats.yHistogram.size() * sizeof(stats.yHistogram[0]));
+}
+
+/*
+ * Run fn(i) for iterations frames and take the wall and CPU time per frame.
+ * The mean includes the frames that skip the statistics, the median and
+ * minimum show the spread.
+ */
+template<typename Fn>
+Measurement measure(const std::string &stage, unsigned int threads,
+		    unsigned int iterations, Fn fn)
+{
+	std::vector<uint64_t> times;
+	uint64_t total = 0;
+
+	for (unsigned int i = 0; i < kWarmupFrames; i++)
+		fn(i);
+
+	times.reserve(iterations);
+	const uint64_t cpuStart = clockNs(CLOCK_PROCESS_CPUTIME_ID);
+	for (unsigned int i = 0; i < iterations; i++) {
+		const uint64_t start = clockNs(CLOCK_MONOTONIC);
+
+		fn(kWarmupFrames + i);
+		times.push_back(clockNs(CLOCK_MONOTONIC) - start);
+		total += times.back();
+	}
+	const uint64_t cpu = (clockNs(CLOCK_PROCESS_CPUTIME_ID) - cpuStart) / iterations;
+
+	std::sort(times.begin(), times.end());
+	return { stage, threads, total / iterations, times[times.size() / 2], times.front(), cpu };
+}
+
+class Bench
+{
+public:
+	Bench(const BenchOptions &options)
+		: options_(options),
+		  allocator_(DmaBufAllocator::DmaBufAllocatorFlag::CmaHeap |
+			     DmaBufAllocator::DmaBufAllocatorFlag::SystemHeap |
+			     DmaBufAllocator::DmaBufAllocatorFlag::UDmaBuf)
+	{
+	}
+
+	int run();
+
+private:
+	int configureInput();
+	int loadFrames();
+	int configureDebayer(DebayerCpu &debayer, StreamConfiguration &outputCfg);
+	Measurement runStats();
+	int runDebayer(unsigned int threads, uint64_t &checksum, bool generic = false);
+	void report() const;
+
+	const BenchOptions &options_;
+	Tuning tuning_;
+
+	DmaBufAllocator allocator_;
+	StreamConfiguration inputCfg_;
+	unsigned int lineBytes_;
+	size_t frameBytes_;
+	std::vector<std::unique_ptr<BenchBuffer>> frames_;
+	BenchBuffer output_;
+	Size outputSize_;
+
+	DebayerParams params_;
+	DebayerParams altParams_;
+	std::vector<Measurement> results_;
+};
+
+int Bench::configureInput()
+{
+	const BayerFormat bayer = BayerFormat::fromPixelFormat(options_.inputFormat);
+	if (!bayer.isValid()) {
+		std::cerr << options_.inputFormat << " is not a Bayer format" << std::endl;
+		return -EINVAL;
+	}
+
+	const unsigned int width = options_.inputSize.width;
+	if (bayer.packing == BayerFormat::Packing::None)
+		lineBytes_ = width * (bayer.bitDepth > 8 ? 2 : 1);
+	else
+		lineBytes_ = width * bayer.bitDepth / 8;
+
+	const unsigned int stride = options_.inputStride ? options_.inputStride : lineBytes_;
+	if (stride < lineBytes_) {
+		std::cerr << "Stride " << stride << " is too small, need at least "
+			  << lineBytes_ << std::endl;
+		return -EINVAL;
+	}
+
+	inputCfg_.pixelFormat = options_.inputFormat;
+	inputCfg_.size = options_.inputSize;
+	inputCfg_.stride = stride;
+	frameBytes_ = static_cast<size_t>(stride) * options_.inputSize.height;
+
+	return 0;
+}
+
+/*
+ * Each file holds one or more frames back to back. Without files, a fixed
+ * pseudo-random pattern over a colour gradient gives repeatable checksums.
+ */
+int Bench::loadFrames()
+{
+	const BayerFormat bayer = BayerFormat::fromPixelFormat(options_.inputFormat);
+
+	/* The SoftISP indexes tables with the pixel values, don't feed it garbage */
+	auto checkRange = [&](const uint8_t *data) {
+		if (bayer.packing != BayerFormat::Packing::None || bayer.bitDepth <= 8)
+			return true;
+
+		for (unsigned int y = 0; y < inputCfg_.size.height; y++) {
+			const uint16_t *line =
+				reinterpret_cast<const uint16_t *>(data + y * inputCfg_.stride);
+
+			for (unsigned int x = 0; x < inputCfg_.size.width; x++) {
+				if (line[x] >> bayer.bitDepth)
+					return false;
+			}
+		}
+		return true;
+	};
+
+	auto newFrame = [&]() -> uint8_t * {
+		auto buffer = std::make_unique<BenchBuffer>();
+		if (buffer->allocate(allocator_, frameBytes_) < 0)
+			return nullptr;
+		frames_.push_back(std::move(buffer));
+		return frames_.back()->data();
+	};
+
+	for (const std::string &path : options_.frameFiles) {
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file) {
+			std::cerr << "Failed to open " << path << std::endl;
+			return -ENOENT;
+		}
+
+		const size_t size = file.tellg();
+		if (!size || size % frameBytes_) {
+			std::cerr << path << ": " << size << " bytes is not a multiple of the "
+				  << frameBytes_ << " byte frame size (check -s and -S)" << std::endl;
+			return -EINVAL;
+		}
+
+		file.seekg(0);
+		for (size_t offset = 0; offset < size; offset += frameBytes_) {
+			uint8_t *data = newFrame();
+			if (!data || !file.read(reinterpret_cast<char *>(data), frameBytes_)) {
+				std::cerr << "Failed to load " << path << std::endl;
+				return -EIO;
+			}
+
+			if (!checkRange(data)) {
+				std::cerr << path << ": pixel values above " << bayer.bitDepth
+					  << " bits, wrong format? (check -f)" << std::endl;
+				return -EINVAL;
+			}
+		}
+	}
+
+	if (!frames_.empty())
+		return 0;
+
+	const unsigned int maxValue = (1U << bayer.bitDepth) - 1;
+	const unsigned int width = options_.inputSize.width;
+	const unsigned int height = options_.inputSize.height;
+	uint32_t seed = 1;
+
+	for (unsigned int n = 0; n < kSyntheticFrames; n++) {
+		uint8_t *data = newFrame();
+		if (!data)
+			return -ENOMEM;
+
+		for (unsigned int y = 0; y < height; y++) {
+			uint8_t *line = data + y * inputCfg_.stride;
+
+			for (unsigned int x = 0; x < width; x++) {
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+
+				unsigned int value = (x + n * 16) * maxValue / (2 * width) +
+						     y * maxValue / (4 * height) +
+						     (seed & (maxValue >> 3));
+				value = std::min(value, maxValue);
+
+				if (bayer.bitDepth > 8 && bayer.packing == BayerFormat::Packing::None) {
+					line[2 * x] = value & 0xff;
+					line[2 * x + 1] = value >> 8;
+				} else if (bayer.bitDepth == 8) {
+					line[x] = value;
+				} else {
+					/* Packed formats: set the MSB bytes only */
+					line[x * bayer.bitDepth / 8] = value >> (bayer.bitDepth - 8);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+int Bench::configureDebayer(DebayerCpu &debayer, StreamConfiguration &outputCfg)
+{
+	outputCfg.pixelFormat = options_.outputFormat;
+	outputCfg.size = outputSize_;
+	std::tie(outputCfg.stride, outputCfg.frameSize) =
+		debayer.strideAndFrameSize(outputCfg.pixelFormat, outputCfg.size);
+
+	std::vector<std::reference_wrapper<StreamConfiguration>> outputCfgs;
+	outputCfgs.push_back(outputCfg);
+
+#ifdef SOFTISP_BENCH_CROP
+	debayer.configureCrop(options_.tuningFile);
+#endif
+
+	return debayer.configure(inputCfg_, outputCfgs, tuning_.ccmEnabled);
+}
+
+/*
+ * The statistics on their own, over the same window the debayer gives them
+ * for the largest output size.
+ */
+Measurement Bench::runStats()
+{
+	std::unique_ptr<SwStatsCpu> stats = createStats(options_.tuningFile);
+	DebayerCpu probe(createStats(options_.tuningFile));
+	const Size maxSize = probe.sizes(inputCfg_.pixelFormat, inputCfg_.size).max;
+	const Size pattern = probe.patternSize(inputCfg_.pixelFormat);
+
+	std::array<double, 3> gains = { 1.0, 1.0, 1.0 };
+	if (options_.gains)
+		gains = { (*options_.gains)[0], 1.0, (*options_.gains)[1] };
+
+	if (stats->configure(inputCfg_) < 0 || pattern.height != 2) {
+		std::cerr << "No statistics for " << inputCfg_.pixelFormat << std::endl;
+		params_ = makeParams(tuning_, gains);
+		altParams_ = makeParams(tuning_, { gains[0] * 1.01, gains[1], gains[2] * 0.99 });
+		return { "stats", 1, 0, 0, 0, 0 };
+	}
+
+	const unsigned int x = ((inputCfg_.size.width - maxSize.width) / 2) & ~(pattern.width - 1);
+	const unsigned int y = ((inputCfg_.size.height - maxSize.height) / 2) & ~(pattern.height - 1);
+	const size_t offset = y * inputCfg_.stride + x * lineBytes_ / inputCfg_.size.width;
+	stats->setWindow(Rectangle(maxSize));
+
+	const SharedFD &fd = stats->getStatsFD();
+	void *map = mmap(nullptr, sizeof(SwIspStats), PROT_READ, MAP_SHARED, fd.get(), 0);
+	const SwIspStats *result = map != MAP_FAILED ? static_cast<const SwIspStats *>(map) : nullptr;
+
+	auto process = [&](unsigned int frame) {
+		const uint8_t *src = frames_[frame % frames_.size()]->data() + offset;
+
+		statsStartFrame(*stats, frame);
+		for (unsigned int line = 0; line < maxSize.height; line += 2) {
+			const uint8_t *lines[3] = {
+				src + (line ? line - 1 : 1) * inputCfg_.stride,
+				src + line * inputCfg_.stride,
+				src + (line + 1) * inputCfg_.stride,
+			};
+
+			statsLine(*stats, frame, line, lines);
+		}
+		stats->finishFrame(frame, 0);
+	};
+
+	/* AWB gains from the first frame, unless given on the command line */
+	process(0);
+	if (!options_.gains && result)
+		gains = greyWorldGains(*result);
+
+	params_ = makeParams(tuning_, gains);
+	altParams_ = makeParams(tuning_, { gains[0] * 1.01, gains[1], gains[2] * 0.99 });
+
+	if (result)
+		munmap(map, sizeof(SwIspStats));
+
+	std::cout << "AWB gains: R " << std::fixed << std::setprecision(3) << gains[0]
+		  << " B " << gains[2] << std::defaultfloat << std::endl;
+
+	return measure("stats", 1, options_.iterations, process);
+}
+
+/*
+ * One pass over all frames for the checksum, then the timed runs with
+ * constant parameters and with parameters that change every frame. With
+ * generic, only the constant parameter run, with the generic converters.
+ */
+int Bench::runDebayer(unsigned int threads, uint64_t &checksum, bool generic)
+{
+	setenv("LIBCAMERA_SOFTISP_THREADS", std::to_string(threads).c_str(), 1);
+	if (generic)
+		setenv("LIBCAMERA_SOFTISP_GENERIC", "1", 1);
+	else
+		unsetenv("LIBCAMERA_SOFTISP_GENERIC");
+
+	DebayerCpu debayer(createStats(options_.tuningFile));
+	StreamConfiguration outputCfg;
+
+	if (configureDebayer(debayer, outputCfg) < 0) {
+		std::cerr << "Failed to configure the debayer for " << outputCfg.toString()
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	const SharedFD &fd = debayer.getStatsFD();
+	void *map = mmap(nullptr, sizeof(SwIspStats), PROT_READ, MAP_SHARED, fd.get(), 0);
+	if (map == MAP_FAILED) {
+		std::cerr << "Failed to map the statistics" << std::endl;
+		return -errno;
+	}
+	const SwIspStats *stats = static_cast<const SwIspStats *>(map);
+
+	Checksum sum;
+	uint32_t frame = 0;
+	for (const auto &input : frames_) {
+		debayer.process(frame++, input->get(), output_.get(), params_);
+		sum.add(output_.data(), outputCfg.frameSize);
+		if (stats->valid)
+			addStats(sum, *stats);
+	}
+	checksum = sum.value();
+
+	munmap(map, sizeof(SwIspStats));
+
+	if (generic) {
+		results_.push_back(measure("generic", threads, options_.iterations,
+					   [&](unsigned int i) {
+						   debayer.process(frame++, frames_[i % frames_.size()]->get(),
+								   output_.get(), params_);
+					   }));
+		return 0;
+	}
+
+	results_.push_back(measure("debayer", threads, options_.iterations,
+				   [&](unsigned int i) {
+					   debayer.process(frame++, frames_[i % frames_.size()]->get(),
+							   output_.get(), params_);
+				   }));
+	results_.push_back(measure("param-update", threads, options_.iterations,
+				   [&](unsigned int i) {
+					   debayer.process(frame++, frames_[i % frames_.size()]->get(),
+							   output_.get(), i & 1 ? altParams_ : params_);
+				   }));
+
+	return 0;
+}
+
+void Bench::report() const
+{
+	const double pixels = static_cast<double>(outputSize_.width) * outputSize_.height;
+	std::optional<uint64_t> baseline;
+
+	std::cout << std::endl
+		  << std::left << std::setw(14) << "stage" << std::right
+		  << std::setw(8) << "threads"
+		  << std::setw(14) << "ns/frame"
+		  << std::setw(14) << "median ns"
+		  << std::setw(14) << "min ns"
+		  << std::setw(14) << "cpu ns"
+		  << std::setw(9) << "fps"
+		  << std::setw(10) << "Mpix/s"
+		  << std::setw(9) << "scaling" << std::endl;
+
+	for (const Measurement &m : results_) {
+		if (!m.mean)
+			continue;
+
+		if (m.stage == "debayer" && !baseline)
+			baseline = m.mean;
+
+		std::cout << std::left << std::setw(14) << m.stage << std::right
+			  << std::setw(8) << m.threads
+			  << std::setw(14) << m.mean
+			  << std::setw(14) << m.median
+			  << std::setw(14) << m.min
+			  << std::setw(14) << m.cpu
+			  << std::fixed << std::setprecision(1)
+			  << std::setw(9) << 1e9 / m.mean
+			  << std::setw(10) << pixels * 1e3 / m.mean;
+		if (m.stage == "debayer" || m.stage == "generic")
+			std::cout << std::setw(8) << static_cast<double>(*baseline) / m.mean << "x";
+		std::cout << std::defaultfloat << std::endl;
+	}
+}
+
+int Bench::run()
+{
+	int ret = loadTuning(options_, tuning_);
+	if (ret < 0)
+		return ret;
+
+	ret = configureInput();
+	if (ret < 0)
+		return ret;
+
+	if (!allocator_.isValid()) {
+		/* memfds can't be synced like DMA-BUFs, don't log that every frame */
+		logSetLevel("DmaBufAllocator", "FATAL");
+		std::cout << "No DMA heap or udmabuf access, using memfd buffers" << std::endl;
+	}
+
+	ret = loadFrames();
+	if (ret < 0)
+		return ret;
+
+	/* Default to the largest output, like the simple pipeline */
+	DebayerCpu probe(createStats(options_.tuningFile));
+	const SizeRange sizes = probe.sizes(inputCfg_.pixelFormat, inputCfg_.size);
+	const std::vector<PixelFormat> outputFormats = probe.formats(inputCfg_.pixelFormat);
+	outputSize_ = options_.outputSize.isNull() ? sizes.max : options_.outputSize;
+
+	if (std::find(outputFormats.begin(), outputFormats.end(), options_.outputFormat) ==
+	    outputFormats.end()) {
+		std::cerr << "The debayer can't convert " << inputCfg_.pixelFormat
+			  << " to " << options_.outputFormat << std::endl;
+		return -EINVAL;
+	}
+
+	const unsigned int outputFrameSize =
+		std::get<1>(probe.strideAndFrameSize(options_.outputFormat, outputSize_));
+	ret = output_.allocate(allocator_, outputFrameSize);
+	if (ret < 0) {
+		std::cerr << "Failed to allocate the output buffer" << std::endl;
+		return ret;
+	}
+
+	std::cout << "Input:  " << inputCfg_.toString() << " stride " << inputCfg_.stride
+		  << ", " << frames_.size()
+		  << (options_.frameFiles.empty() ? " synthetic" : "") << " frames" << std::endl
+		  << "Output: " << outputSize_ << "-" << options_.outputFormat << std::endl
+		  << "Tuning: " << options_.tuningFile << ", "
+		  << (tuning_.ccmEnabled ? "CCM at " + std::to_string(options_.colourTemperature) + "K"
+					 : std::string("no CCM"))
+		  << ", black level " << tuning_.blackLevel << ", gamma " << tuning_.gamma
+		  << std::endl;
+
+	results_.push_back(runStats());
+
+	std::optional<uint64_t> checksum;
+	bool consistent = true;
+
+	for (unsigned int threads : options_.threads) {
+		uint64_t value;
+
+		ret = runDebayer(threads, value);
+		if (ret < 0)
+			return ret;
+
+		if (!checksum) {
+			checksum = value;
+		} else if (value != *checksum) {
+			std::cerr << "Output checksum with " << threads << " threads is "
+				  << hex(value) << ", expected " << hex(*checksum) << std::endl;
+			consistent = false;
+		}
+	}
+
+#ifdef SOFTISP_BENCH_KERNELS
+	/* The fixed-size converters must produce the same frames as the generic ones */
+	const PixelFormat &format = options_.outputFormat;
+	if (format == formats::YUYV || format == formats::NV12) {
+		uint64_t value;
+
+		ret = runDebayer(options_.threads.front(), value, true);
+		if (ret < 0)
+			return ret;
+
+		if (value != *checksum) {
+			std::cerr << "Output checksum with the generic kernels is "
+				  << hex(value) << ", expected " << hex(*checksum) << std::endl;
+			consistent = false;
+		}
+	}
+#endif
+
+	report();
+
+	std::cout << std::endl << "Checksum: " << hex(*checksum) << std::endl;
+
+	if (options_.expect && *options_.expect != *checksum) {
+		std::cerr << "Checksum mismatch, expected " << hex(*options_.expect) << std::endl;
+		return -EILSEQ;
+	}
+
+	return consistent ? 0 : -EILSEQ;
+}
+
+void usage(const char *argv0)
+{
+	std::cerr
+		<< "Usage: " << argv0 << " [options] <tuning.yaml> [frame.raw ...]\n"
+		<< "\n"
+		<< "Benchmark the SoftISP statistics and debayer on raw Bayer frames.\n"
+		<< "Each file holds one or more frames back to back. Without files,\n"
+		<< "synthetic frames are used.\n"
+		<< "\n"
+		<< "  -f, --format FMT        input format (default SGRBG10)\n"
+		<< "  -s, --size WxH          input size (default 1928x1092)\n"
+		<< "  -S, --stride BYTES      input line stride (default: unpadded)\n"
+		<< "  -o, --output FMT        output format (default RGB888)\n"
+		<< "  -O, --output-size WxH   output size (default: largest)\n"
+		<< "  -n, --iterations N      timed frames per run (default 100)\n"
+		<< "  -t, --threads N[,N...]  debayer thread counts (default 1,2,4)\n"
+		<< "  -T, --ct K              colour temperature for the CCM (default 5000)\n"
+		<< "  -b, --black-level N     black level, 8-bit scale (default: tuning file)\n"
+		<< "  -g, --gains R,B         AWB gains (default: grey world on frame 0)\n"
+		<< "  -e, --expect HEX        fail unless the output checksum matches\n";
+}
+
+bool parseSize(const char *arg, Size &size)
+{
+	unsigned int width, height;
+	char end;
+
+	if (sscanf(arg, "%ux%u%c", &width, &height, &end) != 2 || !width || !height)
+		return false;
+
+	size = Size(width, height);
+	return true;
+}
+
+bool parseFormat(const char *arg, PixelFormat &format)
+{
+	format = PixelFormat::fromString(arg);
+	return format.isValid();
+}
+
+int parseOptions(int argc, char *argv[], BenchOptions &options)
+{
+	static const struct option longOptions[] = {
+		{ "format", required_argument, nullptr, 'f' },
+		{ "size", required_argument, nullptr, 's' },
+		{ "stride", required_argument, nullptr, 'S' },
+		{ "output", required_argument, nullptr, 'o' },
+		{ "output-size", required_argument, nullptr, 'O' },
+		{ "iterations", required_argument, nullptr, 'n' },
+		{ "threads", required_argument, nullptr, 't' },
+		{ "ct", required_argument, nullptr, 'T' },
+		{ "black-level", required_argument, nullptr, 'b' },
+		{ "gains", required_argument, nullptr, 'g' },
+		{ "expect", required_argument, nullptr, 'e' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 },
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "f:s:S:o:O:n:t:T:b:g:e:h",
+				  longOptions, nullptr)) != -1) {
+		bool valid = true;
+
+		switch (opt) {
+		case 'f':
+			valid = parseFormat(optarg, options.inputFormat);
+			break;
+		case 's':
+			valid = parseSize(optarg, options.inputSize);
+			break;
+		case 'S':
+			options.inputStride = strtoul(optarg, nullptr, 0);
+			break;
+		case 'o':
+			valid = parseFormat(optarg, options.outputFormat);
+			break;
+		case 'O':
+			valid = parseSize(optarg, options.outputSize);
+			break;
+		case 'n':
+			options.iterations = strtoul(optarg, nullptr, 0);
+			valid = options.iterations > 0;
+			break;
+		case 't': {
+			std::istringstream list(optarg);
+			std::string item;
+
+			while (valid && std::getline(list, item, ',')) {
+				unsigned int threads = strtoul(item.c_str(), nullptr, 0);
+				valid = threads > 0;
+				options.threads.push_back(threads);
+			}
+			break;
+		}
+		case 'T':
+			options.colourTemperature = strtoul(optarg, nullptr, 0);
+			break;
+		case 'b':
+			options.blackLevel = strtoul(optarg, nullptr, 0);
+			valid = *options.blackLevel < 256;
+			break;
+		case 'g': {
+			double r, b;
+			valid = sscanf(optarg, "%lf,%lf", &r, &b) == 2 && r > 0.0 && b > 0.0;
+			options.gains = { r, b };
+			break;
+		}
+		case 'e':
+			options.expect = strtoull(optarg, nullptr, 16);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 1 : -EINVAL;
+		}
+
+		if (!valid) {
+			std::cerr << "Invalid argument '" << optarg << "' for -"
+				  << static_cast<char>(opt) << std::endl;
+			return -EINVAL;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return -EINVAL;
+	}
+
+	options.tuningFile = argv[optind++];
+	while (optind < argc)
+		options.frameFiles.push_back(argv[optind++]);
+
+	if (options.threads.empty()) {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		for (unsigned int threads : { 1, 2, 4 }) {
+			if (threads == 1 || threads <= cpus)
+				options.threads.push_back(threads);
+		}
+	}
+
+#ifndef SOFTISP_BENCH_THREADS
+	if (options.threads != std::vector<unsigned int>{ 1 })
+		std::cout << "Stripe threads not patched in, running single-threaded" << std::endl;
+	options.threads = { 1 };
+#endif
+
+	return 0;
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+
+	int ret = parseOptions(argc, argv, options);
+	if (ret)
+		return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	Bench bench(options);
+	return bench.run() < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -5,96 +5,45 @@
 # Usage: ./tune-ccm.sh [sensor]
 #   sensor: ov02c10 (default) or ov02e10
 #
+#        ./tune-ccm.sh --export DIR
+#   Write every preset to DIR/NN-name.yaml and exit, e.g. to compare them
+#   with softisp-bench. Needs no camera or sudo.
+#
 # Preview modes (auto-detected):
 #   - Camera relay: restarts relay service, opens GStreamer viewer on /dev/video0
 #   - Direct qcam: uses qcam for direct libcamera access (no relay needed)
 #
+# With the patched libcamera (build-patched-libcamera.sh) the camera picks
+# up the rewritten tuning file on the next frame, so presets switch without
+# a restart. Only switching between a preset with and without a CCM still
+# restarts the camera.
+#
 # Requires: sudo access to write tuning files
 
 set -e
 
-SENSOR="${1:-ov02c10}"
-
-# Find the tuning file location
-TUNING_FILE=""
-for dir in /usr/local/share/libcamera/ipa/simple \
-           /usr/share/libcamera/ipa/simple; do
-    if [[ -d "$dir" ]]; then
-        TUNING_FILE="$dir/${SENSOR}.yaml"
-        break
-    fi
-done
-
-if [[ -z "$TUNING_FILE" ]]; then
-    echo "ERROR: Could not find libcamera IPA data directory."
-    echo "Make sure libcamera is installed."
-    exit 1
+EXPORT_DIR=""
+if [[ "${1:-}" == "--export" ]]; then
+    EXPORT_DIR="${2:?Usage: $0 --export DIR}"
+    shift 2
 fi
 
-# Detect preview mode: relay service or qcam
-USE_RELAY=false
-VIEWER_PID=""
-if systemctl --user is-active camera-relay.service >/dev/null 2>&1; then
-    USE_RELAY=true
-    echo "  Detected camera-relay service — will restart relay for each preset."
-elif command -v qcam >/dev/null 2>&1; then
-    echo "  No camera-relay — will use qcam for direct preview."
-else
-    echo "ERROR: No camera-relay service running and qcam not found."
-    echo "Start the relay:  systemctl --user start camera-relay.service"
-    echo "Or install qcam:  sudo apt install libcamera-tools"
-    exit 1
-fi
+# True if the installed libcamera has the given SoftISP patch (same check as
+# camera-relay). The features file records the library mtime, so it goes
+# stale when a distro update replaces the patched libcamera.
+softisp_has_feature() {
+    local feature="$1" library mtime features
+    [[ -f "$SOFTISP_FEATURES" ]] || return 1
 
-# Export IPA path in case it's a source build
-for dir in /usr/local/lib/*/libcamera/ipa /usr/local/lib/libcamera/ipa \
-           /usr/lib/*/libcamera/ipa /usr/lib/libcamera/ipa; do
-    if [[ -d "$dir" ]]; then
-        export LIBCAMERA_IPA_MODULE_PATH="$dir"
-        break
-    fi
-done
+    library=$(sed -n 's/^LIBRARY=//p' "$SOFTISP_FEATURES")
+    mtime=$(sed -n 's/^LIBRARY_MTIME=//p' "$SOFTISP_FEATURES")
+    features=$(sed -n 's/^FEATURES="\(.*\)"$/\1/p' "$SOFTISP_FEATURES")
 
-# Detect libcamera version for Lut vs Adjust algorithm
-# v0.5.x uses Lut; v0.6+ uses Adjust (replaces Lut)
-USE_LUT=false
-LIBCAMERA_VER=$(ls -l /usr/local/lib/*/libcamera.so.* /usr/local/lib/libcamera.so.* \
-    /usr/lib64/libcamera.so.* /usr/lib/*/libcamera.so.* /usr/lib/libcamera.so.* 2>/dev/null \
-    | grep -oP 'libcamera\.so\.\K[0-9]+\.[0-9]+' | head -1 || true)
-if [[ -n "$LIBCAMERA_VER" ]]; then
-    LIBCAMERA_MINOR=$(echo "$LIBCAMERA_VER" | cut -d. -f2)
-    if [[ "$LIBCAMERA_MINOR" -lt 6 ]] 2>/dev/null; then
-        USE_LUT=true
-        echo "  libcamera ${LIBCAMERA_VER} detected — using Lut (not Adjust)"
-    fi
-fi
-
-# Back up the current tuning file
-BACKUP=""
-if [[ -f "$TUNING_FILE" ]]; then
-    BACKUP="${TUNING_FILE}.bak.$$"
-    sudo cp "$TUNING_FILE" "$BACKUP"
-fi
-
-cleanup() {
-    # Kill viewer if we started it
-    if [[ -n "$VIEWER_PID" ]] && kill -0 "$VIEWER_PID" 2>/dev/null; then
-        kill "$VIEWER_PID" 2>/dev/null
-        wait "$VIEWER_PID" 2>/dev/null || true
-    fi
-    # Restore backup if user didn't explicitly save (Ctrl+C, error, etc.)
-    if [[ $SELECTED -lt 0 && -n "$BACKUP" && -f "$BACKUP" ]]; then
-        sudo cp "$BACKUP" "$TUNING_FILE"
-        sudo rm -f "$BACKUP"
-        echo ""
-        echo "  Interrupted — restored original tuning file."
-        if $USE_RELAY; then
-            echo "  Restarting relay with original tuning..."
-            systemctl --user restart camera-relay.service 2>/dev/null || true
-        fi
-    fi
+    [[ -n "$library" && "$(stat -c %Y "$library" 2>/dev/null)" == "$mtime" ]] || return 1
+    [[ " $features " == *" $feature "* ]]
 }
-trap cleanup EXIT INT TERM
+
+SENSOR="${1:-ov02c10}"
 
 # ─── CCM Presets ───────────────────────────────────────────────
 # Each preset: NAME|DESCRIPTION|YAML_CONTENT
@@ -409,6 +358,125 @@ algorithms:
 ..."
 )
 
+# ─── Export mode ───────────────────────────────────────────────
+# Presets are written as-is (with Adjust); softisp-bench reads Lut and
+# Adjust alike.
+if [[ -n "$EXPORT_DIR" ]]; then
+    mkdir -p "$EXPORT_DIR"
+    for idx in "${!PRESETS[@]}"; do
+        entry="${PRESETS[$idx]}"
+        name="${entry%%|*}"
+        yaml="${entry#*|}"
+        yaml="${yaml#*|}"
+        slug=$(echo "$name" | tr 'A-Z' 'a-z' | sed 's/[^a-z0-9]\+/-/g; s/^-//; s/-$//')
+        file="$EXPORT_DIR/$(printf '%02d' $((idx + 1)))-${slug}.yaml"
+        echo "$yaml" > "$file"
+        echo "  $file"
+    done
+    exit 0
+fi
+
+# Find the tuning file location
+TUNING_FILE=""
+for dir in /usr/local/share/libcamera/ipa/simple \
+           /usr/share/libcamera/ipa/simple; do
+    if [[ -d "$dir" ]]; then
+        TUNING_FILE="$dir/${SENSOR}.yaml"
+        break
+    fi
+done
+
+if [[ -z "$TUNING_FILE" ]]; then
+    echo "ERROR: Could not find libcamera IPA data directory."
+    echo "Make sure libcamera is installed."
+    exit 1
+fi
+
+# Detect preview mode: relay service or qcam
+USE_RELAY=false
+VIEWER_PID=""
+if systemctl --user is-active camera-relay.service >/dev/null 2>&1; then
+    USE_RELAY=true
+    echo "  Detected camera-relay service — will restart relay for each preset."
+elif command -v qcam >/dev/null 2>&1; then
+    echo "  No camera-relay — will use qcam for direct preview."
+else
+    echo "ERROR: No camera-relay service running and qcam not found."
+    echo "Start the relay:  systemctl --user start camera-relay.service"
+    echo "Or install qcam:  sudo apt install libcamera-tools"
+    exit 1
+fi
+
+# Export IPA path in case it's a source build
+for dir in /usr/local/lib/*/libcamera/ipa /usr/local/lib/libcamera/ipa \
+           /usr/lib/*/libcamera/ipa /usr/lib/libcamera/ipa; do
+    if [[ -d "$dir" ]]; then
+        export LIBCAMERA_IPA_MODULE_PATH="$dir"
+        break
+    fi
+done
+
+# Detect libcamera version for Lut vs Adjust algorithm
+# v0.5.x uses Lut; v0.6+ uses Adjust (replaces Lut)
+USE_LUT=false
+LIBCAMERA_VER=$(ls -l /usr/local/lib/*/libcamera.so.* /usr/local/lib/libcamera.so.* \
+    /usr/lib64/libcamera.so.* /usr/lib/*/libcamera.so.* /usr/lib/libcamera.so.* 2>/dev/null \
+    | grep -oP 'libcamera\.so\.\K[0-9]+\.[0-9]+' | head -1 || true)
+if [[ -n "$LIBCAMERA_VER" ]]; then
+    LIBCAMERA_MINOR=$(echo "$LIBCAMERA_VER" | cut -d. -f2)
+    if [[ "$LIBCAMERA_MINOR" -lt 6 ]] 2>/dev/null; then
+        USE_LUT=true
+        echo "  libcamera ${LIBCAMERA_VER} detected — using Lut (not Adjust)"
+    fi
+fi
+
+# The patched libcamera reloads the tuning file while streaming
+LIVE_RELOAD=false
+SOFTISP_FEATURES="/usr/local/share/libcamera-softisp/features"
+if softisp_has_feature tuning-reload; then
+    LIVE_RELOAD=true
+    echo "  libcamera reloads the tuning file — presets apply without a restart"
+fi
+# Whether the running camera loaded a CCM; adding or removing it needs a restart
+RUNNING_CCM=false
+if [[ -f "$TUNING_FILE" ]] && grep -q '^  - Ccm:' "$TUNING_FILE"; then
+    RUNNING_CCM=true
+fi
+
+# Back up the current tuning file
+BACKUP=""
+if [[ -f "$TUNING_FILE" ]]; then
+    BACKUP="${TUNING_FILE}.bak.$$"
+    sudo cp "$TUNING_FILE" "$BACKUP"
+fi
+
+# The presets only set the algorithms; the patched SoftISP's top-level
+# statistics: and crop: sections are carried over into every preset
+KEEP_SECTIONS=""
+if [[ -f "$TUNING_FILE" ]]; then
+    KEEP_SECTIONS=$(awk '/^[^ #]/ { keep = /^(statistics|crop):/ } keep' "$TUNING_FILE")
+fi
+
+cleanup() {
+    # Kill viewer if we started it
+    if [[ -n "$VIEWER_PID" ]] && kill -0 "$VIEWER_PID" 2>/dev/null; then
+        kill "$VIEWER_PID" 2>/dev/null
+        wait "$VIEWER_PID" 2>/dev/null || true
+    fi
+    # Restore backup if user didn't explicitly save (Ctrl+C, error, etc.)
+    if [[ $SELECTED -lt 0 && -n "$BACKUP" && -f "$BACKUP" ]]; then
+        sudo cp "$BACKUP" "$TUNING_FILE"
+        sudo rm -f "$BACKUP"
+        echo ""
+        echo "  Interrupted — restored original tuning file."
+        if $USE_RELAY; then
+            echo "  Restarting relay with original tuning..."
+            systemctl --user restart camera-relay.service 2>/dev/null || true
+        fi
+    fi
+}
+trap cleanup EXIT INT TERM
+
 # ─── Main loop ─────────────────────────────────────────────────
 TOTAL=${#PRESETS[@]}
 CURRENT=0
@@ -434,7 +502,11 @@ echo "    s          ->  Save current preset and exit"
 echo "    q          ->  Quit without saving (restores backup)"
 echo "    number     ->  Jump to preset (1-${TOTAL})"
 echo ""
-echo "  The camera will restart for each preset (takes a few seconds)."
+if $LIVE_RELOAD; then
+    echo "  Presets apply on the next frame (a CCM on/off switch restarts the camera)."
+else
+    echo "  The camera will restart for each preset (takes a few seconds)."
+fi
 echo "  Keep the preview window visible."
 echo ""
 read -r -p "Press Enter to start..." _
@@ -472,6 +544,10 @@ apply_preset() {
     echo "  $desc"
     echo "----------------------------------------------"
 
+    if [[ -n "$KEEP_SECTIONS" ]]; then
+        yaml="${yaml%...}${KEEP_SECTIONS}"$'\n...'
+    fi
+
     # Write tuning file (swap Adjust/Lut based on libcamera version)
     if [[ "$USE_LUT" == "true" ]]; then
         echo "$yaml" | sed 's/^  - Adjust:/  - Lut:/' | sudo tee "$TUNING_FILE" > /dev/null
@@ -480,6 +556,15 @@ apply_preset() {
     fi
     sync  # ensure file is flushed to disk
 
+    local has_ccm=false
+    [[ "$yaml" == *"  - Ccm:"* ]] && has_ccm=true
+    if $LIVE_RELOAD && [[ "$has_ccm" == "$RUNNING_CCM" ]] &&
+       [[ -n "$VIEWER_PID" ]] && kill -0 "$VIEWER_PID" 2>/dev/null; then
+        # The running camera applies the new file on its next frame
+        return
+    fi
+    RUNNING_CCM=$has_ccm
+
     if $USE_RELAY; then
         # Kill viewer so it's not holding the device during restart
         kill_viewer
@@ -54,6 +54,9 @@ fi
 sudo systemctl disable ipu-bridge-check-upstream.service 2>/dev/null || true
 sudo rm -f /etc/systemd/system/ipu-bridge-check-upstream.service
 sudo rm -f /usr/local/sbin/ipu-bridge-check-upstream.sh
+# The shared helpers go once no check script is left
+sudo rm -f /var/cache/check-upstream/ipu-bridge
+compgen -G "/usr/local/sbin/*-check-upstream.sh" > /dev/null || sudo rm -rf /usr/local/share/check-upstream /var/cache/check-upstream
 # Restore kernel's original ipu-bridge
 sudo depmod -a 2>/dev/null || true
 
@@ -137,6 +140,7 @@ for user_home in /home/*; do
         sudo -u "$user" systemctl --user disable camera-relay.service 2>/dev/null || true
         rm -f "$service_file"
     fi
+    rm -rf "$user_home/.cache/camera-relay"
 done
 sudo rm -f /usr/local/bin/camera-relay
 sudo rm -f /usr/local/bin/camera-relay-monitor
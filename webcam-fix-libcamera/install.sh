@@ -738,7 +738,7 @@ if [[ -d "$RELAY_DIR" ]]; then
     # Build and install on-demand monitor (C binary)
     if [[ -f "$RELAY_DIR/camera-relay-monitor.c" ]]; then
         echo "  Building on-demand monitor..."
-        if gcc -O2 -Wall -o /tmp/camera-relay-monitor "$RELAY_DIR/camera-relay-monitor.c"; then
+        if gcc -O2 -Wall -pthread -o /tmp/camera-relay-monitor "$RELAY_DIR/camera-relay-monitor.c"; then
             sudo cp /tmp/camera-relay-monitor /usr/local/bin/camera-relay-monitor
             sudo chmod 755 /usr/local/bin/camera-relay-monitor
             rm -f /tmp/camera-relay-monitor
@@ -757,6 +757,8 @@ if [[ -d "$RELAY_DIR" ]]; then
     sudo mkdir -p /usr/local/share/camera-relay
     sudo cp "$RELAY_DIR/camera-relay-systray.py" /usr/local/share/camera-relay/
     sudo chmod 755 /usr/local/share/camera-relay/camera-relay-systray.py
+    sudo cp "$RELAY_DIR/camera-relay-flight.py" /usr/local/share/camera-relay/
+    sudo chmod 755 /usr/local/share/camera-relay/camera-relay-flight.py
     echo "  ✓ Installed systray GUI"
 
     # Install desktop file
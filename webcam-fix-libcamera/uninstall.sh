@@ -34,6 +34,7 @@ sudo rm -rf /usr/local/share/camera-relay
 sudo rm -f /usr/share/applications/camera-relay-systray.desktop
 # Remove user service file if still present
 rm -f "${HOME}/.config/systemd/user/camera-relay.service" 2>/dev/null || true
+rm -rf "${XDG_CACHE_HOME:-$HOME/.cache}/camera-relay" 2>/dev/null || true
 systemctl --user daemon-reload 2>/dev/null || true
 # Unload v4l2loopback if it was only used by the relay
 if lsmod 2>/dev/null | grep -q v4l2loopback; then
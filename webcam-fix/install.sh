@@ -515,6 +515,12 @@ echo "  ✓ v4l2-relayd configured for IPU6"
 sudo install -m 755 "$SCRIPT_DIR/v4l2-relayd-detect-resolution.sh" /usr/local/sbin/v4l2-relayd-detect-resolution.sh
 echo "  ✓ Resolution auto-detection script installed"
 
+# Install the CSI-2 stall recovery helper (ISYS unbind/rebind, records MTTR).
+# The relay's OnFailure= (step 9) starts it when restarts don't help.
+sudo install -m 755 "$SCRIPT_DIR/v4l2-relayd-recover.sh" /usr/local/sbin/v4l2-relayd-recover.sh
+sudo install -m 644 "$SCRIPT_DIR/v4l2-relayd-recover.service" /etc/systemd/system/v4l2-relayd-recover.service
+echo "  ✓ Stall recovery helper installed"
+
 # ──────────────────────────────────────────────
 # [9/13] Harden v4l2-relayd service
 # ──────────────────────────────────────────────
@@ -526,6 +532,8 @@ sudo tee /etc/systemd/system/v4l2-relayd@default.service.d/override.conf > /dev/
 # Rate-limit restarts: max 10 attempts in 60 seconds
 StartLimitIntervalSec=60
 StartLimitBurst=10
+# Once the restarts are used up, reset the CSI-2 link and start again
+OnFailure=v4l2-relayd-recover.service
 
 [Service]
 # Auto-detect camera resolution before starting the relay.
@@ -611,6 +619,7 @@ fi
 echo ""
 echo "[12/13] Installing upstream detection service..."
 sudo install -m 755 "$SCRIPT_DIR/v4l2-relayd-check-upstream.sh" /usr/local/sbin/v4l2-relayd-check-upstream.sh
+sudo install -D -m 644 "$SCRIPT_DIR/../check-upstream/check-upstream-lib.sh" /usr/local/share/check-upstream/check-upstream-lib.sh
 sudo install -m 644 "$SCRIPT_DIR/v4l2-relayd-check-upstream.service" /etc/systemd/system/v4l2-relayd-check-upstream.service
 sudo systemctl daemon-reload
 sudo systemctl enable v4l2-relayd-check-upstream.service
@@ -675,6 +684,9 @@ echo "    /etc/udev/rules.d/90-hide-ipu6-v4l2.rules"
 echo "    $INITRAMFS_CONFIG"
 echo "    /etc/systemd/system/v4l2-relayd@default.service.d/override.conf"
 echo "    /usr/local/sbin/v4l2-relayd-detect-resolution.sh"
+echo "    /usr/local/sbin/v4l2-relayd-recover.sh"
+echo "    /etc/systemd/system/v4l2-relayd-recover.service"
 echo "    /usr/local/sbin/v4l2-relayd-check-upstream.sh"
+echo "    /usr/local/share/check-upstream/check-upstream-lib.sh"
 echo "    /etc/systemd/system/v4l2-relayd-check-upstream.service"
 echo "=============================================="
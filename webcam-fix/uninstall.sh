@@ -60,7 +60,11 @@ sudo systemctl disable v4l2-relayd-watchdog.timer 2>/dev/null || true
 sudo systemctl stop v4l2-relayd-watchdog.service 2>/dev/null || true
 sudo rm -f /usr/local/sbin/v4l2-relayd-watchdog.sh
 sudo rm -f /usr/local/sbin/v4l2-relayd-detect-resolution.sh
+sudo rm -f /usr/local/sbin/v4l2-relayd-recover.sh
+sudo rm -f /etc/systemd/system/v4l2-relayd-recover.service
 sudo rm -f /run/v4l2-relayd-resolution.env
+sudo rm -rf /var/cache/v4l2-relayd
+sudo rm -rf /var/lib/v4l2-relayd
 sudo rm -f /etc/systemd/system/v4l2-relayd-watchdog.service
 sudo rm -f /etc/systemd/system/v4l2-relayd-watchdog.timer
 sudo rm -rf /run/v4l2-relayd-watchdog
@@ -72,6 +76,9 @@ echo "[5/9] Removing upstream detection service..."
 sudo systemctl stop v4l2-relayd-check-upstream.service 2>/dev/null || true
 sudo systemctl disable v4l2-relayd-check-upstream.service 2>/dev/null || true
 sudo rm -f /usr/local/sbin/v4l2-relayd-check-upstream.sh
+# The shared helpers go once no check script is left
+sudo rm -f /var/cache/check-upstream/v4l2-relayd
+compgen -G "/usr/local/sbin/*-check-upstream.sh" > /dev/null || sudo rm -rf /usr/local/share/check-upstream /var/cache/check-upstream
 sudo rm -f /etc/systemd/system/v4l2-relayd-check-upstream.service
 sudo systemctl daemon-reload
 echo "  Done"
@@ -12,56 +12,72 @@
 #   1. IVSC modules auto-load via ACPI aliases (no /etc/modules-load.d/ hack)
 #   2. libcamera has a working IPU6 pipeline handler
 #   3. PipeWire exposes the camera via libcamera SPA plugin (no v4l2-relayd)
+#
+# A failed check 1 or 2 is cached per kernel, mei-vsc module and libcamera
+# pipeline handlers (check-upstream-lib.sh), so later boots with the same
+# files skip the checks.
 
-UPSTREAM_READY=true
-
-log() { echo "v4l2-relayd-check: $*"; }
+# Shared helpers: module lookup and the per-kernel verdict cache
+CHECK_LIB=/usr/local/share/check-upstream/check-upstream-lib.sh
+[ -r "$CHECK_LIB" ] || CHECK_LIB="$(dirname "$0")/../check-upstream/check-upstream-lib.sh"
+. "$CHECK_LIB" || exit 0
 
-# --- Check 1: IVSC modules have proper ACPI aliases ---
-# Currently, mei-vsc doesn't auto-load because it lacks modalias entries
-# matching the ACPI hardware IDs (e.g., INTC10CF for Meteor Lake IVSC).
-# When upstream fixes this, modinfo will show the alias.
-if ! modinfo mei_vsc 2>/dev/null | grep -q "alias:.*acpi"; then
-    UPSTREAM_READY=false
-    log "mei-vsc: missing ACPI modalias (IVSC won't auto-load)"
-fi
+check_begin v4l2-relayd
 
-# --- Check 2: libcamera IPU6 pipeline handler exists ---
-# When libcamera supports IPU6 natively, it ships a pipeline handler .so.
-# Check standard library paths for it.
-IPU6_HANDLER=""
+# The verdict of checks 1 and 2 depends on the mei-vsc module and the
+# installed libcamera pipeline handlers only
+MEI_VSC_MODULE=$(modinfo -n mei_vsc 2>/dev/null)
+IPU6_HANDLERS=()
 for dir in /usr/lib/*/libcamera /usr/lib/libcamera /usr/local/lib/*/libcamera /usr/local/lib/libcamera; do
-    if ls "${dir}/"*ipu6* 2>/dev/null | grep -q .; then
-        IPU6_HANDLER="found"
-        break
-    fi
+    for handler in "${dir}/"*ipu6*; do
+        [ -e "$handler" ] && IPU6_HANDLERS+=("$handler")
+    done
 done
-if [ -z "$IPU6_HANDLER" ]; then
-    UPSTREAM_READY=false
-    log "libcamera: IPU6 pipeline handler not found"
-fi
+check_key "$MEI_VSC_MODULE" "${IPU6_HANDLERS[@]}"
+
+if ! check_cached; then
+    # --- Check 1: IVSC modules have proper ACPI aliases ---
+    # Currently, mei-vsc doesn't auto-load because it lacks modalias entries
+    # matching the ACPI hardware IDs (e.g., INTC10CF for Meteor Lake IVSC).
+    # When upstream fixes this, modinfo will show the alias.
+    if ! kmod_has_alias mei_vsc "acpi"; then
+        not_ready "mei-vsc: missing ACPI modalias (IVSC won't auto-load)"
+    fi
 
-# --- Check 3: libcamera can actually enumerate the camera ---
-# The pipeline handler existing isn't enough — it must work with this
-# kernel version and detect the OV02C10 sensor. Use cam -l if available,
-# otherwise check the libcamera SPA plugin's device list.
-CAMERA_ENUMERATED=false
-if command -v cam &>/dev/null; then
-    if LIBCAMERA_LOG_LEVELS="*:ERROR" cam -l 2>/dev/null | grep -qi "ipu6\|ov02c10\|OVTI02C1"; then
-        CAMERA_ENUMERATED=true
+    # --- Check 2: libcamera IPU6 pipeline handler exists ---
+    # When libcamera supports IPU6 natively, it ships a pipeline handler .so.
+    if [ ${#IPU6_HANDLERS[@]} -eq 0 ]; then
+        not_ready "libcamera: IPU6 pipeline handler not found"
     fi
-fi
-# Fallback: check if PipeWire's libcamera SPA plugin sees the camera
-# (requires pw-cli, works in system context)
-if ! $CAMERA_ENUMERATED && command -v pw-cli &>/dev/null; then
-    if pw-cli list-objects 2>/dev/null | grep -qi "libcamera.*ipu6\|libcamera.*ov02c10"; then
-        CAMERA_ENUMERATED=true
+
+    # --- Check 3: libcamera can actually enumerate the camera ---
+    # The pipeline handler existing isn't enough — it must work with this
+    # kernel version and detect the OV02C10 sensor. Use cam -l if available,
+    # otherwise check the libcamera SPA plugin's device list. Only checked
+    # once 1 and 2 pass, and never cached: the camera may simply not be up
+    # yet on this boot.
+    if $UPSTREAM_READY; then
+        CAMERA_ENUMERATED=false
+        if command -v cam &>/dev/null; then
+            if LIBCAMERA_LOG_LEVELS="*:ERROR" cam -l 2>/dev/null | grep -qi "ipu6\|ov02c10\|OVTI02C1"; then
+                CAMERA_ENUMERATED=true
+            fi
+        fi
+        # Fallback: check if PipeWire's libcamera SPA plugin sees the camera
+        # (requires pw-cli, works in system context)
+        if ! $CAMERA_ENUMERATED && command -v pw-cli &>/dev/null; then
+            if pw-cli list-objects 2>/dev/null | grep -qi "libcamera.*ipu6\|libcamera.*ov02c10"; then
+                CAMERA_ENUMERATED=true
+            fi
+        fi
+        if ! $CAMERA_ENUMERATED; then
+            UPSTREAM_READY=false
+            log "libcamera: cannot enumerate IPU6 camera (pipeline handler may not work with this kernel)"
+        fi
+    else
+        check_store
     fi
 fi
-if ! $CAMERA_ENUMERATED; then
-    UPSTREAM_READY=false
-    log "libcamera: cannot enumerate IPU6 camera (pipeline handler may not work with this kernel)"
-fi
 
 if ! $UPSTREAM_READY; then
     log "upstream not available yet in $(uname -r) — v4l2-relayd workaround still needed"
@@ -114,6 +130,12 @@ udevadm control --reload-rules 2>/dev/null || true
 # Remove resolution detection script and runtime env
 rm -f /usr/local/sbin/v4l2-relayd-detect-resolution.sh
 rm -f /run/v4l2-relayd-resolution.env
+rm -rf /var/cache/v4l2-relayd
+
+# Remove the stall recovery helper and its MTTR log
+rm -f /usr/local/sbin/v4l2-relayd-recover.sh
+rm -f /etc/systemd/system/v4l2-relayd-recover.service
+rm -rf /var/lib/v4l2-relayd
 
 # Remove watchdog files
 rm -f /usr/local/sbin/v4l2-relayd-watchdog.sh
@@ -124,6 +146,8 @@ rm -rf /run/v4l2-relayd-watchdog
 # Remove this check script and service
 rm -f /etc/systemd/system/v4l2-relayd-check-upstream.service
 rm -f /usr/local/sbin/v4l2-relayd-check-upstream.sh
+check_forget
+check_cleanup_lib
 
 systemctl daemon-reload
 
@@ -10,15 +10,75 @@
 # resolution mismatch where videoconvert can't scale, resulting in blank
 # frames through the v4l2loopback device.
 #
+# Probing powers up the camera for a full icamerasrc pipeline, so the result
+# is cached in /var/cache/v4l2-relayd/resolution. The cache is keyed by the
+# camera HAL package version, the HAL / icamerasrc libraries and sensor
+# configs, the kernel release and the sensor identity. Service restarts only
+# probe again when one of those changes. Run with --refresh to force a probe.
+#
 # Installed to /usr/local/sbin/v4l2-relayd-detect-resolution.sh
 
 set -euo pipefail
 
 ENV_FILE="/run/v4l2-relayd-resolution.env"
+CACHE_FILE="/var/cache/v4l2-relayd/resolution"
 SHM_KEY="0x0043414d"
 DEFAULT_WIDTH=1920
 DEFAULT_HEIGHT=1080
 
+# Everything that decides icamerasrc's default resolution
+cache_key() {
+    local version="" path sensor
+    local -a files=()
+
+    # Ubuntu PPA, Fedora RPM Fusion, Arch; source builds leave a stamp file
+    version=$(dpkg-query -W -f='${Version}' libcamhal-ipu6epmtl 2>/dev/null) || \
+        version=$(rpm -q ipu6-camera-hal 2>/dev/null) || \
+        version=$(pacman -Q ipu6-camera-hal 2>/dev/null) || \
+        version=""
+    echo "hal=$version"
+    echo "kernel=$(uname -r)"
+
+    for path in /usr/lib*/libcamhal.so* /usr/lib/*-linux-gnu/libcamhal.so* \
+                /usr/lib*/gstreamer-1.0/libgsticamerasrc.so \
+                /usr/lib/*-linux-gnu/gstreamer-1.0/libgsticamerasrc.so \
+                /usr/share/defaults/etc/camera \
+                /var/lib/ipu6-hal-backup/.source-build-stamp; do
+        [[ -e "$path" ]] && files+=("$path")
+    done
+    (( ${#files[@]} )) && stat -L -c '%n %Y %s' "${files[@]}" 2>/dev/null
+
+    for sensor in /sys/bus/i2c/devices/i2c-OVTI*; do
+        [[ -e "$sensor" ]] || continue
+        echo "sensor=$(basename "$sensor") $(cat "$sensor/firmware_node/path" 2>/dev/null)"
+    done
+    return 0
+}
+
+write_env() {
+    echo "WIDTH=$WIDTH" > "$ENV_FILE"
+    echo "HEIGHT=$HEIGHT" >> "$ENV_FILE"
+}
+
+KEY=$(cache_key | md5sum | cut -d' ' -f1)
+
+if [[ "${1:-}" != "--refresh" && -f "$CACHE_FILE" ]]; then
+    CACHED_KEY="" WIDTH="" HEIGHT=""
+    while IFS='=' read -r name value; do
+        case "$name" in
+            KEY)    CACHED_KEY="$value" ;;
+            WIDTH)  WIDTH="$value" ;;
+            HEIGHT) HEIGHT="$value" ;;
+        esac
+    done < "$CACHE_FILE"
+
+    if [[ "$CACHED_KEY" == "$KEY" && "$WIDTH" =~ ^[0-9]+$ && "$HEIGHT" =~ ^[0-9]+$ ]]; then
+        write_env
+        echo "Cached resolution: ${WIDTH}x${HEIGHT}" >&2
+        exit 0
+    fi
+fi
+
 # Clean any stale SHM from previous runs
 ipcrm -M "$SHM_KEY" 2>/dev/null || true
 
@@ -37,9 +97,17 @@ if [[ -n "$CAPS" ]]; then
     HEIGHT=$(echo "$CAPS" | grep -oP 'height=\(int\)\K[0-9]+' || true)
 fi
 
+# Only a successful probe is cached, the defaults are a guess
+if [[ -n "$WIDTH" && -n "$HEIGHT" ]]; then
+    mkdir -p "$(dirname "$CACHE_FILE")"
+    printf 'KEY=%s\nWIDTH=%s\nHEIGHT=%s\n' "$KEY" "$WIDTH" "$HEIGHT" > "$CACHE_FILE.tmp"
+    mv -f "$CACHE_FILE.tmp" "$CACHE_FILE"
+else
+    rm -f "$CACHE_FILE"
+fi
+
 WIDTH=${WIDTH:-$DEFAULT_WIDTH}
 HEIGHT=${HEIGHT:-$DEFAULT_HEIGHT}
 
-echo "WIDTH=$WIDTH" > "$ENV_FILE"
-echo "HEIGHT=$HEIGHT" >> "$ENV_FILE"
+write_env
 echo "Detected resolution: ${WIDTH}x${HEIGHT}" >&2
@@ -0,0 +1,220 @@
+#!/bin/bash
+# v4l2-relayd-recover.sh — Recover a stalled IPU6 CSI-2 link
+#
+# Stops the relay, cleans the stale icamerasrc shared memory, unbinds and
+# rebinds the IPU6 ISYS to reset the CSI-2 link, and starts the relay again.
+#
+# Each step waits for the condition the next one needs instead of sleeping
+# for a fixed time: the relay's SHM segment detached, the ISYS driver
+# unbound / bound in sysfs, the sensor bound to it again and its nodes
+# processed by udev, and finally a real (non-blank) frame on the loopback
+# device. Recovery
+# used to take 6 s of sleeps plus the relay start; now it takes as long as
+# the hardware does.
+#
+# Every run appends its time to recovery (MTTR) and per-step times to
+# /var/lib/v4l2-relayd/recovery.log, one key=value line per recovery:
+#   2026-03-01T10:15:02+01:00 result=ok mttr_ms=3412 stop_ms=180 ...
+#
+# Usage: v4l2-relayd-recover.sh [--reason TEXT]   (as root)
+#        v4l2-relayd-recover.sh --stats           (MTTR summary)
+#
+# Started by v4l2-relayd-recover.service, the OnFailure= unit of the relay
+# once its restarts are used up, or by hand when the camera shows
+# "Frame sync error" and black frames.
+#
+# Installed to /usr/local/sbin/v4l2-relayd-recover.sh
+
+set -euo pipefail
+
+SERVICE="v4l2-relayd@default"
+LOOPBACK_DEV="/dev/video0"
+LOG_FILE="/var/lib/v4l2-relayd/recovery.log"
+MIN_JPEG_BYTES=10240  # 10KB — real frames are 15-200KB; blank < 8KB
+
+ISYS_DEVICE="intel_ipu6.isys.40"
+ISYS_DRIVER_PATH="/sys/bus/auxiliary/drivers/intel_ipu6_isys.isys"
+SHM_KEY="0x0043414d"  # icamerasrc shared memory key
+
+# Upper bounds for each wait; normally they return much sooner
+SHM_TIMEOUT_MS=5000
+UNBIND_TIMEOUT_MS=5000
+BIND_TIMEOUT_MS=15000
+FRAME_TIMEOUT_MS=30000
+
+log() { echo "$(date '+%Y-%m-%d %H:%M:%S') recover: $*"; }
+
+now_ms() {
+    if [[ -n "${EPOCHREALTIME:-}" ]]; then
+        local t=${EPOCHREALTIME/[.,]/}
+        echo $(( t / 1000 ))
+    else
+        date +%s%3N
+    fi
+}
+
+# wait_until TIMEOUT_MS COMMAND... — poll COMMAND every 50 ms until it
+# succeeds. Returns 1 on timeout.
+wait_until() {
+    local deadline=$(( $(now_ms) + $1 ))
+    shift
+    until "$@"; do
+        (( $(now_ms) < deadline )) || return 1
+        sleep 0.05
+    done
+}
+
+# --- Readiness checks ---
+
+shm_detached() {
+    # nattch column: no process has the segment attached any more
+    ! ipcs -m 2>/dev/null | awk -v key="$SHM_KEY" '$1 == key && $6 > 0 { found = 1 } END { exit !found }'
+}
+
+isys_unbound() { [[ ! -e "$ISYS_DRIVER_PATH/$ISYS_DEVICE" ]]; }
+isys_bound()   { [[ -e "$ISYS_DRIVER_PATH/$ISYS_DEVICE" ]]; }
+
+# The ISYS registers its capture nodes when it probes, and the sensor's
+# subdev node once the sensor has bound to the CSI-2 port again. Their
+# /dev nodes exist after udev has processed them (udevadm settle).
+sensor_ready() {
+    local node
+    compgen -G "/sys/bus/auxiliary/devices/$ISYS_DEVICE/video4linux/video*" > /dev/null || return 1
+    for node in /sys/bus/i2c/devices/i2c-OVTI*/video4linux/v4l-subdev*; do
+        [[ -e "$node" ]] && return 0
+    done
+    return 1
+}
+
+first_frame() {
+    local file size
+    file=$(mktemp /tmp/recover-frame-XXXXXX.jpg)
+    if timeout 6 ffmpeg -f v4l2 -i "$LOOPBACK_DEV" -frames:v 1 -update 1 -y "$file" 2>/dev/null; then
+        size=$(stat -c%s "$file" 2>/dev/null || echo 0)
+        rm -f "$file"
+        (( size > MIN_JPEG_BYTES ))
+        return
+    fi
+    rm -f "$file"
+    return 1
+}
+
+# --- Stats ---
+
+if [[ "${1:-}" == "--stats" ]]; then
+    [[ -r "$LOG_FILE" ]] || { echo "No recoveries recorded ($LOG_FILE)"; exit 0; }
+    times=$(grep ' result=ok ' "$LOG_FILE" | grep -o 'mttr_ms=[0-9]*' | cut -d= -f2 | sort -n) || true
+    failed=$(grep -vc ' result=ok ' "$LOG_FILE") || true
+    echo "Recoveries: $(wc -w <<< "$times") ok, $failed failed"
+    [[ -n "$times" ]] || exit 0
+    awk '{ t[NR] = $1; sum += $1 }
+         END { printf "MTTR: mean %d ms, median %d ms, max %d ms\n", sum / NR, t[int((NR + 1) / 2)], t[NR] }' <<< "$times"
+    exit 0
+fi
+
+REASON="manual"
+[[ "${1:-}" == "--reason" && -n "${2:-}" ]] && REASON="$2"
+
+[[ $EUID -eq 0 ]] || { echo "ERROR: must run as root" >&2; exit 1; }
+
+# --- Recovery ---
+
+declare -A STEP_MS=()
+START_MS=$(now_ms)
+STEP_START=$START_MS
+RESULT="ok"
+NOTE=""  # steps that timed out, the relay is started anyway
+
+# step NAME — record the time since the previous step under NAME
+step() {
+    local t
+    t=$(now_ms)
+    STEP_MS[$1]=$(( t - STEP_START ))
+    STEP_START=$t
+}
+
+record() {
+    local line name
+    line="$(date -Iseconds) result=$RESULT mttr_ms=$(( $(now_ms) - START_MS ))"
+    for name in stop shm unbind bind nodes start frame; do
+        [[ -n "${STEP_MS[$name]:-}" ]] && line+=" ${name}_ms=${STEP_MS[$name]}"
+    done
+    [[ -n "$NOTE" ]] && line+=" note=${NOTE# }"
+    line+=" kernel=$(uname -r) reason=${REASON// /_}"
+    mkdir -p "$(dirname "$LOG_FILE")"
+    echo "$line" >> "$LOG_FILE"
+    log "$line"
+}
+trap record EXIT
+
+log "=== Starting recovery ($REASON) ==="
+
+# 1. Stop relay. systemctl waits for the relay to exit; its SHM segment
+#    can stay attached for a moment while the HAL tears down.
+log "stopping $SERVICE..."
+systemctl stop "$SERVICE" 2>/dev/null || true
+step stop
+
+# 2. Clean stale SysV shared memory from icamerasrc
+if ipcs -m 2>/dev/null | grep -q "$SHM_KEY"; then
+    wait_until "$SHM_TIMEOUT_MS" shm_detached || log "SHM segment still attached, removing anyway"
+    log "cleaning stale SHM segment ($SHM_KEY)"
+    ipcrm -M "$SHM_KEY" 2>/dev/null || true
+fi
+step shm
+
+# 3. Unbind IPU6 ISYS to reset the CSI-2 link
+#    NOTE: Do NOT unload/reload ov02c10 — modprobe -r with IVSC loaded causes
+#    a kernel oops (page fault in v4l2_fwnode_endpoint_alloc_parse due to stale
+#    firmware node references). ISYS unbind/rebind alone resets the CSI link.
+if [[ ! -d "$ISYS_DRIVER_PATH" ]]; then
+    log "no IPU6 ISYS driver, skipping the link reset"
+    NOTE+=" no-isys"
+elif isys_bound; then
+    log "unbinding IPU6 ISYS..."
+    echo "$ISYS_DEVICE" 2>/dev/null > "$ISYS_DRIVER_PATH/unbind" || true
+    if ! wait_until "$UNBIND_TIMEOUT_MS" isys_unbound; then
+        log "ISYS did not unbind"
+        NOTE+=" unbind-timeout"
+    fi
+fi
+step unbind
+
+# 4. Rebind IPU6 ISYS, wait for the driver and the sensor behind it
+if [[ -d "$ISYS_DRIVER_PATH" ]]; then
+    if isys_unbound; then
+        log "rebinding IPU6 ISYS..."
+        echo "$ISYS_DEVICE" 2>/dev/null > "$ISYS_DRIVER_PATH/bind" || true
+    fi
+    if ! wait_until "$BIND_TIMEOUT_MS" isys_bound; then
+        log "ISYS did not bind, starting the relay anyway"
+        NOTE+=" bind-timeout"
+    fi
+    step bind
+    if isys_bound && ! wait_until "$BIND_TIMEOUT_MS" sensor_ready; then
+        log "sensor not bound to the ISYS yet"
+        NOTE+=" sensor-timeout"
+    fi
+fi
+udevadm settle --timeout=10 2>/dev/null || true
+step nodes
+
+# 5. Start relay (ExecStartPost handles udev trigger + WirePlumber restart).
+#    After OnFailure= the relay has hit its start limit, which would refuse
+#    the start.
+log "starting $SERVICE..."
+systemctl reset-failed "$SERVICE" 2>/dev/null || true
+if ! systemctl start "$SERVICE"; then
+    RESULT="start-failed"
+fi
+step start
+
+# 6. Recovered when a real frame comes through the loopback device
+if [[ "$RESULT" != "start-failed" ]] && wait_until "$FRAME_TIMEOUT_MS" first_frame; then
+    log "=== Recovery complete ==="
+else
+    [[ "$RESULT" == "ok" ]] && RESULT="no-frame"
+    log "=== Recovery failed ($RESULT${NOTE:+,$NOTE}) ==="
+fi
+step frame
+[[ "$RESULT" == "ok" ]]